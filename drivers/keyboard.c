@@ -1,12 +1,22 @@
 #include "keyboard.h"
 #include "idt.h"
 #include "vga.h"
+#include "timer.h"
+#include "process.h"
 
 // Keyboard buffer
 static char keyboard_buffer[KEYBOARD_BUFFER_SIZE];
+static uint64_t keyboard_stamp[KEYBOARD_BUFFER_SIZE];  // Arrival time (us)
 static int buffer_start = 0;
 static int buffer_end = 0;
 
+// Task sleeping in keyboard_getchar(), or NULL
+static process_t *keyboard_waiter = NULL;
+
+// Keyboard-to-echo latency
+static uint64_t last_key_stamp = 0;     // Arrival of the last key read
+static keyboard_latency_t latency;
+
 // Shift key state
 static int shift_pressed = 0;
 
@@ -90,11 +100,20 @@ void keyboard_handler(void) {
     if (ascii != 0) {
         // Add to buffer
         keyboard_buffer[buffer_end] = ascii;
+        keyboard_stamp[buffer_end] = timer_get_uptime_us();
         buffer_end = (buffer_end + 1) % KEYBOARD_BUFFER_SIZE;
+        
+        if (keyboard_waiter) {
+            process_unblock(keyboard_waiter->pid);
+            keyboard_waiter = NULL;
+        }
     }
     
     // Send EOI (End of Interrupt) to PIC
     outb(0x20, 0x20);
+    
+    // The reader may be ahead enough to run right away
+    schedule_if_needed();
 }
 
 void keyboard_init(void) {
@@ -103,16 +122,53 @@ void keyboard_init(void) {
 }
 
 char keyboard_getchar(void) {
-    // Wait for a character
+    uint32_t eflags = irq_save();
+    
+    // Sleep until the interrupt handler wakes us with a character
     while (buffer_start == buffer_end) {
-        __asm__ volatile("hlt");
+        keyboard_waiter = current_process;
+        process_block(current_process->pid);
+        
+        // Nothing else was ready, so we kept the CPU: wait for an
+        // interrupt (STI takes effect after HLT, so none is missed)
+        if (buffer_start == buffer_end) {
+            __asm__ volatile("sti; hlt; cli");
+        }
     }
+    keyboard_waiter = NULL;
     
     char c = keyboard_buffer[buffer_start];
+    last_key_stamp = keyboard_stamp[buffer_start];
     buffer_start = (buffer_start + 1) % KEYBOARD_BUFFER_SIZE;
+    irq_restore(eflags);
     return c;
 }
 
+void keyboard_echoed(void) {
+    uint64_t delay = timer_get_uptime_us() - last_key_stamp;
+    uint32_t us = delay > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)delay;
+    
+    latency.samples++;
+    latency.total_us += us;
+    latency.last_us = us;
+    if (us > latency.max_us) latency.max_us = us;
+    for (int i = 0; i < KEYBOARD_LATENCY_BUCKETS; i++) {
+        if (us < (1000u << i) || i == KEYBOARD_LATENCY_BUCKETS - 1) {
+            latency.buckets[i]++;
+            break;
+        }
+    }
+}
+
+void keyboard_get_latency(keyboard_latency_t *stats) {
+    if (stats) *stats = latency;
+}
+
+void keyboard_reset_latency(void) {
+    keyboard_latency_t empty = {0};
+    latency = empty;
+}
+
 int keyboard_available(void) {
     return buffer_start != buffer_end;
 }
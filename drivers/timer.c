@@ -4,6 +4,8 @@
 #include "process.h"
 #include "ktimer.h"
 
+#define PIT_FREQUENCY 1193180   // Input clock of the PIT (Hz)
+
 // Timer state
 static uint32_t tick = 0;
 static uint32_t timer_frequency = 0;
@@ -44,10 +46,8 @@ void timer_handler(void) {
     // Run kernel timers
     ktimer_run();
     
-    // Schedule every 10 ticks (approx 200ms at 50Hz, or 10ms at 1000Hz)
-    if (tick % 10 == 0) {
-        schedule();
-    }
+    // Charge the running task; switch when its slice is over
+    scheduler_tick();
 }
 
 void init_timer(uint32_t frequency) {
@@ -66,10 +66,12 @@ void init_timer(uint32_t frequency) {
 
     // The value we send to the PIT is the value to divide it's input clock
     // (1193180 Hz) by, to get our required frequency.
-    uint32_t divisor = 1193180 / frequency;
+    uint32_t divisor = PIT_FREQUENCY / frequency;
 
-    // Send the command byte.
-    outb(0x43, 0x36);
+    // Send the command byte: channel 0, low then high byte, mode 2
+    // (rate generator). The counter runs down once per tick, which
+    // timer_get_uptime_us() reads for the time within a tick.
+    outb(0x43, 0x34);
 
     // Divisor has to be sent byte-wise, so split here into upper/lower bytes.
     uint8_t l = (uint8_t)(divisor & 0xFF);
@@ -90,6 +92,28 @@ uint32_t timer_get_uptime_ms(void) {
     return (tick * 1000) / timer_frequency;
 }
 
+uint64_t timer_get_uptime_us(void) {
+    static uint64_t last_us = 0;
+    if (timer_frequency == 0) return 0;
+    
+    uint32_t eflags = irq_save();
+    uint32_t ticks = tick;
+    outb(0x43, 0x00);                   // Latch channel 0
+    uint32_t count = inb(0x40);
+    count |= (uint32_t)inb(0x40) << 8;
+    
+    // PIT input clock periods into this tick (838 ns each)
+    uint32_t divisor = PIT_FREQUENCY / timer_frequency;
+    uint32_t elapsed = count < divisor ? divisor - count : 0;
+    uint64_t us = (uint64_t)ticks * (1000000 / timer_frequency) + elapsed * 1000 / 1193;
+    
+    // The counter may have wrapped before its tick was handled
+    if (us < last_us) us = last_us;
+    last_us = us;
+    irq_restore(eflags);
+    return us;
+}
+
 void timer_wait(int ticks) {
     unsigned long eticks;
     eticks = tick + ticks;
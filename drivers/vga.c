@@ -1,8 +1,9 @@
 #include "vga.h"
 #include "string.h"
 #include "idt.h"
+#include "page.h"
 
-static uint16_t* vga_buffer = (uint16_t*)0xB8000;
+static uint16_t* vga_buffer = (uint16_t*)(KERNEL_VIRT_BASE + 0xB8000);
 static size_t vga_row = 0;
 static size_t vga_column = 0;
 static uint8_t vga_current_color = 0;
@@ -140,7 +141,7 @@ void vga_draw_splash_text(void) {
             else c = colors[4];             // S
             
             // Draw direct to memory to avoid cursor move
-             uint16_t *terminal = (uint16_t*)0xB8000;
+             uint16_t *terminal = (uint16_t*)(KERNEL_VIRT_BASE + 0xB8000);
              size_t index = (start_y + i) * VGA_WIDTH + (start_x + j);
              terminal[index] = (uint16_t)line[j] | (uint16_t)(c << 8);
         }
@@ -153,7 +154,7 @@ void vga_draw_splash_text(void) {
     int msg_y = 15;
     
     for(int k=0; k<msg_len; k++) {
-         uint16_t *terminal = (uint16_t*)0xB8000;
+         uint16_t *terminal = (uint16_t*)(KERNEL_VIRT_BASE + 0xB8000);
          size_t index = msg_y * VGA_WIDTH + (msg_x + k);
          terminal[index] = (uint16_t)msg[k] | (uint16_t)(VGA_COLOR_LIGHT_GREY << 8);
     }
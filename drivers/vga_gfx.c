@@ -1,5 +1,6 @@
 #include "vga_gfx.h"
 #include "idt.h" // For outb/inb
+#include "page.h"
 
 // VGA Registers
 #define VGA_AC_INDEX      0x3C0
@@ -23,7 +24,7 @@
 #define VGA_NUM_AC_REGS     21
 
 // Video memory for Mode 13h
-static uint8_t *vga_mem = (uint8_t*)0xA0000;
+static uint8_t *vga_mem = (uint8_t*)(KERNEL_VIRT_BASE + 0xA0000);
 
 // Register values for Mode 13h (320x200x256)
 static uint8_t g_320x200x256[] = {
@@ -0,0 +1,270 @@
+#include "zram.h"
+#include "blkdev.h"
+#include "slab.h"
+#include "memory.h"
+#include "pmm.h"
+#include "page.h"
+#include "lz4.h"
+#include "printk.h"
+#include "string.h"
+#include "idt.h"
+
+#define ZRAM_PAGE_SIZE    PMM_BLOCK_SIZE
+#define ZRAM_SECTOR_SIZE  512
+#define ZRAM_NR_PAGES     (ZRAM_DISK_SIZE / ZRAM_PAGE_SIZE)
+
+// Entry flags
+#define ZRAM_SAME   0x01        // value holds the fill word, no memory
+#define ZRAM_HUGE   0x02        // handle is a whole uncompressed frame
+
+// Compressed data goes into the smallest size class that holds it
+static const uint16_t zram_class_size[] = {64, 128, 192, 256, 384, 512, 768, 1024, 1536};
+#define ZRAM_NR_CLASSES (sizeof(zram_class_size) / sizeof(zram_class_size[0]))
+
+// One entry per page of the disk
+typedef struct {
+    void *handle;               // Compressed data (or raw frame), NULL if empty
+    uint32_t value;             // Fill word of a ZRAM_SAME page
+    uint16_t size;              // Compressed size
+    uint8_t class;              // Size class of handle
+    uint8_t flags;              // ZRAM_* flags
+} zram_entry_t;
+
+static zram_entry_t *zram_table;
+static kmem_cache_t *zram_caches[ZRAM_NR_CLASSES];
+static zram_stats_t zram_stats;
+
+// Scratch buffers (requests are serialized with interrupts off)
+static uint8_t zram_wrkmem[LZ4_WORKMEM_SIZE];
+static uint8_t zram_buffer[ZRAM_PAGE_SIZE];
+static uint8_t zram_compressed[ZRAM_HUGE_THRESHOLD];
+
+// Helper: Is the page one repeated 32-bit word? Stores it in *value.
+static int zram_page_same_filled(const uint8_t *page, uint32_t *value) {
+    const uint32_t *words = (const uint32_t *)page;
+    for (uint32_t i = 1; i < ZRAM_PAGE_SIZE / 4; i++) {
+        if (words[i] != words[0]) return 0;
+    }
+    *value = words[0];
+    return 1;
+}
+
+// Helper: Release whatever holds a page's data
+static void zram_free_page(uint32_t index) {
+    zram_entry_t *entry = &zram_table[index];
+
+    if (entry->flags & ZRAM_SAME) {
+        zram_stats.same_pages--;
+        zram_stats.pages_stored--;
+    } else if (entry->handle) {
+        if (entry->flags & ZRAM_HUGE) {
+            pmm_free_block(virt_to_phys(entry->handle));
+            zram_stats.huge_pages--;
+            zram_stats.mem_used -= ZRAM_PAGE_SIZE;
+        } else {
+            kmem_cache_free(zram_caches[entry->class], entry->handle);
+            zram_stats.mem_used -= zram_class_size[entry->class];
+        }
+        zram_stats.compr_data_size -= entry->size;
+        zram_stats.pages_stored--;
+    }
+
+    entry->handle = NULL;
+    entry->value = 0;
+    entry->size = 0;
+    entry->flags = 0;
+}
+
+// Helper: Read a whole page into buf
+static int zram_read_page(uint32_t index, uint8_t *buf) {
+    zram_entry_t *entry = &zram_table[index];
+
+    if (entry->flags & ZRAM_SAME || !entry->handle) {
+        // Never written pages read as zero
+        uint32_t *words = (uint32_t *)buf;
+        for (uint32_t i = 0; i < ZRAM_PAGE_SIZE / 4; i++) words[i] = entry->value;
+        return 0;
+    }
+
+    if (entry->flags & ZRAM_HUGE) {
+        memcpy(buf, entry->handle, ZRAM_PAGE_SIZE);
+        return 0;
+    }
+
+    if (lz4_decompress(entry->handle, entry->size, buf, ZRAM_PAGE_SIZE) != ZRAM_PAGE_SIZE) {
+        pr_err("zram: Corrupt page %u\n", index);
+        return -1;
+    }
+    return 0;
+}
+
+// Helper: Store a whole page from buf
+static int zram_write_page(uint32_t index, const uint8_t *buf) {
+    zram_entry_t *entry = &zram_table[index];
+    uint32_t value;
+
+    if (zram_page_same_filled(buf, &value)) {
+        zram_free_page(index);
+        entry->value = value;
+        entry->flags = ZRAM_SAME;
+        zram_stats.same_pages++;
+        zram_stats.pages_stored++;
+        return 0;
+    }
+
+    uint32_t size = lz4_compress(buf, ZRAM_PAGE_SIZE, zram_compressed,
+                                 sizeof(zram_compressed), zram_wrkmem);
+
+    // Allocate before dropping the old copy so a failed write keeps it
+    void *handle;
+    uint8_t class = 0, flags = 0;
+    if (size == 0) {
+        uint32_t frame = pmm_alloc_block();
+        if (!frame) return -1;
+        handle = phys_to_virt(frame);
+        memcpy(handle, buf, ZRAM_PAGE_SIZE);
+        size = ZRAM_PAGE_SIZE;
+        flags = ZRAM_HUGE;
+    } else {
+        while (zram_class_size[class] < size) class++;
+        handle = kmem_cache_alloc(zram_caches[class], GFP_KERNEL);
+        if (!handle) return -1;
+        memcpy(handle, zram_compressed, size);
+    }
+
+    zram_free_page(index);
+    entry->handle = handle;
+    entry->size = (uint16_t)size;
+    entry->class = class;
+    entry->flags = flags;
+
+    zram_stats.pages_stored++;
+    zram_stats.compr_data_size += size;
+    if (flags & ZRAM_HUGE) {
+        zram_stats.huge_pages++;
+        zram_stats.mem_used += ZRAM_PAGE_SIZE;
+    } else {
+        zram_stats.mem_used += zram_class_size[class];
+    }
+    return 0;
+}
+
+static int zram_submit(struct bio *bio) {
+    uint32_t offset = bio->sector * ZRAM_SECTOR_SIZE;
+    if (offset >= ZRAM_DISK_SIZE || bio->size > ZRAM_DISK_SIZE - offset) return -1;
+
+    uint32_t eflags = irq_save();
+    int ret = 0;
+
+    if (bio->rw == READ) zram_stats.reads++;
+    else zram_stats.writes++;
+
+    for (uint32_t done = 0; done < bio->size && ret == 0; ) {
+        uint32_t index = offset / ZRAM_PAGE_SIZE;
+        uint32_t in_page = offset % ZRAM_PAGE_SIZE;
+        uint32_t chunk = ZRAM_PAGE_SIZE - in_page;
+        if (chunk > bio->size - done) chunk = bio->size - done;
+        uint8_t *data = (uint8_t *)bio->data + done;
+
+        if (chunk == ZRAM_PAGE_SIZE) {
+            ret = (bio->rw == READ) ? zram_read_page(index, data)
+                                    : zram_write_page(index, data);
+        } else {
+            // Partial page: go through the bounce buffer
+            ret = zram_read_page(index, zram_buffer);
+            if (ret == 0 && bio->rw == READ) {
+                memcpy(data, zram_buffer + in_page, chunk);
+            } else if (ret == 0) {
+                memcpy(zram_buffer + in_page, data, chunk);
+                ret = zram_write_page(index, zram_buffer);
+            }
+        }
+
+        done += chunk;
+        offset += chunk;
+    }
+
+    irq_restore(eflags);
+    return ret;
+}
+
+// Drop the pages wholly inside a discarded range
+static void zram_discard(uint32_t sector, uint32_t nr_sectors) {
+    uint32_t start = sector * ZRAM_SECTOR_SIZE;
+    if (start >= ZRAM_DISK_SIZE) return;
+
+    uint32_t end = start + nr_sectors * ZRAM_SECTOR_SIZE;
+    if (end > ZRAM_DISK_SIZE || end < start) end = ZRAM_DISK_SIZE;
+
+    uint32_t eflags = irq_save();
+    for (uint32_t index = (start + ZRAM_PAGE_SIZE - 1) / ZRAM_PAGE_SIZE;
+         (index + 1) * ZRAM_PAGE_SIZE <= end; index++) {
+        zram_free_page(index);
+    }
+    irq_restore(eflags);
+}
+
+// lsblk details
+static void zram_show(struct block_device *bdev) {
+    (void)bdev;
+    uint32_t orig = zram_stats.pages_stored * (ZRAM_PAGE_SIZE / 1024);
+    uint32_t used = zram_stats.mem_used / 1024;
+
+    pr_info("    %u pages stored (%u same-filled, %u incompressible)\n",
+            zram_stats.pages_stored, zram_stats.same_pages, zram_stats.huge_pages);
+    pr_info("    data %u KB, compressed %u KB, memory %u KB\n",
+            orig, zram_stats.compr_data_size / 1024, used);
+
+    if (zram_stats.mem_used) {
+        uint32_t ratio = (zram_stats.pages_stored * ZRAM_PAGE_SIZE / 16) * 100 /
+                         (zram_stats.mem_used / 16);
+        pr_info("    ratio %u.%u%ux, saved %u KB\n",
+                ratio / 100, (ratio / 10) % 10, ratio % 10, orig > used ? orig - used : 0);
+    } else {
+        pr_info("    saved %u KB\n", orig);
+    }
+}
+
+static struct block_device zram_dev = {
+    .name = "zram0",
+    .size = ZRAM_DISK_SIZE / ZRAM_SECTOR_SIZE,
+    .queue = NULL,
+    .submit = zram_submit,
+    .discard = zram_discard,
+    .show = zram_show
+};
+
+void zram_init(void) {
+    zram_table = (zram_entry_t *)kmalloc(ZRAM_NR_PAGES * sizeof(zram_entry_t));
+    if (!zram_table) {
+        pr_err("zram: Cannot allocate page table\n");
+        return;
+    }
+    memset(zram_table, 0, ZRAM_NR_PAGES * sizeof(zram_entry_t));
+
+    for (uint32_t i = 0; i < ZRAM_NR_CLASSES; i++) {
+        char name[16] = "zram-";
+        uint32_t size = zram_class_size[i], len = 5;
+        char digits[8];
+        int n = 0;
+        while (size) {
+            digits[n++] = '0' + size % 10;
+            size /= 10;
+        }
+        while (n) name[len++] = digits[--n];
+        name[len] = '\0';
+
+        zram_caches[i] = kmem_cache_create(name, zram_class_size[i], 0, 0);
+        if (!zram_caches[i]) {
+            pr_err("zram: Cannot create %s cache\n", name);
+            return;
+        }
+    }
+
+    INIT_LIST_HEAD(&zram_dev.list);
+    blkdev_register(&zram_dev);
+}
+
+void zram_get_stats(zram_stats_t *stats) {
+    if (stats) *stats = zram_stats;
+}
@@ -1,6 +1,7 @@
 #include "fat12.h"
 #include "vga.h"
 #include "string.h"
+#include "page.h"
 
 // Address where bootloader loads the image (starting from Sector 1)
 #define RAMDISK_START 0x10000
@@ -30,8 +31,8 @@ static char current_path[256] = "/";
 // ============================================================================
 
 static uint8_t *get_sector_ptr(uint32_t lba) {
-    if (lba == 0) return (uint8_t*)BOOT_SECTOR;
-    return (uint8_t*)(RAMDISK_START + (lba - 1) * SECTOR_SIZE);
+    if (lba == 0) return (uint8_t*)phys_to_virt(BOOT_SECTOR);
+    return (uint8_t*)phys_to_virt(RAMDISK_START + (lba - 1) * SECTOR_SIZE);
 }
 
 // Parse filename into FAT12 format (8.3, uppercase, space-padded)
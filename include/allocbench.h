@@ -0,0 +1,75 @@
+#ifndef ALLOCBENCH_H
+#define ALLOCBENCH_H
+
+#include <stdint.h>
+#include "memprof.h"
+
+/**
+ * Allocator Trace Replay Benchmark
+ *
+ * Recording puts every allocation and free made through the profiler
+ * hooks (memprof.h) into a ring buffer: allocator, object and size.
+ * The buffer can be saved to the boot disk as a trace file and replayed
+ * against the allocators later, the same sequence every time, which
+ * gives cycles per operation (rdtsc), the peak footprint and the heap
+ * fragmentation for a realistic workload.
+ *
+ * Trace files are text, one event per line ('#' starts a comment):
+ *
+ *   a <type> <id> <size>     allocation
+ *   f <type> <id>            free of the live object with that id
+ *
+ * type is k (kmalloc), c (kmem_cache_alloc, size = object size) or
+ * p (page frame); id is a hex key naming the object while it is live.
+ * Traces are captured on the running system: "allocbench record", run
+ * the workload (fork storm, socket churn, a shell session), then
+ * "allocbench save <file>". Trace files put in bench/ are copied to the
+ * boot disk by the build.
+ */
+
+#define ALLOCBENCH_RING_SIZE   4096    // Events kept while recording (power of two)
+#define ALLOCBENCH_MAX_EVENTS  16384   // Largest trace that can be replayed
+#define ALLOCBENCH_MAX_CACHES  8       // Distinct object sizes of 'c' events
+
+/**
+ * allocbench_record_start - Clear the ring buffer and start recording
+ */
+void allocbench_record_start(void);
+
+/**
+ * allocbench_record_stop - Stop recording
+ */
+void allocbench_record_stop(void);
+
+/**
+ * allocbench_record - Add an event while recording (allocator hook)
+ * @type: Allocator
+ * @ptr: Object
+ * @size: Bytes allocated, 0 for a free
+ * @is_free: 1 for a free, 0 for an allocation
+ */
+void allocbench_record(memprof_type_t type, const void *ptr, uint32_t size, int is_free);
+
+/**
+ * allocbench_save - Write the recorded events to a trace file
+ * Returns: Number of events written, or -1 on error
+ */
+int allocbench_save(const char *filename);
+
+/**
+ * allocbench_replay - Replay a trace file and print the results
+ * @filename: Trace file on the boot disk
+ * @iterations: Times to run the trace
+ *
+ * Objects still live at the end of a run are freed (not timed).
+ *
+ * Returns: 0 on success, -1 if the trace cannot be loaded
+ */
+int allocbench_replay(const char *filename, uint32_t iterations);
+
+/**
+ * allocbench_show - Print the recording state
+ */
+void allocbench_show(void);
+
+#endif /* ALLOCBENCH_H */
@@ -34,6 +34,8 @@ struct block_device {
     uint32_t size;              // Size in sectors
     struct request_queue *queue; // Request queue
     int (*submit)(struct bio *bio); // Submit I/O
+    void (*discard)(uint32_t sector, uint32_t nr_sectors); // Data no longer needed (optional)
+    void (*show)(struct block_device *bdev); // Extra lsblk details (optional)
     struct list_head list;      // Device list
 };
 
@@ -51,11 +53,30 @@ void blkdev_init(void);
  */
 int blkdev_register(struct block_device *bdev);
 
+/**
+ * blkdev_show_devices - Print every registered block device (lsblk)
+ */
+void blkdev_show_devices(void);
+
+/**
+ * blkdev_find - Look up a registered block device by name
+ * Returns: Device or NULL
+ */
+struct block_device *blkdev_find(const char *name);
+
 /**
  * blkdev_submit_bio - Submit block I/O request
  */
 int blkdev_submit_bio(struct block_device *bdev, struct bio *bio);
 
+/**
+ * blkdev_discard - Tell a device a range of sectors holds no data any more
+ *
+ * Devices that keep data in memory (zram) release it. A later read of the
+ * range returns zeroes or stale data.
+ */
+void blkdev_discard(struct block_device *bdev, uint32_t sector, uint32_t nr_sectors);
+
 /**
  * blkdev_alloc_bio - Allocate bio structure
  */
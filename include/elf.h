@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 
+struct mm_struct;
+struct vm_file;
+
 /**
  * ELF (Executable and Linkable Format) Loader
  * 
@@ -81,17 +84,21 @@ typedef struct {
 int elf_validate(elf32_ehdr_t *ehdr);
 
 /**
- * elf_load - Load ELF binary into memory
- * @data: ELF file data
- * @size: File size
+ * elf_load - Set up the segments of an ELF image in an address space
+ * @mm: Empty user address space
+ * @file: Executable image
+ *
+ * Each PT_LOAD segment becomes a file-backed region; its pages are
+ * read from the image on first access.
+ *
  * Returns: Entry point address or 0 on error
  */
-uint32_t elf_load(void *data, uint32_t size);
+uint32_t elf_load(struct mm_struct *mm, struct vm_file *file);
 
 /**
- * elf_exec - Execute ELF binary
+ * elf_exec - Start an ELF binary as a new user process
  * @path: Path to ELF file
- * Returns: 0 on success, -1 on error
+ * Returns: PID on success, -1 on error
  */
 int elf_exec(const char *path);
 
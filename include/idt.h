@@ -42,4 +42,15 @@ static inline uint8_t inb(uint16_t port) {
     return ret;
 }
 
+// Disable interrupts, returning the previous EFLAGS for irq_restore()
+static inline uint32_t irq_save(void) {
+    uint32_t eflags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(eflags) :: "memory");
+    return eflags;
+}
+
+static inline void irq_restore(uint32_t eflags) {
+    __asm__ volatile("push %0; popf" :: "r"(eflags) : "memory", "cc");
+}
+
 #endif
@@ -0,0 +1,36 @@
+#ifndef KALLSYMS_H
+#define KALLSYMS_H
+
+#include <stdint.h>
+
+/**
+ * Kernel Symbol Table
+ *
+ * The build puts the kernel's function symbols (`nm -n` output, text
+ * symbols only) on the boot disk as KALLSYMS_FILE. The table is loaded
+ * from there on first use and maps code addresses back to function
+ * names for diagnostics.
+ */
+
+#define KALLSYMS_FILE "KERNEL.MAP"
+
+/**
+ * kallsyms_load - Read the symbol table from the boot disk
+ *
+ * Does nothing if it is already loaded.
+ *
+ * Returns: 0 on success, -1 if the file is missing, malformed or on OOM
+ */
+int kallsyms_load(void);
+
+/**
+ * kallsyms_lookup - Find the function containing an address
+ * @addr: Code address
+ * @offset: Set to addr minus the function start (may be NULL)
+ *
+ * Returns: Function name, or NULL if the table is not loaded or addr
+ * lies below the first symbol
+ */
+const char *kallsyms_lookup(uint32_t addr, uint32_t *offset);
+
+#endif /* KALLSYMS_H */
@@ -4,13 +4,31 @@
 #include <stdint.h>
 
 #define KEYBOARD_BUFFER_SIZE 256
+#define KEYBOARD_LATENCY_BUCKETS 8    // <1, <2, <4 ... <64 ms, and the rest
+
+// Keyboard-to-echo latency: time from the key interrupt until the
+// reader reports the character echoed (microseconds)
+typedef struct {
+    uint32_t samples;
+    uint32_t total_us;          // Sum of all samples (for the average)
+    uint32_t max_us;
+    uint32_t last_us;
+    uint32_t buckets[KEYBOARD_LATENCY_BUCKETS]; // Bucket i: under 2^i ms
+} keyboard_latency_t;
 
 // Initialize keyboard driver
 void keyboard_init(void);
 
-// Get a character from the keyboard buffer (blocking)
+// Get a character from the keyboard buffer (sleeps until a key arrives)
 char keyboard_getchar(void);
 
+// The character last returned by keyboard_getchar() is on the screen
+void keyboard_echoed(void);
+
+// Keyboard-to-echo latency statistics
+void keyboard_get_latency(keyboard_latency_t *stats);
+void keyboard_reset_latency(void);
+
 // Check if a key is available
 int keyboard_available(void);
 
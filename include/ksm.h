@@ -0,0 +1,42 @@
+#ifndef KSM_H
+#define KSM_H
+
+#include <stdint.h>
+
+/**
+ * Kernel Same-page Merging (Linux-inspired)
+ *
+ * ksmd periodically walks the user pages of every address space and
+ * merges pages with identical contents into a single read-only frame
+ * (a KSM page). Mappings of writable regions are marked copy-on-write,
+ * so the first write to a merged page gives the writer a private copy
+ * again.
+ *
+ * Pages are found by checksum. KSM pages live in the stable tree; pages
+ * seen once so far in the current pass wait in the unstable tree until
+ * a twin turns up. The unstable tree is rebuilt every pass.
+ */
+
+#define KSM_PAGES_TO_SCAN  100     // Present pages examined per round
+#define KSM_SLEEP_MS       100     // Pause between rounds
+
+// KSM statistics
+typedef struct {
+    uint32_t pages_shared;      // KSM pages in use
+    uint32_t pages_sharing;     // Extra mappings of them (pages saved)
+    uint32_t pages_unshared;    // Unique pages last pass, waiting for a twin
+    uint32_t pages_scanned;     // Pages examined
+    uint32_t full_scans;        // Completed passes over all address spaces
+} ksm_stats_t;
+
+/**
+ * ksm_init - Start the ksmd scanner thread
+ */
+void ksm_init(void);
+
+/**
+ * ksm_get_stats - Get KSM statistics (updated at the end of each pass)
+ */
+void ksm_get_stats(ksm_stats_t *stats);
+
+#endif /* KSM_H */
@@ -0,0 +1,46 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+
+/**
+ * LZ4 Block Compression
+ *
+ * Compressor and decompressor for the LZ4 block format (no frame
+ * header or checksum). The compressor is the simple greedy variant:
+ * one hash table of 4-byte sequences, no lazy matching. Inputs are
+ * limited to 64KB, which covers page-sized blocks.
+ */
+
+// Scratch space lz4_compress() needs (hash table)
+#define LZ4_HASH_BITS    12
+#define LZ4_WORKMEM_SIZE ((1 << LZ4_HASH_BITS) * sizeof(uint16_t))
+
+/**
+ * lz4_compress - Compress a block
+ * @src: Input
+ * @src_len: Input size (at most 64KB)
+ * @dst: Output buffer
+ * @dst_cap: Output buffer size
+ * @wrkmem: LZ4_WORKMEM_SIZE bytes of scratch space
+ *
+ * Returns: Compressed size, or 0 if it does not fit in dst_cap
+ */
+uint32_t lz4_compress(const uint8_t *src, uint32_t src_len,
+                      uint8_t *dst, uint32_t dst_cap, void *wrkmem);
+
+/**
+ * lz4_decompress - Decompress a block
+ * @src: Compressed input
+ * @src_len: Compressed size
+ * @dst: Output buffer
+ * @dst_cap: Output buffer size
+ *
+ * Malformed input never reads or writes out of bounds.
+ *
+ * Returns: Decompressed size, or -1 on malformed input
+ */
+int lz4_decompress(const uint8_t *src, uint32_t src_len,
+                   uint8_t *dst, uint32_t dst_cap);
+
+#endif /* LZ4_H */
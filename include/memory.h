@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "pmm.h"
 
 // BIOS E820 Memory Map Entry
 typedef struct {
@@ -16,6 +17,11 @@ typedef struct {
 #define MEMORY_AVAILABLE 1
 #define MEMORY_RESERVED  2
 
+// Where boot.asm leaves the E820 map (entry count, then the entries)
+#define E820_COUNT_ADDR  0x7000
+#define E820_MAP_ADDR    0x7004
+#define E820_MAX_ENTRIES 128
+
 // Block size for PMM (4KB)
 #define BLOCK_SIZE 4096
 #define BLOCKS_PER_BYTE 8
@@ -23,11 +29,53 @@ typedef struct {
 // Functions
 void memory_init(void);
 
+// Read the BIOS E820 map into PMM regions (sorted, clipped to 4GB)
+// Returns: number of regions filled in
+uint32_t memory_detect(memory_region_t *regions, uint32_t max_regions);
+
 // Physical Memory Manager
 // PMM Functions handled in pmm.h
 
-// Heap Allocator
+// General purpose allocation: requests up to KMALLOC_MAX_CACHE_SIZE come
+// from the kmalloc-N slab caches, larger ones from the heap
 void *kmalloc(size_t size);
+void *kzalloc(size_t size);     // kmalloc() returning zeroed memory
 void kfree(void *ptr);
 
+// Usable size of an allocation (at least what was asked for)
+size_t ksize(const void *ptr);
+
+// Resize an allocation, in place when its size class or the free heap
+// space above it allows. Returns NULL (leaving ptr intact) on failure.
+void *krealloc(void *ptr, size_t size);
+
+// Allocate size bytes starting on an align boundary (power of two)
+// Freed with kfree()
+void *kmalloc_aligned(size_t size, size_t align);
+
+// Heap Allocator (TLSF: O(1) heap_alloc/heap_free, 8-byte aligned)
+// Also backs allocator metadata, which must not come from the slab caches
+void *heap_alloc(size_t size);
+void heap_free(void *ptr);
+
+// Heap statistics (bytes include block headers)
+typedef struct {
+    uint32_t total;             // Heap size
+    uint32_t used;              // Allocated
+    uint32_t allocs;            // Successful allocations
+    uint32_t frees;
+    uint32_t failures;          // Allocations that found no block
+    uint32_t free_blocks;       // Free blocks
+    uint32_t largest_free;      // Largest allocation that would succeed
+    uint32_t fragmentation;     // Percent of free memory outside the largest block
+    uint32_t grown;             // Pages mapped to grow the heap
+    uint32_t shrunk;            // Pages given back to the PMM
+} heap_stats_t;
+
+void heap_get_stats(heap_stats_t *stats);
+
+// Give the free top of the heap back to the PMM (memory pressure)
+// Returns: number of pages released
+uint32_t heap_shrink(void);
+
 #endif
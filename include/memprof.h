@@ -0,0 +1,85 @@
+#ifndef MEMPROF_H
+#define MEMPROF_H
+
+#include <stdint.h>
+
+/**
+ * Allocation Profiler
+ *
+ * An opt-in mode that charges every kmalloc(), kmem_cache_alloc() and
+ * page frame allocation to the code that asked for it: the return
+ * address of the allocator call. Call sites live in a hash table with
+ * their allocation count, bytes and live (not yet freed) objects; a
+ * second table maps each live object back to its site so frees are
+ * credited to the right one. Sites are named with the kernel symbol
+ * table (kallsyms.h).
+ *
+ * Only allocations made while profiling is on are tracked. When the
+ * object table is full further allocations are counted as untracked.
+ * The hooks also feed the trace recorder (allocbench.h).
+ */
+
+#define MEMPROF_MAX_SITES    256    // Call sites (power of two)
+#define MEMPROF_MAX_OBJECTS  2048   // Live objects (power of two)
+
+// Allocator an allocation came from
+typedef enum {
+    MEMPROF_KMALLOC,            // kmalloc() family (slab or heap)
+    MEMPROF_SLAB,               // kmem_cache_alloc() on a named cache
+    MEMPROF_PAGE,               // Page frame (pmm_alloc_block/zeroed)
+    MEMPROF_NR_TYPES
+} memprof_type_t;
+
+// One call site
+typedef struct {
+    uint32_t caller;            // Return address of the allocator call
+    uint8_t type;               // memprof_type_t
+    uint32_t allocs;            // Allocations made
+    uint32_t frees;             // Of which freed again
+    uint32_t bytes;             // Bytes allocated in total
+    uint32_t live_objs;         // Allocations not freed yet
+    uint32_t live_bytes;
+    unsigned long first_seen;   // jiffies of the first and last allocation
+    unsigned long last_seen;
+} memprof_site_t;
+
+/**
+ * memprof_enable - Turn tracking on (1) or off (0)
+ *
+ * Turning it on again keeps earlier records; see memprof_reset().
+ */
+void memprof_enable(int on);
+
+/**
+ * memprof_enabled - Is tracking on?
+ */
+int memprof_enabled(void);
+
+/**
+ * memprof_reset - Forget every site and live object
+ */
+void memprof_reset(void);
+
+/**
+ * memprof_alloc - Record an allocation (allocator hook)
+ * @type: Allocator
+ * @ptr: Object (virtual address, or physical for frames); NULL is ignored
+ * @size: Bytes handed out
+ * @caller: Return address of the allocator entry point
+ */
+void memprof_alloc(memprof_type_t type, const void *ptr, uint32_t size, void *caller);
+
+/**
+ * memprof_free - Record a free (allocator hook)
+ *
+ * Objects allocated while tracking was off are not known and ignored.
+ */
+void memprof_free(memprof_type_t type, const void *ptr);
+
+/**
+ * memprof_show - Print the top call sites
+ * @max: Number of sites to print, by live bytes
+ */
+void memprof_show(uint32_t max);
+
+#endif /* MEMPROF_H */
@@ -0,0 +1,256 @@
+#ifndef MM_H
+#define MM_H
+
+#include <stdint.h>
+#include "list.h"
+#include "rbtree.h"
+
+/**
+ * User Address Space Regions (Linux-inspired VMAs)
+ *
+ * Each user process owns an address space (mm_struct) describing what it
+ * has mapped as a set of regions.
+ * Pages inside a region are only populated when first touched:
+ * - File-backed regions (ELF segments) are filled from the executable image
+ * - Anonymous regions (stack, brk heap) are filled with zeroes
+ */
+
+// Region flags
+#define VM_READ      0x1
+#define VM_WRITE     0x2
+#define VM_EXEC      0x4
+#define VM_GROWSDOWN 0x8    // Stack
+
+// User address space layout
+#define USER_HEAP_START 0x80000000          // brk heap starts at 2GB
+#define USER_STACK_TOP  0xC0000000          // Stack grows down from 3GB
+#define USER_STACK_SIZE (4096 * 256)        // 1MB reserved, populated on demand
+
+/**
+ * vm_file - In-memory executable image backing file regions
+ *
+ * Shared (refcounted) by every region and forked address space using it.
+ */
+typedef struct vm_file {
+    uint8_t *data;              // Image contents (kmalloc'd, owned)
+    uint32_t size;              // Image size in bytes
+    uint32_t refcount;
+} vm_file_t;
+
+/**
+ * vm_area - A contiguous range of user virtual memory
+ *
+ * [start, end) is page aligned. For file-backed regions the bytes
+ * [file_vaddr, file_vaddr + file_size) come from the image at
+ * file_offset; everything else in the region reads as zero.
+ */
+typedef struct vm_area {
+    uint32_t start;             // First address (page aligned)
+    uint32_t end;               // One past the last address (page aligned)
+    uint32_t flags;             // VM_* flags
+
+    vm_file_t *file;            // Backing image, NULL for anonymous memory
+    uint32_t file_offset;       // Image offset of file_vaddr
+    uint32_t file_vaddr;        // First address backed by the image
+    uint32_t file_size;         // Bytes backed by the image
+
+    struct rb_node rb;          // Node in mm->mm_rb (keyed by address)
+    struct list_head list;      // Link in mm->mmap (address order)
+} vm_area_t;
+
+/**
+ * mm_struct - A user address space
+ *
+ * Owns the page directory and every region mapped in it. Regions are
+ * kept in a red-black tree for O(log n) lookup from the fault handler
+ * and in a sorted list for cheap in-order walks (fork, teardown).
+ */
+typedef struct mm_struct {
+    uint32_t pgd;               // Page directory (physical)
+    struct rb_root mm_rb;       // Regions by address
+    struct list_head mmap;      // Regions in address order
+    uint32_t map_count;         // Number of regions
+
+    uint32_t start_brk;         // Start of the brk heap
+    uint32_t brk;               // Current program break
+
+    uint32_t users;             // Processes sharing this address space
+    struct list_head mmlist;    // Link in the list of all address spaces
+} mm_struct_t;
+
+/**
+ * vm_file_create - Wrap a kmalloc'd image buffer (takes ownership)
+ */
+vm_file_t *vm_file_create(uint8_t *data, uint32_t size);
+
+/**
+ * vm_file_put - Drop a reference, freeing the image with the last one
+ */
+void vm_file_put(vm_file_t *file);
+
+/**
+ * mm_create - Create an empty address space
+ *
+ * The new page directory shares the kernel mappings only.
+ *
+ * Returns: Address space with one user, or NULL on out of memory
+ */
+mm_struct_t *mm_create(void);
+
+/**
+ * mm_dup - Copy an address space for fork
+ * @old: Address space to copy
+ *
+ * Regions are duplicated; populated pages are shared copy-on-write.
+ *
+ * Returns: New address space, or NULL on out of memory
+ */
+mm_struct_t *mm_dup(mm_struct_t *old);
+
+/**
+ * mm_put - Drop a user, tearing the address space down with the last one
+ *
+ * Frees every region, every user frame and the page directory. The
+ * address space must not be the active one.
+ */
+void mm_put(mm_struct_t *mm);
+
+/**
+ * mm_next - Iterate over every live address space
+ * @mm: Previous address space, NULL to start
+ *
+ * The list may change whenever interrupts are enabled.
+ *
+ * Returns: Next address space, or NULL at the end
+ */
+mm_struct_t *mm_next(mm_struct_t *mm);
+
+/**
+ * mm_add_area - Add a region to an address space
+ * @mm: Address space
+ * @start: Start address (rounded down to a page)
+ * @end: End address (rounded up to a page)
+ * @flags: VM_* flags
+ * @file: Backing image or NULL (a reference is taken)
+ * @file_offset: Image offset of file_vaddr
+ * @file_vaddr: First address backed by the image
+ * @file_size: Bytes backed by the image
+ *
+ * Nothing is mapped; pages are populated on first access.
+ *
+ * Returns: Region, or NULL if it overlaps an existing one or on OOM
+ */
+vm_area_t *mm_add_area(mm_struct_t *mm, uint32_t start, uint32_t end,
+                       uint32_t flags, vm_file_t *file, uint32_t file_offset,
+                       uint32_t file_vaddr, uint32_t file_size);
+
+/**
+ * mm_find_area - Find the region containing addr
+ * Returns: Region or NULL
+ */
+vm_area_t *mm_find_area(mm_struct_t *mm, uint32_t addr);
+
+/**
+ * mm_unmap - Remove [start, end) from an address space
+ * @mm: Address space
+ * @start: Start address (page aligned)
+ * @end: End address (page aligned)
+ *
+ * Regions partly inside the range are split. Populated pages are
+ * unmapped and their frames released.
+ *
+ * Returns: 0 on success, -1 on out of memory
+ */
+int mm_unmap(mm_struct_t *mm, uint32_t start, uint32_t end);
+
+/**
+ * mm_protect - Change the access flags of [start, end)
+ * @mm: Address space
+ * @start: Start address (page aligned)
+ * @end: End address (page aligned)
+ * @flags: New VM_READ/VM_WRITE/VM_EXEC flags
+ *
+ * Regions partly inside the range are split; populated pages are
+ * updated in place.
+ *
+ * Returns: 0 on success, -1 if part of the range is unmapped or on OOM
+ */
+int mm_protect(mm_struct_t *mm, uint32_t start, uint32_t end, uint32_t flags);
+
+/**
+ * mm_populate_page - Allocate and fill the page at addr from its region
+ * @mm: Address space owning the region
+ * @vma: Region containing addr
+ * @addr: Address inside the page to populate
+ *
+ * Returns: 0 on success, -1 on out of memory
+ */
+int mm_populate_page(mm_struct_t *mm, vm_area_t *vma, uint32_t addr);
+
+/**
+ * mm_handle_fault - Demand paging entry point from the page fault handler
+ * @addr: Faulting address (CR2)
+ * @err_code: Page fault error code
+ *
+ * Returns: 1 if the fault was resolved, 0 if it is a real fault
+ */
+int mm_handle_fault(uint32_t addr, uint32_t err_code);
+
+/**
+ * mm_migrate_page - Move a user frame's contents to a new frame
+ * @old_phys: Frame to vacate
+ *
+ * Every PTE mapping the frame, in any address space, is switched to the
+ * copy. Fails if the mappings found do not account for all references
+ * to the frame (it is pinned by someone else). Called by compaction with
+ * interrupts disabled.
+ *
+ * Returns: The new frame, or 0 if the page could not be moved
+ */
+uint32_t mm_migrate_page(uint32_t old_phys);
+
+/**
+ * mm_page_referenced - Test and clear the accessed bit of a user frame
+ * @phys: Frame
+ * @vaddr: User address it is mapped at
+ *
+ * Returns: Number of mappings that had accessed the page
+ */
+int mm_page_referenced(uint32_t phys, uint32_t vaddr);
+
+/**
+ * mm_page_mkclean - Clear the dirty bit of a user frame's mapping
+ * @phys: Frame (mapped exactly once)
+ * @vaddr: User address it is mapped at
+ *
+ * Done before the frame is copied to swap, so a write made while the copy
+ * is in flight shows up in mm_unmap_to_swap().
+ *
+ * Returns: 1 on success, 0 if no mapping was found
+ */
+int mm_page_mkclean(uint32_t phys, uint32_t vaddr);
+
+/**
+ * mm_unmap_to_swap - Replace the mapping of a frame with a swap entry
+ * @phys: Frame (mapped exactly once)
+ * @vaddr: User address it is mapped at
+ * @entry: Swap entry to store in the PTE
+ *
+ * Returns: 1 on success, 0 if no mapping was found or the page was
+ * written since mm_page_mkclean()
+ */
+int mm_unmap_to_swap(uint32_t phys, uint32_t vaddr, uint32_t entry);
+
+/**
+ * mm_brk - Move the program break
+ * @mm: Address space
+ * @new_brk: Requested break (start_brk..USER_STACK_TOP - USER_STACK_SIZE)
+ *
+ * Growing only extends the heap region; pages appear on first touch.
+ * Shrinking unmaps and frees the pages past the new break.
+ *
+ * Returns: New break, or the current one if the request is invalid
+ */
+uint32_t mm_brk(mm_struct_t *mm, uint32_t new_brk);
+
+#endif /* MM_H */
@@ -0,0 +1,42 @@
+#ifndef PAGE_H
+#define PAGE_H
+
+#include <stdint.h>
+
+/**
+ * Kernel Virtual Memory Layout (higher half)
+ *
+ *   0x00000000 - 0xBFFFFFFF  User space (per process)
+ *   0xC0000000 - 0xF7FFFFFF  Linear map of physical RAM (lowmem, 896MB)
+ *   0xF8000000 - 0xFBFFFFFF  Kernel heap (grows on demand)
+ *   0xFC000000 - 0xFFBFFFFF  Reserved for other kernel mappings
+ *   0xFFC00000 - 0xFFFFFFFF  Page tables of the active directory (recursive PDE)
+ *
+ * The kernel image is loaded at physical 0x10000 and linked at
+ * KERNEL_VIRT_BASE + 0x10000. All RAM handed out by the PMM lies in
+ * lowmem, so any frame can be reached with phys_to_virt().
+ */
+
+#define KERNEL_VIRT_BASE  0xC0000000
+#define LOWMEM_END        0x38000000    // Physical RAM covered by the linear map
+#define KERNEL_MAP_START  0xF8000000    // First address above the linear map
+#define KERNEL_HEAP_START KERNEL_MAP_START
+#define KERNEL_HEAP_END   0xFC000000
+
+// Page directory slot mapping the directory onto itself
+#define RECURSIVE_PDE     1023
+#define PAGE_TABLES_BASE  0xFFC00000    // Page table N at PAGE_TABLES_BASE + N * 4KB
+#define PAGE_DIR_VIRT     0xFFFFF000    // The active page directory
+
+// kernel_entry.asm maps this much RAM before vmm_init() runs
+#define BOOT_MAPPED_END   0x1000000
+
+static inline void *phys_to_virt(uint32_t phys) {
+    return (void *)(phys + KERNEL_VIRT_BASE);
+}
+
+static inline uint32_t virt_to_phys(const void *virt) {
+    return (uint32_t)virt - KERNEL_VIRT_BASE;
+}
+
+#endif /* PAGE_H */
@@ -2,10 +2,14 @@
 #define PMM_H
 
 #include <stdint.h>
+#include "list.h"
 
 // 4KB Block Size
 #define PMM_BLOCK_SIZE 4096
 
+// Buddy allocator orders: order n is a block of 2^n pages (order 10 = 4MB)
+#define PMM_MAX_ORDER 11
+
 // Memory region structure
 typedef struct {
     uint32_t base;
@@ -13,17 +17,89 @@ typedef struct {
     uint32_t type; // 1 = usable, 2 = reserved
 } memory_region_t;
 
+#define MEMORY_REGION_USABLE   1
+#define MEMORY_REGION_RESERVED 2
+
+/**
+ * page - Per-frame descriptor
+ *
+ * One entry per physical 4KB frame, kept in the mem_map array.
+ * While a frame heads a free buddy block, @list links it into the
+ * free list for @order. Allocated frames carry a reference count so
+ * they can be shared between address spaces (copy-on-write). Mapped
+ * user frames are kept on an LRU list instead and record the user
+ * address they live at in @index.
+ */
+typedef struct page {
+    struct list_head list;      // Free-list link (buddy)
+    uint16_t flags;             // PG_* flags
+    uint8_t order;              // Order of the free block headed by this page
+    uint8_t _pad;
+    uint32_t refcount;          // Mappings/users of an allocated frame
+    uint32_t index;             // User address of an LRU page (reverse map),
+                                // slab descriptor of a slab page
+} page_t;
+
+// Page flags
+#define PG_BUDDY    0x0001      // Page heads a free block in the buddy free lists
+#define PG_ZEROED   0x0002      // Page sits cleared in the zeroed pool
+#define PG_MOVABLE  0x0004      // User page: compaction may migrate it
+#define PG_ISOLATED 0x0008      // Claimed by compaction for the block it builds
+#define PG_LRU      0x0010      // On an LRU list (swap.h), linked through @list
+#define PG_ACTIVE   0x0020      // On the active rather than the inactive LRU list
+#define PG_KSM      0x0040      // Merged page shared read-only by KSM (ksm.h)
+#define PG_SLAB     0x0080      // Holds objects of the slab in @index (slab.h)
+
 // Functions
-void pmm_init(uint32_t mem_size);
+// Build the free lists from a sorted memory map (usable regions become
+// free, everything else stays reserved)
+void pmm_init(const memory_region_t *regions, uint32_t count);
 
 // Single block allocation
 uint32_t pmm_alloc_block(void);
 void pmm_free_block(uint32_t addr);
 
+// Single block that reads as zero. Taken from a pool of frames cleared
+// ahead of time by the idle zeroing thread; cleared on the spot when the
+// pool is empty. Free with pmm_free_block()/pmm_unref_block().
+uint32_t pmm_alloc_zeroed(void);
+
+// Start the low-priority thread keeping the zeroed pool filled
+void pmm_zero_pool_init(void);
+
+// Free frame watermarks. Below low, kswapd is woken to run the shrinkers
+// (shrinker.h) and swap until free frames are back above high. The
+// zeroed pool never takes free frames below high.
+#define PMM_WMARK_LOW   128     // 512KB
+#define PMM_WMARK_HIGH  256     // 1MB
+
+// Returns 0 on success, -1 unless 0 < low < high < total frames
+int pmm_set_watermarks(uint32_t low, uint32_t high);
+void pmm_get_watermarks(uint32_t *low, uint32_t *high);
+
 // Contiguous block allocation
 uint32_t pmm_alloc_blocks(uint32_t count);
 void pmm_free_blocks(uint32_t addr, uint32_t count);
 
+// Power-of-two block allocation (2^order contiguous, naturally aligned blocks)
+uint32_t pmm_alloc_order(uint32_t order);
+void pmm_free_order(uint32_t addr, uint32_t order);
+
+// Compaction: build a free naturally aligned block of 2^order frames by
+// migrating the movable pages out of the cheapest candidate range.
+// Returns the block, allocated like pmm_alloc_order(), or 0.
+uint32_t pmm_compact(uint32_t order);
+
+// Frame descriptor lookup (NULL past the end of RAM)
+page_t *pmm_phys_to_page(uint32_t addr);
+uint32_t pmm_page_to_phys(page_t *page);
+
+// Frame reference counting (allocation returns a frame with count 1;
+// the frame is freed when the last reference is dropped)
+void pmm_ref_block(uint32_t addr);
+void pmm_unref_block(uint32_t addr);
+uint32_t pmm_block_refcount(uint32_t addr);
+
 // Reserve specific memory region
 void pmm_reserve_region(uint32_t start, uint32_t size);
 
@@ -32,4 +108,29 @@ void pmm_get_stats(uint32_t *total, uint32_t *used);
 uint32_t pmm_get_free_memory(void);
 uint32_t pmm_get_total_memory(void);
 
+// Free block count for each order (array of PMM_MAX_ORDER entries)
+void pmm_get_order_stats(uint32_t *free_blocks);
+
+// Zeroed pool statistics
+typedef struct {
+    uint32_t pooled;            // Frames currently cleared and waiting
+    uint32_t hits;              // pmm_alloc_zeroed() served from the pool
+    uint32_t misses;            // pmm_alloc_zeroed() that had to clear inline
+    uint32_t refilled;          // Frames cleared by the idle thread
+} pmm_zero_stats_t;
+
+void pmm_get_zero_stats(pmm_zero_stats_t *stats);
+
+// Compaction statistics
+typedef struct {
+    uint32_t pages_migrated;    // Frames moved to a new location
+    uint32_t migrate_failed;    // Frames that could not be moved (pinned)
+    uint32_t compact_success;   // Compaction runs that produced a block
+    uint32_t compact_fail;      // Compaction runs that gave up
+    uint32_t highorder_success; // Multi-page allocations satisfied
+    uint32_t highorder_fail;    // Multi-page allocations failed
+} pmm_compact_stats_t;
+
+void pmm_get_compact_stats(pmm_compact_stats_t *stats);
+
 #endif
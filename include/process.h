@@ -3,9 +3,31 @@
 
 #include <stdint.h>
 #include "list.h"
+#include "rbtree.h"
 
 // Forward declaration
 typedef void (*sighandler_t)(int);
+struct mm_struct;
+
+// Scheduling
+// Fair scheduling (Linux CFS): every task accumulates virtual runtime,
+// the CPU time it used scaled by NICE_0_WEIGHT / weight, and the READY
+// task with the least virtual runtime runs next. READY tasks wait in a
+// red-black tree keyed by virtual runtime, with the leftmost node
+// cached. Priority (0-255) maps onto a nice level and its load weight,
+// so a task's share of the CPU is its weight over the total weight of
+// the runnable tasks. Within SCHED_LATENCY_US every runnable task gets
+// a slice in proportion to its weight (never shorter than the minimum
+// granularity). A task waking up is placed no further back than half a
+// period behind the queue, and preempts the running task if it is
+// ahead by more than the wakeup granularity. Blocked tasks are on no
+// run queue; every task is on the task list and in the PID hash.
+#define SCHED_LATENCY_US            60000   // Period in which every runnable task runs
+#define SCHED_MIN_GRANULARITY_US    10000   // Shortest slice before a tick may preempt
+#define SCHED_WAKEUP_GRANULARITY_US 5000    // Lead a waking task needs to preempt
+#define SCHED_NR_LATENCY (SCHED_LATENCY_US / SCHED_MIN_GRANULARITY_US)
+#define NICE_0_WEIGHT               1024    // Weight of DEFAULT_PRIORITY (nice 0)
+#define PID_HASH_SIZE     64
 
 // Process states
 typedef enum {
@@ -20,20 +42,45 @@ typedef struct process {
     uint32_t pid;        // Process ID
     uint32_t kernel_stack_top; // For TSS: where to restart kernel stack on interrupt
     uint32_t cr3;        // Page Directory Physical Address
-    struct list_head list;     // Linux-style linked list node
+    struct rb_node run_node;    // Node in the fair run queue (READY tasks)
+    int on_rq;                  // run_node is in the run queue
+    struct list_head tasks;     // Link in the list of all tasks
+    struct list_head pid_chain; // Link in the PID hash bucket
     
     // Preemptive multitasking fields
     process_state_t state;      // Current process state
     uint8_t priority;           // 0-255 (higher = more priority)
-    uint32_t time_slice;        // Remaining ticks in current slice
+    uint32_t weight;            // Load weight of the priority
+    uint64_t vruntime;          // Virtual runtime (weighted microseconds)
+    uint64_t exec_start;        // Clock (us) when last charged for running
+    uint64_t sum_exec_runtime;  // Microseconds executed
+    uint64_t prev_sum_exec_runtime; // sum_exec_runtime when last picked
     uint32_t total_runtime;     // Total ticks executed
     char name[32];              // Process name for debugging
     
     // Signal handling
     uint32_t pending_signals;   // Bitmap of pending signals
     sighandler_t signal_handlers[32];  // Signal handlers
+    
+    // User address space (NULL for kernel threads, see mm.h)
+    struct mm_struct *mm;
 } process_t;
 
+// Scheduler statistics
+typedef struct {
+    uint32_t context_switches;  // Task switches
+    uint32_t cr3_reloads;       // Page directory loads (non-global TLB flushed)
+    uint32_t cr3_skips;         // Switches between tasks sharing a directory
+    uint32_t lazy_switches;     // Switches to kernel threads (directory kept)
+    uint32_t tick_preemptions;  // Slices run out with another task waiting
+    uint32_t wakeup_preemptions; // Wakeups that preempted the running task
+    uint32_t nr_running;        // Runnable tasks now (queued and running)
+    uint32_t nr_tasks;          // Tasks in total
+} sched_stats_t;
+
+// All tasks (walk with list_for_each_entry(proc, &task_list, tasks))
+extern struct list_head task_list;
+
 // Global pointer to current process
 extern process_t *current_process;
 
@@ -42,6 +89,13 @@ void process_init(void);
 void process_create(void (*entry_point)(void));
 void process_create_user(void (*entry_point)(void));
 
+// Two-step user process creation (ELF loader): allocate the PCB, kernel
+// stack and an empty address space, fill the address space, then queue
+// the process to enter user mode at entry with the given stack pointer
+process_t *process_alloc_user(const char *name);
+void process_start_user(process_t *proc, uint32_t entry, uint32_t user_esp);
+void process_free_user(process_t *proc);   // Undo process_alloc_user (never started)
+
 // Find process by PID
 process_t *process_find_by_pid(uint32_t pid);
 
@@ -52,11 +106,17 @@ int process_kill(uint32_t pid);
 void schedule(void);
 void process_yield(void);
 
+// Timer tick: charge the running task and preempt it when its slice is over
+void scheduler_tick(void);
+// Reschedule now if a wakeup asked for it (end of an interrupt handler)
+void schedule_if_needed(void);
+
 // New process management functions
 void process_set_priority(uint32_t pid, uint8_t priority);
 void process_block(uint32_t pid);
 void process_unblock(uint32_t pid);
 void process_get_stats(uint32_t pid, uint32_t *runtime, uint8_t *priority, process_state_t *state);
+void process_get_sched_stats(sched_stats_t *stats);
 
 // Fork and wait
 int process_fork(void);
@@ -0,0 +1,137 @@
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include <stddef.h>
+#include "list.h"
+
+/**
+ * Linux-Style Intrusive Red-Black Trees
+ *
+ * Like list.h, the node is embedded in your data structure and the tree
+ * code never allocates. Searching and choosing where to insert is left
+ * to the caller, since only the caller knows how its keys compare.
+ *
+ * Example Usage:
+ *
+ *   struct my_data {
+ *       uint32_t key;
+ *       struct rb_node node;
+ *   };
+ *
+ *   struct rb_root tree = RB_ROOT;
+ *
+ *   // Insert
+ *   struct rb_node **link = &tree.rb_node, *parent = NULL;
+ *   while (*link) {
+ *       struct my_data *cur = rb_entry(*link, struct my_data, node);
+ *       parent = *link;
+ *       link = (item->key < cur->key) ? &(*link)->rb_left : &(*link)->rb_right;
+ *   }
+ *   rb_link_node(&item->node, parent, link);
+ *   rb_insert_color(&item->node, &tree);
+ */
+
+#define RB_RED   0
+#define RB_BLACK 1
+
+/**
+ * struct rb_node - Red-black tree node
+ * @rb_parent: parent node (NULL for the root)
+ * @rb_left: left child (smaller keys)
+ * @rb_right: right child (larger keys)
+ * @rb_color: RB_RED or RB_BLACK
+ */
+struct rb_node {
+    struct rb_node *rb_parent;
+    struct rb_node *rb_left;
+    struct rb_node *rb_right;
+    int rb_color;
+};
+
+/**
+ * struct rb_root - Red-black tree root
+ * @rb_node: root node, NULL when the tree is empty
+ */
+struct rb_root {
+    struct rb_node *rb_node;
+};
+
+/**
+ * RB_ROOT - Initializer for an empty tree
+ */
+#define RB_ROOT (struct rb_root) { NULL }
+
+/**
+ * rb_entry - Get the struct for this node
+ * @ptr: the &struct rb_node pointer
+ * @type: the type of the struct this is embedded in
+ * @member: the name of the rb_node within the struct
+ */
+#define rb_entry(ptr, type, member) \
+    container_of(ptr, type, member)
+
+/**
+ * RB_EMPTY_ROOT - Test whether a tree is empty
+ * @root: the tree
+ */
+#define RB_EMPTY_ROOT(root) ((root)->rb_node == NULL)
+
+/**
+ * rb_link_node - Attach a new node at a leaf position found by a search
+ * @node: new node
+ * @parent: parent of the leaf position (NULL for an empty tree)
+ * @rb_link: the parent's child pointer (or &root->rb_node)
+ *
+ * Must be followed by rb_insert_color() to rebalance the tree.
+ */
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
+                                struct rb_node **rb_link) {
+    node->rb_parent = parent;
+    node->rb_left = node->rb_right = NULL;
+    node->rb_color = RB_RED;
+    *rb_link = node;
+}
+
+/**
+ * rb_insert_color - Rebalance the tree after rb_link_node()
+ * @node: newly linked node
+ * @root: the tree
+ */
+void rb_insert_color(struct rb_node *node, struct rb_root *root);
+
+/**
+ * rb_erase - Remove a node from the tree
+ * @node: node to remove
+ * @root: the tree
+ */
+void rb_erase(struct rb_node *node, struct rb_root *root);
+
+/**
+ * rb_first - Get the smallest node
+ * @root: the tree
+ * Returns: first node in key order, or NULL if empty
+ */
+struct rb_node *rb_first(const struct rb_root *root);
+
+/**
+ * rb_last - Get the largest node
+ * @root: the tree
+ * Returns: last node in key order, or NULL if empty
+ */
+struct rb_node *rb_last(const struct rb_root *root);
+
+/**
+ * rb_next - Get the in-order successor
+ * @node: current node
+ * Returns: next node, or NULL at the end
+ */
+struct rb_node *rb_next(const struct rb_node *node);
+
+/**
+ * rb_prev - Get the in-order predecessor
+ * @node: current node
+ * Returns: previous node, or NULL at the start
+ */
+struct rb_node *rb_prev(const struct rb_node *node);
+
+#endif /* RBTREE_H */
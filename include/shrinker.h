@@ -0,0 +1,59 @@
+#ifndef SHRINKER_H
+#define SHRINKER_H
+
+#include <stdint.h>
+#include "list.h"
+
+/**
+ * Shrinkers (Linux-inspired)
+ *
+ * Subsystems that hold memory they could give back (empty slabs, the
+ * zeroed page pool, free heap pages) register a shrinker. When free
+ * frames drop below the PMM's low watermark kswapd runs the shrinkers
+ * until the high watermark is reached, and an allocation that finds no
+ * free block runs them directly before it fails.
+ */
+
+struct shrinker {
+    const char *name;
+
+    // Pages the shrinker could free now (may be an estimate)
+    uint32_t (*count)(void);
+
+    // Free up to nr pages. Returns the pages actually freed.
+    uint32_t (*scan)(uint32_t nr);
+
+    // Statistics
+    uint32_t nr_calls;          // Times scan() was called
+    uint32_t pages_reclaimed;   // Pages scan() freed in total
+
+    struct list_head list;      // Link in the shrinker list
+};
+
+/**
+ * register_shrinker - Add a shrinker to the registry
+ * Returns: 0 on success, -1 if it lacks a scan() callback
+ */
+int register_shrinker(struct shrinker *shrinker);
+
+/**
+ * unregister_shrinker - Remove a shrinker from the registry
+ */
+void unregister_shrinker(struct shrinker *shrinker);
+
+/**
+ * shrink_slab - Ask the shrinkers for up to nr pages
+ *
+ * Shrinkers are called in registration order until nr pages have been
+ * freed. Calls made while already shrinking return 0.
+ *
+ * Returns: Pages freed
+ */
+uint32_t shrink_slab(uint32_t nr);
+
+/**
+ * shrinker_show - Print every shrinker with its statistics
+ */
+void shrinker_show(void);
+
+#endif /* SHRINKER_H */
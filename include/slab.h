@@ -19,24 +19,59 @@
  */
 
 // Slab flags
-#define SLAB_HWCACHE_ALIGN  0x00002000  // Align objects to cache lines
+#define SLAB_HWCACHE_ALIGN  0x00002000  // Align objects to cache lines (SLAB_CACHE_LINE)
 #define SLAB_PANIC          0x00040000  // Panic if allocation fails
+#define SLAB_OFF_SLAB       0x80000000  // Internal: slab descriptor kept off the slab page
+
+#define SLAB_CACHE_LINE     64          // Cache line size for alignment and colouring
+#define SLAB_MAX_ORDER      3           // Slabs are at most 2^3 pages (32KB)
+#define SLAB_MAGAZINE_SIZE  16          // Hot objects cached in front of the slab lists
+
+// Allocation flags
+typedef uint32_t gfp_t;
+#define GFP_KERNEL          0x00000000
+#define __GFP_ZERO          0x00000100  // Return zeroed memory
 
 // Forward declarations
 struct kmem_cache;
 struct slab;
 
+/**
+ * slab_magazine - LIFO stack of free objects kept ready per cache
+ *
+ * Allocation pops and free pushes here without touching the slab lists.
+ * An empty magazine is refilled with half a load from the slabs, a full
+ * one returns its older half to them.
+ */
+typedef struct slab_magazine {
+    uint32_t avail;                         // Objects in the magazine
+    void *objects[SLAB_MAGAZINE_SIZE];      // Most recently freed on top
+} slab_magazine_t;
+
 /**
  * kmem_cache - Cache descriptor for a specific object type
  * 
- * Each cache manages objects of a single size.
+ * Each cache manages objects of a single size. The slab order is the
+ * smallest one that leaves at most 1/8 of a slab unused.
  * Example: process_cache for process_t structures
  */
 typedef struct kmem_cache {
     char name[32];              // Cache name for debugging
-    size_t object_size;         // Size of each object
+    size_t size;                // Object size asked for
+    size_t object_size;         // Size of each object (aligned)
     size_t align;               // Alignment requirement
     uint32_t flags;             // Cache flags
+    uint32_t order;             // Each slab is 2^order pages
+    uint32_t objects_per_slab;  // Objects each slab holds
+    size_t obj_offset;          // Offset of the first object in a slab (uncoloured)
+    
+    // Colouring: successive slabs start their objects at different
+    // cache line offsets within the space left over
+    uint32_t colour;            // Number of colours (1: no room to colour)
+    uint32_t colour_off;        // Offset step between colours
+    uint32_t colour_next;       // Colour of the next slab
+    
+    slab_magazine_t magazine;   // Hot objects in front of the slab lists
     
     // Slab lists
     struct list_head slabs_full;    // Slabs with no free objects
@@ -47,6 +82,8 @@ typedef struct kmem_cache {
     uint32_t num_objs;          // Total objects allocated
     uint32_t num_active;        // Active (in-use) objects
     uint32_t num_slabs;         // Total number of slabs
+    uint32_t mag_hits;          // Allocs/frees served by the magazine
+    uint32_t mag_misses;        // Allocs/frees that went to the slab lists
     
     // Cache list (global list of all caches)
     struct list_head list;
@@ -56,9 +93,14 @@ typedef struct kmem_cache {
  * slab - A slab containing multiple objects
  * 
  * Each slab is one or more pages containing objects of the cache's size.
+ * Caches of small objects keep the descriptor at the start of the slab
+ * page, the others allocate it separately (SLAB_OFF_SLAB). Either way
+ * the page descriptor of a slab page points at it, so the slab owning
+ * an object is found from the object's address.
  */
 typedef struct slab {
     struct list_head list;      // Link in cache's slab list
+    struct kmem_cache *cache;   // Owning cache
     void *mem;                  // Pointer to slab memory
     uint32_t inuse;             // Number of allocated objects
     uint32_t objects;           // Total objects in this slab
@@ -82,7 +124,8 @@ typedef struct slab_obj {
  * @align: Alignment requirement (0 for default)
  * @flags: Cache flags (SLAB_HWCACHE_ALIGN, etc.)
  * 
- * Returns: Pointer to cache descriptor, or NULL on failure
+ * Returns: Pointer to cache descriptor, or NULL on failure (also when an
+ * object does not fit a slab of SLAB_MAX_ORDER)
  */
 kmem_cache_t *kmem_cache_create(const char *name, size_t size, 
                                 size_t align, uint32_t flags);
@@ -98,10 +141,19 @@ void kmem_cache_destroy(kmem_cache_t *cache);
 /**
  * kmem_cache_alloc - Allocate an object from the cache
  * @cache: Cache to allocate from
+ * @flags: GFP_KERNEL, or __GFP_ZERO for a zeroed object
  * 
  * Returns: Pointer to allocated object, or NULL on failure
  */
-void *kmem_cache_alloc(kmem_cache_t *cache);
+void *kmem_cache_alloc(kmem_cache_t *cache, gfp_t flags);
+
+/**
+ * kmem_cache_alloc_noprof - kmem_cache_alloc() without profiler accounting
+ *
+ * For wrappers such as kmalloc() that charge the object to their own
+ * caller (memprof.h).
+ */
+void *kmem_cache_alloc_noprof(kmem_cache_t *cache, gfp_t flags);
 
 /**
  * kmem_cache_free - Free an object back to the cache
@@ -110,6 +162,30 @@ void *kmem_cache_alloc(kmem_cache_t *cache);
  */
 void kmem_cache_free(kmem_cache_t *cache, void *obj);
 
+/**
+ * kmem_cache_free_noprof - kmem_cache_free() for kmem_cache_alloc_noprof() objects
+ */
+void kmem_cache_free_noprof(kmem_cache_t *cache, void *obj);
+
+/**
+ * kmem_cache_alloc_bulk - Allocate several objects in one call
+ * @cache: Cache to allocate from
+ * @flags: GFP_KERNEL or __GFP_ZERO
+ * @nr: Number of objects
+ * @objs: Array receiving the objects
+ * 
+ * Returns: nr on success, 0 if not all could be allocated (none are then)
+ */
+int kmem_cache_alloc_bulk(kmem_cache_t *cache, gfp_t flags, size_t nr, void **objs);
+
+/**
+ * kmem_cache_free_bulk - Free several objects in one call
+ * @cache: Cache the objects belong to
+ * @nr: Number of objects
+ * @objs: Objects to free (NULL entries are skipped)
+ */
+void kmem_cache_free_bulk(kmem_cache_t *cache, size_t nr, void **objs);
+
 /**
  * kmem_cache_shrink - Free empty slabs to reduce memory usage
  * @cache: Cache to shrink
@@ -139,4 +215,28 @@ void slab_stats(void);
 // Common cache sizes (can be created on demand)
 extern kmem_cache_t *kmalloc_caches[8];  // 32, 64, 128, 256, 512, 1024, 2048, 4096
 
+// Largest kmalloc() served by the kmalloc caches; above it the heap is used
+#define KMALLOC_MIN_CACHE_SIZE 32
+#define KMALLOC_MAX_CACHE_SIZE 4096
+
+/**
+ * kmalloc_slab - Find the kmalloc cache for a request size
+ * @size: Request size in bytes
+ *
+ * Returns: Smallest kmalloc cache holding size bytes, or NULL if size is 0,
+ * above KMALLOC_MAX_CACHE_SIZE, or the caches do not exist yet
+ */
+kmem_cache_t *kmalloc_slab(size_t size);
+
+/**
+ * virt_to_cache - Find the cache an object was allocated from
+ * @obj: Object address
+ *
+ * Slab pages record their slab in their page descriptor, so this
+ * works from the pointer alone.
+ *
+ * Returns: Owning cache, or NULL if obj is not in a slab page
+ */
+kmem_cache_t *virt_to_cache(const void *obj);
+
 #endif /* SLAB_H */
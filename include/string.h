@@ -28,5 +28,8 @@ void* memset(void* ptr, int value, size_t num);
 // Memory copy
 void* memcpy(void* dest, const void* src, size_t num);
 
+// Memory comparison
+int memcmp(const void* ptr1, const void* ptr2, size_t num);
+
 #endif
 
@@ -0,0 +1,131 @@
+#ifndef SWAP_H
+#define SWAP_H
+
+#include <stdint.h>
+#include "blkdev.h"
+#include "pmm.h"
+#include "vmm.h"
+
+/**
+ * Swap and Page Reclaim (Linux-inspired)
+ *
+ * Mapped user pages sit on two LRU lists. New pages start on the
+ * inactive list. Aging tests and clears the PTE accessed bit: a
+ * referenced inactive page is promoted to the active list, an
+ * unreferenced active page is demoted back to the inactive one.
+ *
+ * Reclaim writes unreferenced inactive pages to a swap area on a block
+ * device and leaves a swap entry in their PTE, which the page fault
+ * handler resolves by reading the page back:
+ *
+ *   31                12 11 10 9          1 0
+ *  [     swap slot      |  | S |          | 0 ]   S = PTE_SWAP, not present
+ *
+ * kswapd reclaims in the background once free memory drops below the
+ * PMM low watermark, until it is back above the high one: first from
+ * the shrinkers (shrinker.h), then by swapping. An allocation that still
+ * finds no free frame reclaims directly.
+ */
+
+// Swap areas use 512-byte sectors, 8 per page
+#define SWAP_SECTOR_SIZE      512
+#define SWAP_SECTORS_PER_PAGE (PMM_BLOCK_SIZE / SWAP_SECTOR_SIZE)
+
+// Pages reclaimed per kswapd round / direct reclaim attempt
+#define SWAP_CLUSTER     32
+
+/**
+ * Swap entries in page table entries
+ */
+static inline uint32_t swap_entry(uint32_t slot) {
+    return (slot << 12) | PTE_SWAP;
+}
+
+static inline int pte_is_swap(uint32_t pte) {
+    return !(pte & PTE_PRESENT) && (pte & PTE_SWAP);
+}
+
+static inline uint32_t swap_entry_slot(uint32_t pte) {
+    return pte >> 12;
+}
+
+// Swap statistics
+typedef struct {
+    uint32_t total_slots;       // Pages the swap area holds
+    uint32_t used_slots;        // Slots holding a page
+    uint32_t swapped_out;       // Pages written out
+    uint32_t swapped_in;        // Pages read back
+    uint32_t nr_active;         // Pages on the active LRU list
+    uint32_t nr_inactive;       // Pages on the inactive LRU list
+    uint32_t kswapd_wakeups;    // Times kswapd was woken
+    uint32_t direct_reclaims;   // Allocations that had to reclaim themselves
+} swap_stats_t;
+
+/**
+ * swapon - Use a block device as the swap area
+ * @bdev: Registered block device (its whole size is used)
+ *
+ * Returns: 0 on success, -1 if a swap area is active or on OOM
+ */
+int swapon(struct block_device *bdev);
+
+/**
+ * swap_dup - Take another reference on a swap entry (fork)
+ */
+void swap_dup(uint32_t entry);
+
+/**
+ * swap_free - Drop a reference on a swap entry, freeing the slot with the last
+ */
+void swap_free(uint32_t entry);
+
+/**
+ * swap_in_page - Read a swapped page back
+ * @entry: Swap entry from the PTE
+ *
+ * Drops the entry's reference on success.
+ *
+ * Returns: Frame holding the page, or 0 on OOM or I/O error
+ */
+uint32_t swap_in_page(uint32_t entry);
+
+/**
+ * lru_cache_add - Put a newly mapped user frame on the inactive list
+ * @phys: Frame
+ * @vaddr: User address it is mapped at (same in every address space)
+ *
+ * LRU pages are also movable for compaction.
+ */
+void lru_cache_add(uint32_t phys, uint32_t vaddr);
+
+/**
+ * lru_cache_del - Take a frame off the LRU lists (freeing, migration)
+ */
+void lru_cache_del(uint32_t phys);
+
+/**
+ * try_to_free_pages - Reclaim up to nr pages into swap
+ *
+ * Interrupts are only disabled around the LRU list and slot map updates;
+ * call with them enabled so the swap I/O runs that way too.
+ *
+ * Returns: Number of frames freed
+ */
+uint32_t try_to_free_pages(uint32_t nr);
+
+/**
+ * wakeup_kswapd - Start background reclaim (free memory is low)
+ */
+void wakeup_kswapd(void);
+
+/**
+ * kswapd_init - Start the background reclaim thread
+ */
+void kswapd_init(void);
+
+/**
+ * swap_get_stats - Get swap and LRU statistics
+ */
+void swap_get_stats(swap_stats_t *stats);
+
+#endif /* SWAP_H */
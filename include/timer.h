@@ -19,6 +19,10 @@ uint32_t timer_get_ticks(void);
 // Get system uptime in milliseconds
 uint32_t timer_get_uptime_ms(void);
 
+// Get system uptime in microseconds (tick count plus the PIT counter;
+// never goes backwards)
+uint64_t timer_get_uptime_us(void);
+
 // Wait for specified number of ticks (legacy)
 void timer_wait(int ticks);
 
@@ -35,4 +39,11 @@ void timer_unregister_callback(int callback_id);
 // Get timer statistics
 void timer_get_stats(uint32_t *total_ticks, uint32_t *callbacks_executed);
 
+// Read the CPU timestamp counter (cycles since reset)
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
 #endif
@@ -2,15 +2,26 @@
 #define VMM_H
 
 #include <stdint.h>
+#include "page.h"
 
 // Page Table Entry Flags
 #define PTE_PRESENT 0x1
 #define PTE_RW      0x2
 #define PTE_USER    0x4
+#define PTE_ACCESSED 0x20   // Set by the CPU on access (LRU aging)
+#define PTE_DIRTY   0x40    // Set by the CPU on write
+#define PTE_PSE     0x80    // PDE only: maps a 4MB page (needs CR4.PSE)
+#define PTE_GLOBAL  0x100   // Kept in the TLB across CR3 loads (needs CR4.PGE)
+#define PTE_COW     0x200   // Available bit: read-only copy-on-write page
+#define PTE_SWAP    0x400   // Available bit: non-present entry holding a swap slot
 
 // Size of one Page
 #define PAGE_SIZE 4096
 
+// Size of one PSE page (one page directory entry)
+#define LARGE_PAGE_SIZE 0x400000
+#define LARGE_PAGE_MASK 0xFFC00000
+
 // Functions
 void vmm_init(void);
 
@@ -20,15 +31,65 @@ void vmm_map_page(uint32_t phys, uint32_t virt, uint32_t flags);
 // Unmap a virtual page
 void vmm_unmap_page(uint32_t virt);
 
+// Map/unmap a page in a specific page directory (user address spaces).
+// Mapping returns 0 if the page table cannot be allocated (or the
+// mapping is refused); unmapping returns the frame that was mapped, or 0.
+int vmm_map_page_dir(uint32_t dir_phys, uint32_t phys, uint32_t virt, uint32_t flags);
+uint32_t vmm_unmap_page_dir(uint32_t dir_phys, uint32_t virt);
+
+// Change the flags of a mapped page in a specific directory (shared
+// frames get PTE_COW instead of PTE_RW). Returns 0 if nothing is mapped.
+int vmm_protect_page_dir(uint32_t dir_phys, uint32_t virt, uint32_t flags);
+
+// Range operations on a directory: page tables are looked up once per
+// 4MB and TLB invalidations are batched (single invlpg for a few pages,
+// one full flush above that). Sizes are rounded down to whole pages.
+// Unmap drops a reference on each frame when release is set.
+int vmm_map_range(uint32_t dir_phys, uint32_t phys, uint32_t virt, uint32_t size, uint32_t flags);
+void vmm_unmap_range(uint32_t dir_phys, uint32_t virt, uint32_t size, int release);
+void vmm_protect_range(uint32_t dir_phys, uint32_t virt, uint32_t size, uint32_t flags);
+
+// Raw access to a single PTE (no tables are created). vmm_get_pte
+// returns 0 if the table does not exist; vmm_set_pte invalidates the
+// old translation.
+uint32_t vmm_get_pte(uint32_t dir_phys, uint32_t virt);
+void vmm_set_pte(uint32_t dir_phys, uint32_t virt, uint32_t pte);
+
+// Switch PTEs in a range that map old_phys to new_phys, keeping their
+// flags (page migration). Returns the number of PTEs changed.
+uint32_t vmm_replace_frame_range(uint32_t dir_phys, uint32_t virt, uint32_t size,
+                                 uint32_t old_phys, uint32_t new_phys);
+
+// Map a 4MB page with a single directory entry (PSE). phys and virt must
+// be 4MB aligned and the slot must not hold a page table. Large user pages
+// are shared on fork and not freed with the directory, so they suit memory
+// owned elsewhere such as framebuffers. Returns 0 on success, -1 otherwise.
+int vmm_map_large(uint32_t phys, uint32_t virt, uint32_t flags);
+int vmm_map_large_dir(uint32_t dir_phys, uint32_t phys, uint32_t virt, uint32_t flags);
+int vmm_pse_enabled(void);
+
 // Get physical address from virtual address
 uint32_t vmm_get_physical_address(uint32_t virt);
 
 // Switch Page Directory (used for Context Switching later)
+// Directories are passed around by physical address (the CR3 value)
 void vmm_switch_directory(uint32_t dir_phys);
 uint32_t vmm_get_kernel_directory(void);
+uint32_t vmm_get_current_directory(void);   // Loaded directory (CR3)
+
+// Create an empty user page directory sharing the kernel mappings
+// (the top 1GB; the low 3GB is left to user space)
+uint32_t vmm_create_directory(void);
+
+// Clone page directory for new process (user pages are shared copy-on-write)
+uint32_t vmm_clone_directory(uint32_t src_phys);
+
+// Free a cloned page directory, its private tables and its user frames
+void vmm_free_directory(uint32_t dir_phys);
 
-// Clone page directory for new process
-uint32_t vmm_clone_directory(void);
+// Flush all non-global TLB entries (reload CR3). Kernel mappings are
+// global when the CPU supports it and are not affected.
+void vmm_flush_tlb(void);
 
 // Note: kmalloc/kfree are defined in memory.h/memory.c
 
@@ -0,0 +1,43 @@
+#ifndef ZRAM_H
+#define ZRAM_H
+
+#include <stdint.h>
+
+/**
+ * Compressed RAM Block Device (Linux zram-style)
+ *
+ * A block device whose data lives in RAM, compressed page by page with
+ * LZ4. Pages that are one repeated 32-bit value (zero pages above all)
+ * are stored as that value only; pages that do not compress below
+ * ZRAM_HUGE_THRESHOLD keep a whole frame. Memory is only used for
+ * pages that have been written, until they are discarded (swap frees
+ * a slot).
+ *
+ * Registered as "zram0"; use it as a swap area with 'swapon zram0'.
+ */
+
+#define ZRAM_DISK_SIZE      (8 * 1024 * 1024)   // 8MB of (uncompressed) capacity
+#define ZRAM_HUGE_THRESHOLD 1536                // Compressed pages above this stay raw
+
+// zram statistics
+typedef struct {
+    uint32_t reads;             // Read requests
+    uint32_t writes;            // Write requests
+    uint32_t pages_stored;      // Pages holding data
+    uint32_t same_pages;        // Pages stored as a fill value
+    uint32_t huge_pages;        // Pages stored uncompressed
+    uint32_t compr_data_size;   // Bytes of compressed data
+    uint32_t mem_used;          // Bytes of memory holding the data
+} zram_stats_t;
+
+/**
+ * zram_init - Create and register zram0
+ */
+void zram_init(void);
+
+/**
+ * zram_get_stats - Get zram0 statistics
+ */
+void zram_get_stats(zram_stats_t *stats);
+
+#endif /* ZRAM_H */
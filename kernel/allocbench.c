@@ -0,0 +1,466 @@
+#include "allocbench.h"
+#include "memory.h"
+#include "slab.h"
+#include "pmm.h"
+#include "fat12.h"
+#include "timer.h"
+#include "printk.h"
+#include "string.h"
+#include "idt.h"
+
+// Recorded event: object key and size << 3 | type << 1 | is_free
+typedef struct {
+    uint32_t key;
+    uint32_t info;
+} ring_event_t;
+
+static ring_event_t ring[ALLOCBENCH_RING_SIZE];
+static uint32_t ring_head = 0;      // Events recorded (oldest is head - RING_SIZE)
+static int recording = 0;
+
+// Replay event, resolved to an object slot when the trace is loaded
+typedef struct {
+    uint32_t key;               // Object id in the trace
+    uint32_t size;              // Allocation size (also set on frees)
+    uint32_t slot;              // Index into the live object array
+    uint8_t is_free;
+    uint8_t type;               // memprof_type_t
+    uint8_t cache;              // Bench cache of a slab event
+} bench_event_t;
+
+// Open-addressed table of allocations not matched by a free yet, holding
+// event index + 1 (0 = empty). Half full at worst, so probes stay short.
+#define TRACE_LIVE_SIZE (ALLOCBENCH_MAX_EVENTS * 2)
+
+typedef struct {
+    bench_event_t *events;
+    uint32_t *live;             // Only while loading
+    uint32_t nr_events;
+    uint32_t nr_slots;
+    kmem_cache_t *caches[ALLOCBENCH_MAX_CACHES];
+    uint32_t cache_size[ALLOCBENCH_MAX_CACHES];
+    uint32_t nr_caches;
+} bench_trace_t;
+
+// Per-allocator results
+typedef struct {
+    uint32_t allocs, frees, failures;
+    uint64_t alloc_cycles, free_cycles;
+    uint32_t alloc_max, free_max;
+} bench_stats_t;
+
+static const char type_chars[MEMPROF_NR_TYPES] = {'k', 'c', 'p'};
+static const char *type_names[MEMPROF_NR_TYPES] = {"kmalloc", "kmem_cache", "page"};
+
+void allocbench_record_start(void) {
+    uint32_t eflags = irq_save();
+    ring_head = 0;
+    recording = 1;
+    irq_restore(eflags);
+}
+
+void allocbench_record_stop(void) {
+    recording = 0;
+}
+
+void allocbench_record(memprof_type_t type, const void *ptr, uint32_t size, int is_free) {
+    if (!recording || !ptr) return;
+
+    uint32_t eflags = irq_save();
+    ring_event_t *event = &ring[ring_head & (ALLOCBENCH_RING_SIZE - 1)];
+    event->key = (uint32_t)ptr;
+    event->info = (size << 3) | ((uint32_t)type << 1) | (is_free ? 1 : 0);
+    ring_head++;
+    irq_restore(eflags);
+}
+
+void allocbench_show(void) {
+    uint32_t kept = ring_head < ALLOCBENCH_RING_SIZE ? ring_head : ALLOCBENCH_RING_SIZE;
+    pr_info("Recording %s: %u events seen, %u kept (ring of %d)\n",
+            recording ? "on" : "off", ring_head, kept, ALLOCBENCH_RING_SIZE);
+}
+
+// Helper: Append a number in hex or decimal
+static char *put_number(char *p, uint32_t value, uint32_t base) {
+    char digits[10];
+    int n = 0;
+    do {
+        uint32_t d = value % base;
+        digits[n++] = (char)(d < 10 ? '0' + d : 'a' + d - 10);
+        value /= base;
+    } while (value);
+    while (n) *p++ = digits[--n];
+    return p;
+}
+
+int allocbench_save(const char *filename) {
+    uint32_t eflags = irq_save();
+    int was_recording = recording;
+    recording = 0;
+    irq_restore(eflags);
+
+    uint32_t first = ring_head > ALLOCBENCH_RING_SIZE ? ring_head - ALLOCBENCH_RING_SIZE : 0;
+    uint32_t count = ring_head - first;
+
+    // "a k ffffffff 16777215\n" at most
+    char *text = (char *)kmalloc(count * 24 + 64);
+    if (!text) {
+        recording = was_recording;
+        return -1;
+    }
+
+    char *p = text;
+    const char *header = "# ValcOS allocation trace\n";
+    strcpy(p, header);
+    p += strlen(header);
+
+    for (uint32_t i = first; i < ring_head; i++) {
+        ring_event_t *event = &ring[i & (ALLOCBENCH_RING_SIZE - 1)];
+        uint32_t type = (event->info >> 1) & 3;
+        int is_free = event->info & 1;
+
+        *p++ = is_free ? 'f' : 'a';
+        *p++ = ' ';
+        *p++ = type_chars[type];
+        *p++ = ' ';
+        p = put_number(p, event->key, 16);
+        if (!is_free) {
+            *p++ = ' ';
+            p = put_number(p, event->info >> 3, 10);
+        }
+        *p++ = '\n';
+    }
+
+    int ret = fat12_create_file(filename);
+    if (ret == FAT12_SUCCESS || ret == FAT12_ALREADY_EXISTS) {
+        ret = fat12_write_file(filename, (uint8_t *)text, (uint32_t)(p - text));
+    }
+    kfree(text);
+    recording = was_recording;
+
+    if (ret != FAT12_SUCCESS) {
+        pr_err("allocbench: Cannot write %s: %s\n", filename, fat12_get_error_string(ret));
+        return -1;
+    }
+    return (int)count;
+}
+
+// Helper: Skip spaces and tabs
+static const char *skip_blanks(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+// Helper: Parse a number in hex or decimal. Returns NULL if there is none.
+static const char *parse_number(const char *p, const char *end, uint32_t base, uint32_t *value) {
+    uint32_t v = 0;
+    const char *start = p;
+    for (; p < end; p++) {
+        uint32_t d;
+        if (*p >= '0' && *p <= '9') d = *p - '0';
+        else if (base == 16 && *p >= 'a' && *p <= 'f') d = *p - 'a' + 10;
+        else if (base == 16 && *p >= 'A' && *p <= 'F') d = *p - 'A' + 10;
+        else break;
+        v = v * base + d;
+    }
+    *value = v;
+    return p > start ? p : NULL;
+}
+
+// Helper: Bench cache for an object size, created on first use
+static int trace_cache(bench_trace_t *trace, uint32_t size) {
+    for (uint32_t i = 0; i < trace->nr_caches; i++) {
+        if (trace->cache_size[i] == size) return (int)i;
+    }
+    if (trace->nr_caches == ALLOCBENCH_MAX_CACHES) return -1;
+
+    kmem_cache_t *cache = kmem_cache_create("allocbench", size, 0, 0);
+    if (!cache) return -1;
+    trace->caches[trace->nr_caches] = cache;
+    trace->cache_size[trace->nr_caches] = size;
+    return (int)trace->nr_caches++;
+}
+
+static inline uint32_t trace_live_hash(uint32_t key, uint32_t type) {
+    return ((key ^ type) * 2654435761u >> 16) & (TRACE_LIVE_SIZE - 1);
+}
+
+// Helper: Live table slot of the allocation of key, or the empty slot
+// that ends its probe sequence
+static uint32_t trace_live_find(bench_trace_t *trace, uint32_t key, uint32_t type) {
+    uint32_t i = trace_live_hash(key, type);
+    while (trace->live[i]) {
+        bench_event_t *alloc = &trace->events[trace->live[i] - 1];
+        if (alloc->key == key && alloc->type == type) break;
+        i = (i + 1) & (TRACE_LIVE_SIZE - 1);
+    }
+    return i;
+}
+
+// Helper: Empty a live table slot, shifting later entries of the probe
+// sequence back so lookups never stop early
+static void trace_live_remove(bench_trace_t *trace, uint32_t hole) {
+    uint32_t i = hole;
+    while (1) {
+        i = (i + 1) & (TRACE_LIVE_SIZE - 1);
+        if (!trace->live[i]) break;
+
+        // An entry may fill the hole if its home is not in (hole, i]
+        bench_event_t *alloc = &trace->events[trace->live[i] - 1];
+        uint32_t home = trace_live_hash(alloc->key, alloc->type);
+        if (((i - home) & (TRACE_LIVE_SIZE - 1)) >= ((i - hole) & (TRACE_LIVE_SIZE - 1))) {
+            trace->live[hole] = trace->live[i];
+            hole = i;
+        }
+    }
+    trace->live[hole] = 0;
+}
+
+// Helper: Give a free the slot of the latest live allocation of its
+// object. Returns 0 if there is none (allocated before the trace).
+static int trace_resolve_free(bench_trace_t *trace, bench_event_t *free_event) {
+    uint32_t i = trace_live_find(trace, free_event->key, free_event->type);
+    if (!trace->live[i]) return 0;
+
+    bench_event_t *alloc = &trace->events[trace->live[i] - 1];
+    trace_live_remove(trace, i);
+    free_event->slot = alloc->slot;
+    free_event->size = alloc->size;
+    free_event->cache = alloc->cache;
+    return 1;
+}
+
+// Helper: Parse one trace line into the next event. Returns -1 on a
+// malformed line, 0 if the line adds no event.
+static int trace_parse_line(bench_trace_t *trace, const char *p, const char *end) {
+    p = skip_blanks(p, end);
+    if (p == end || *p == '#' || *p == '\r') return 0;
+
+    char op = *p++;
+    p = skip_blanks(p, end);
+    if (p == end || (op != 'a' && op != 'f')) return -1;
+
+    int type = -1;
+    for (int t = 0; t < MEMPROF_NR_TYPES; t++) {
+        if (*p == type_chars[t]) type = t;
+    }
+    if (type < 0) return -1;
+
+    bench_event_t *event = &trace->events[trace->nr_events];
+    memset(event, 0, sizeof(*event));
+    event->type = (uint8_t)type;
+    event->is_free = (op == 'f');
+
+    p = parse_number(skip_blanks(p + 1, end), end, 16, &event->key);
+    if (!p) return -1;
+
+    if (event->is_free) return trace_resolve_free(trace, event);
+
+    p = parse_number(skip_blanks(p, end), end, 10, &event->size);
+    if (!p || event->size == 0) return -1;
+
+    if (type == MEMPROF_SLAB) {
+        int cache = trace_cache(trace, event->size);
+        if (cache < 0) return -1;
+        event->cache = (uint8_t)cache;
+    }
+    event->slot = trace->nr_slots++;
+
+    // A repeated allocation of a live key replaces it; frees match the latest
+    trace->live[trace_live_find(trace, event->key, type)] = trace->nr_events + 1;
+    return 1;
+}
+
+static void trace_release(bench_trace_t *trace) {
+    for (uint32_t i = 0; i < trace->nr_caches; i++) kmem_cache_destroy(trace->caches[i]);
+    kfree(trace->events);
+}
+
+// Helper: Load a trace file. Returns 0 or -1 (reported).
+static int trace_load(bench_trace_t *trace, const char *filename) {
+    memset(trace, 0, sizeof(*trace));
+
+    int size = fat12_get_file_size(filename);
+    if (size <= 0) {
+        pr_err("allocbench: No trace %s\n", filename);
+        return -1;
+    }
+
+    char *text = (char *)kmalloc((size + 511) & ~511);    // Whole sectors are read
+    trace->events = (bench_event_t *)kmalloc(ALLOCBENCH_MAX_EVENTS * sizeof(bench_event_t));
+    trace->live = (uint32_t *)kmalloc(TRACE_LIVE_SIZE * sizeof(uint32_t));
+    if (!text || !trace->events || !trace->live ||
+        fat12_read_file(filename, (uint8_t *)text) < 0) {
+        pr_err("allocbench: Cannot load %s\n", filename);
+        kfree(text);
+        kfree(trace->events);
+        kfree(trace->live);
+        return -1;
+    }
+    memset(trace->live, 0, TRACE_LIVE_SIZE * sizeof(uint32_t));
+
+    const char *p = text, *end = text + size;
+    uint32_t line = 0;
+    while (p < end) {
+        const char *eol = p;
+        while (eol < end && *eol != '\n') eol++;
+        line++;
+
+        if (trace->nr_events == ALLOCBENCH_MAX_EVENTS) {
+            pr_warn("allocbench: %s truncated at line %u\n", filename, line);
+            break;
+        }
+        int ret = trace_parse_line(trace, p, eol);
+        if (ret < 0) {
+            pr_err("allocbench: %s:%u: bad event\n", filename, line);
+            kfree(text);
+            kfree(trace->live);
+            trace_release(trace);
+            return -1;
+        }
+        trace->nr_events += ret;
+        p = eol + 1;
+    }
+
+    kfree(text);
+    kfree(trace->live);
+    trace->live = NULL;
+    return 0;
+}
+
+// Helper: 64-by-32 bit division (no libgcc in the kernel)
+static uint32_t div_u64(uint64_t n, uint32_t d) {
+    uint64_t q = 0, r = 0;
+    if (d == 0) return 0;
+    for (int i = 63; i >= 0; i--) {
+        r = (r << 1) | ((n >> i) & 1);
+        if (r >= d) {
+            r -= d;
+            q |= 1ULL << i;
+        }
+    }
+    return q > 0xFFFFFFFFULL ? 0xFFFFFFFF : (uint32_t)q;
+}
+
+// Helper: One operation, timed
+static void *bench_alloc(bench_trace_t *trace, bench_event_t *event, uint32_t *cycles) {
+    void *ptr;
+    uint64_t start = rdtsc();
+    if (event->type == MEMPROF_KMALLOC) ptr = kmalloc(event->size);
+    else if (event->type == MEMPROF_SLAB) ptr = kmem_cache_alloc(trace->caches[event->cache], GFP_KERNEL);
+    else ptr = (void *)pmm_alloc_block();
+    *cycles = (uint32_t)(rdtsc() - start);
+    return ptr;
+}
+
+static void bench_free(bench_trace_t *trace, bench_event_t *event, void *ptr, uint32_t *cycles) {
+    uint64_t start = rdtsc();
+    if (event->type == MEMPROF_KMALLOC) kfree(ptr);
+    else if (event->type == MEMPROF_SLAB) kmem_cache_free(trace->caches[event->cache], ptr);
+    else pmm_free_block((uint32_t)ptr);
+    *cycles = (uint32_t)(rdtsc() - start);
+}
+
+int allocbench_replay(const char *filename, uint32_t iterations) {
+    bench_trace_t trace;
+    if (iterations == 0) iterations = 1;
+
+    // Neither the profiler nor the recorder may see the replay
+    int was_profiling = memprof_enabled();
+    int was_recording = recording;
+    memprof_enable(0);
+    recording = 0;
+
+    if (trace_load(&trace, filename) < 0) {
+        memprof_enable(was_profiling);
+        recording = was_recording;
+        return -1;
+    }
+
+    void **objs = (void **)kzalloc((trace.nr_slots ? trace.nr_slots : 1) * sizeof(void *));
+    if (!objs) {
+        pr_err("allocbench: Out of memory\n");
+        trace_release(&trace);
+        memprof_enable(was_profiling);
+        recording = was_recording;
+        return -1;
+    }
+
+    bench_stats_t stats[MEMPROF_NR_TYPES];
+    memset(stats, 0, sizeof(stats));
+    uint32_t free_start = pmm_get_free_memory() / PMM_BLOCK_SIZE;
+    uint32_t free_min = free_start;
+    uint32_t live_bytes = 0, peak_bytes = 0, worst_frag = 0;
+    heap_stats_t heap;
+
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t i = 0; i < trace.nr_events; i++) {
+            bench_event_t *event = &trace.events[i];
+            bench_stats_t *s = &stats[event->type];
+            uint32_t cycles;
+
+            if (!event->is_free) {
+                void *ptr = bench_alloc(&trace, event, &cycles);
+                objs[event->slot] = ptr;
+                if (!ptr) {
+                    s->failures++;
+                    continue;
+                }
+                s->allocs++;
+                s->alloc_cycles += cycles;
+                if (cycles > s->alloc_max) s->alloc_max = cycles;
+                live_bytes += event->size;
+                if (live_bytes > peak_bytes) peak_bytes = live_bytes;
+            } else {
+                void *ptr = objs[event->slot];
+                if (!ptr) continue;
+                bench_free(&trace, event, ptr, &cycles);
+                objs[event->slot] = NULL;
+                s->frees++;
+                s->free_cycles += cycles;
+                if (cycles > s->free_max) s->free_max = cycles;
+                live_bytes -= event->size;
+            }
+
+            uint32_t free_now = pmm_get_free_memory() / PMM_BLOCK_SIZE;
+            if (free_now < free_min) free_min = free_now;
+        }
+
+        // The heap as the workload left it, then clean up untimed
+        heap_get_stats(&heap);
+        if (heap.fragmentation > worst_frag) worst_frag = heap.fragmentation;
+
+        for (uint32_t i = 0; i < trace.nr_events; i++) {
+            bench_event_t *event = &trace.events[i];
+            if (event->is_free || !objs[event->slot]) continue;
+
+            uint32_t cycles;
+            bench_free(&trace, event, objs[event->slot], &cycles);
+            objs[event->slot] = NULL;
+            live_bytes -= event->size;
+        }
+    }
+
+    pr_info("Trace %s: %u events, %u run(s)\n", filename, trace.nr_events, iterations);
+    for (int t = 0; t < MEMPROF_NR_TYPES; t++) {
+        bench_stats_t *s = &stats[t];
+        if (!s->allocs && !s->failures) continue;
+        pr_info("  %s: %u allocs, %u cycles avg (max %u); %u frees, %u cycles avg (max %u)",
+                type_names[t], s->allocs, div_u64(s->alloc_cycles, s->allocs), s->alloc_max,
+                s->frees, div_u64(s->free_cycles, s->frees), s->free_max);
+        if (s->failures) pr_info("; %u failed", s->failures);
+        pr_info("\n");
+    }
+
+    uint32_t peak_frames = free_start - free_min;
+    pr_info("  Peak live: %u bytes requested, %u frames in use (%u KB)\n",
+            peak_bytes, peak_frames, peak_frames * (PMM_BLOCK_SIZE / 1024));
+    pr_info("  Heap after a run: %u KB, %u free blocks, %u%% fragmented (worst %u%%)\n",
+            heap.total / 1024, heap.free_blocks, heap.fragmentation, worst_frag);
+
+    kfree(objs);
+    trace_release(&trace);
+    memprof_enable(was_profiling);
+    recording = was_recording;
+    return 0;
+}
@@ -19,6 +19,22 @@ int blkdev_register(struct block_device *bdev) {
     return 0;
 }
 
+void blkdev_show_devices(void) {
+    struct block_device *bdev;
+    list_for_each_entry(bdev, &blkdev_list, list) {
+        pr_info("  %s  %u KB\n", bdev->name, bdev->size / 2);
+        if (bdev->show) bdev->show(bdev);
+    }
+}
+
+struct block_device *blkdev_find(const char *name) {
+    struct block_device *bdev;
+    list_for_each_entry(bdev, &blkdev_list, list) {
+        if (strcmp(bdev->name, name) == 0) return bdev;
+    }
+    return NULL;
+}
+
 struct bio *blkdev_alloc_bio(uint32_t sector, uint32_t size, int rw) {
     struct bio *bio = (struct bio *)kmalloc(sizeof(struct bio));
     if (!bio) return NULL;
@@ -52,3 +68,7 @@ int blkdev_submit_bio(struct block_device *bdev, struct bio *bio) {
     
     return -1;
 }
+
+void blkdev_discard(struct block_device *bdev, uint32_t sector, uint32_t nr_sectors) {
+    if (bdev && bdev->discard) bdev->discard(sector, nr_sectors);
+}
@@ -5,10 +5,9 @@
 #include "process.h"
 #include "vmm.h"
 #include "pmm.h"
-
-// User stack location (grows down from 3GB)
-#define USER_STACK_TOP 0xC0000000
-#define USER_STACK_SIZE (4096 * 4)  // 16KB stack
+#include "swap.h"
+#include "mm.h"
+#include "fat12.h"
 
 int elf_validate(elf32_ehdr_t *ehdr) {
     if (!ehdr) return -1;
@@ -50,12 +49,33 @@ int elf_validate(elf32_ehdr_t *ehdr) {
     return 0;
 }
 
-uint32_t elf_load(void *data, uint32_t size) {
-    if (!data || size < sizeof(elf32_ehdr_t)) {
+// Helper: Copy the file-backed bytes of a segment that fall in one page
+static void elf_copy_page(uint8_t *frame, uint32_t page, elf32_phdr_t *ph, uint8_t *data) {
+    uint32_t lo = page > ph->p_vaddr ? page : ph->p_vaddr;
+    uint32_t hi = ph->p_vaddr + ph->p_filesz;
+    if (hi > page + PAGE_SIZE) hi = page + PAGE_SIZE;
+    
+    if (lo < hi) {
+        memcpy(frame + (lo - page), data + ph->p_offset + (lo - ph->p_vaddr), hi - lo);
+    }
+}
+
+// Helper: Translate ELF segment flags to region flags
+static uint32_t elf_vm_flags(uint32_t p_flags) {
+    uint32_t flags = 0;
+    if (p_flags & PF_R) flags |= VM_READ;
+    if (p_flags & PF_W) flags |= VM_WRITE;
+    if (p_flags & PF_X) flags |= VM_EXEC;
+    return flags;
+}
+
+uint32_t elf_load(mm_struct_t *mm, vm_file_t *file) {
+    if (!mm || !file || file->size < sizeof(elf32_ehdr_t)) {
         pr_err("ELF: Invalid data\n");
         return 0;
     }
     
+    uint8_t *data = file->data;
     elf32_ehdr_t *ehdr = (elf32_ehdr_t *)data;
     
     // Validate ELF header
@@ -63,92 +83,137 @@ uint32_t elf_load(void *data, uint32_t size) {
         return 0;
     }
     
+    // Compared against what is left of the file: the sums could wrap
+    if (ehdr->e_phoff > file->size ||
+        ehdr->e_phnum > (file->size - ehdr->e_phoff) / sizeof(elf32_phdr_t)) {
+        pr_err("ELF: Program headers out of range\n");
+        return 0;
+    }
+    
     pr_info("ELF: Loading program (entry: 0x%x)\n", ehdr->e_entry);
     
     // Get program headers
-    elf32_phdr_t *phdr = (elf32_phdr_t *)((uint8_t *)data + ehdr->e_phoff);
+    elf32_phdr_t *phdr = (elf32_phdr_t *)(data + ehdr->e_phoff);
+    elf32_phdr_t *prev = NULL;
     
-    // Load each PT_LOAD segment
+    // Register each PT_LOAD segment; its pages are filled on first touch
     for (int i = 0; i < ehdr->e_phnum; i++) {
-        if (phdr[i].p_type == PT_LOAD) {
-            pr_debug("ELF: Loading segment %d at 0x%x (size: %d bytes)\n",
-                    i, phdr[i].p_vaddr, phdr[i].p_memsz);
-            
-            // Allocate pages for this segment
-            uint32_t pages_needed = (phdr[i].p_memsz + 4095) / 4096;
-            
-            for (uint32_t p = 0; p < pages_needed; p++) {
-                uint32_t vaddr = phdr[i].p_vaddr + (p * 4096);
-                uint32_t paddr = pmm_alloc_block();
-                
-                if (paddr == 0) {
-                    pr_err("ELF: Failed to allocate memory\n");
-                    return 0;
-                }
-                
-                // Map page (user accessible, writable)
-                // Flags: PRESENT | RW | USER
-                vmm_map_page(paddr, vaddr, PTE_PRESENT | PTE_RW | PTE_USER);
+        elf32_phdr_t *ph = &phdr[i];
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0) continue;
+        
+        if (ph->p_offset > file->size || ph->p_filesz > file->size - ph->p_offset ||
+            ph->p_filesz > ph->p_memsz ||
+            ph->p_vaddr + ph->p_memsz > USER_HEAP_START || ph->p_vaddr + ph->p_memsz < ph->p_vaddr) {
+            pr_err("ELF: Bad segment %d\n", i);
+            return 0;
+        }
+        
+        pr_debug("ELF: Segment %d at 0x%x (size: %d bytes, file: %d bytes)\n",
+                i, ph->p_vaddr, ph->p_memsz, ph->p_filesz);
+        
+        uint32_t start = ph->p_vaddr;
+        uint32_t flags = elf_vm_flags(ph->p_flags);
+        
+        // Segments sharing a page with the previous one (e.g. .text and
+        // .data packed by the linker): fill that page now with both.
+        // It becomes a one-page region with the flags of both, so swap-in
+        // and mprotect see the same access as the PTE.
+        if (prev && mm_find_area(mm, start)) {
+            uint32_t page = start & ~(PAGE_SIZE - 1);
+            uint32_t shared_flags = flags | elf_vm_flags(prev->p_flags);
+            if (mm_protect(mm, page, page + PAGE_SIZE, shared_flags) < 0) {
+                pr_err("ELF: Failed to allocate memory\n");
+                return 0;
             }
             
-            // Copy segment data
-            if (phdr[i].p_filesz > 0) {
-                memcpy((void *)phdr[i].p_vaddr, 
-                       (uint8_t *)data + phdr[i].p_offset,
-                       phdr[i].p_filesz);
+            uint32_t frame = pmm_alloc_zeroed();
+            if (!frame) {
+                pr_err("ELF: Failed to allocate memory\n");
+                return 0;
             }
             
-            // Zero BSS (uninitialized data)
-            if (phdr[i].p_memsz > phdr[i].p_filesz) {
-                memset((uint8_t *)phdr[i].p_vaddr + phdr[i].p_filesz,
-                       0,
-                       phdr[i].p_memsz - phdr[i].p_filesz);
+            uint8_t *buf = (uint8_t *)phys_to_virt(frame);
+            elf_copy_page(buf, page, prev, data);
+            elf_copy_page(buf, page, ph, data);
+            
+            uint32_t pte = PTE_PRESENT | PTE_USER;
+            if (shared_flags & VM_WRITE) pte |= PTE_RW;
+            if (!vmm_map_page_dir(mm->pgd, frame, page, pte)) {
+                pmm_free_block(frame);
+                pr_err("ELF: Failed to allocate memory\n");
+                return 0;
             }
+            lru_cache_add(frame, page);
+            
+            start = page + PAGE_SIZE;
         }
+        
+        if (start < ph->p_vaddr + ph->p_memsz &&
+            !mm_add_area(mm, start, ph->p_vaddr + ph->p_memsz, flags, file,
+                         ph->p_offset, ph->p_vaddr, ph->p_filesz)) {
+            pr_err("ELF: Segment %d overlaps another\n", i);
+            return 0;
+        }
+        
+        prev = ph;
     }
     
     pr_info("ELF: Program loaded successfully\n");
     return ehdr->e_entry;
 }
 
-// Jump to user mode and execute
-extern void enter_usermode(uint32_t entry, uint32_t stack);
-
 int elf_exec(const char *path) {
     if (!path) return -1;
     
     pr_info("ELF: Executing %s\n", path);
     
-    // For now, we'll use a hardcoded test
-    // In a full implementation, this would:
-    // 1. Open file from VFS
-    // 2. Read into buffer
-    // 3. Call elf_load()
+    int size = fat12_get_file_size(path);
+    if (size <= 0) {
+        pr_err("ELF: Cannot open %s\n", path);
+        return -1;
+    }
     
-    // Allocate user stack
-    uint32_t stack_pages = USER_STACK_SIZE / 4096;
-    uint32_t stack_bottom = USER_STACK_TOP - USER_STACK_SIZE;
+    // The FAT12 driver copies whole sectors
+    uint8_t *data = (uint8_t *)kmalloc((size + 511) & ~511);
+    if (!data) {
+        pr_err("ELF: Out of memory\n");
+        return -1;
+    }
     
-    for (uint32_t i = 0; i < stack_pages; i++) {
-        uint32_t vaddr = stack_bottom + (i * 4096);
-        uint32_t paddr = pmm_alloc_block();
-        
-        if (paddr == 0) {
-            pr_err("ELF: Failed to allocate stack\n");
-            return -1;
-        }
-        
-        // Map page (user accessible, writable)
-        vmm_map_page(paddr, vaddr, PTE_PRESENT | PTE_RW | PTE_USER);
+    if (fat12_read_file(path, data) < 0) {
+        kfree(data);
+        pr_err("ELF: Failed to read %s\n", path);
+        return -1;
     }
     
-    pr_info("ELF: User stack allocated at 0x%x\n", USER_STACK_TOP);
+    vm_file_t *file = vm_file_create(data, size);
+    if (!file) {
+        kfree(data);
+        return -1;
+    }
     
-    // For demonstration, we'll just print a message
-    // Full implementation would call enter_usermode()
-    pr_info("ELF: Ready to execute (user mode switching not fully implemented)\n");
-    pr_info("ELF: Entry point: 0x%x, Stack: 0x%x\n", 0x400000, USER_STACK_TOP);
+    process_t *proc = process_alloc_user(path);
+    if (!proc) {
+        vm_file_put(file);
+        pr_err("ELF: Failed to create process\n");
+        return -1;
+    }
     
-    return 0;
+    uint32_t entry = elf_load(proc->mm, file);
+    
+    // Regions hold their own references to the image
+    vm_file_put(file);
+    
+    // Stack region; pages appear as the program touches them
+    if (!entry || !mm_add_area(proc->mm, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_TOP,
+                               VM_READ | VM_WRITE | VM_GROWSDOWN, NULL, 0, 0, 0)) {
+        process_free_user(proc);
+        pr_err("ELF: Failed to load %s\n", path);
+        return -1;
+    }
+    
+    pr_info("ELF: Entry point: 0x%x, Stack: 0x%x\n", entry, USER_STACK_TOP);
+    process_start_user(proc, entry, USER_STACK_TOP);
+    
+    return proc->pid;
 }
-
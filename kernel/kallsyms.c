@@ -0,0 +1,111 @@
+#include "kallsyms.h"
+#include "memory.h"
+#include "fat12.h"
+#include "printk.h"
+
+// Sorted by address (nm -n); names point into the file buffer
+static struct {
+    char *buffer;
+    uint32_t *addrs;
+    const char **names;
+    uint32_t count;
+} kallsyms;
+
+// Helper: Parse a hex number, advancing *p. Returns -1 if there is none.
+static int parse_hex(char **p, uint32_t *value) {
+    uint32_t v = 0;
+    int digits = 0;
+    for (;; (*p)++, digits++) {
+        char c = **p;
+        if (c >= '0' && c <= '9') v = (v << 4) | (c - '0');
+        else if (c >= 'a' && c <= 'f') v = (v << 4) | (c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') v = (v << 4) | (c - 'A' + 10);
+        else break;
+    }
+    *value = v;
+    return digits ? 0 : -1;
+}
+
+// Helper: Parse "addr type name" lines in place, keeping text symbols.
+// Returns the number of symbols stored (at most max; 0 sizes the table).
+static uint32_t kallsyms_parse(char *p, char *end, uint32_t max) {
+    uint32_t count = 0;
+
+    while (p < end) {
+        char *line = p;
+        while (p < end && *p != '\n') p++;
+        char *eol = p;
+        if (p < end) p++;
+
+        uint32_t addr;
+        char *s = line;
+        if (parse_hex(&s, &addr) < 0 || s + 3 > eol || s[0] != ' ' || s[2] != ' ') continue;
+        if (s[1] != 'T' && s[1] != 't') continue;
+
+        char *name = s + 3;
+        if (*name == '_') name++;   // PE (i386pe) prefixes C symbols
+        if (eol > name && eol[-1] == '\r') eol--;
+        if (eol == name) continue;
+
+        if (max) {
+            if (count == max) break;
+            *eol = '\0';
+            kallsyms.addrs[count] = addr;
+            kallsyms.names[count] = name;
+        }
+        count++;
+    }
+    return count;
+}
+
+int kallsyms_load(void) {
+    if (kallsyms.count) return 0;
+
+    int size = fat12_get_file_size(KALLSYMS_FILE);
+    if (size <= 0) return -1;
+
+    // Whole sectors are read, and the last line may end at the end of
+    // the file: keep at least one byte past it for its terminator
+    char *buffer = (char *)kmalloc((size + 512) & ~511);
+    if (!buffer) return -1;
+    if (fat12_read_file(KALLSYMS_FILE, (uint8_t *)buffer) < 0) {
+        kfree(buffer);
+        return -1;
+    }
+    buffer[size] = '\0';
+
+    uint32_t count = kallsyms_parse(buffer, buffer + size, 0);
+    if (count == 0) {
+        kfree(buffer);
+        return -1;
+    }
+
+    kallsyms.addrs = (uint32_t *)kmalloc(count * sizeof(uint32_t));
+    kallsyms.names = (const char **)kmalloc(count * sizeof(const char *));
+    if (!kallsyms.addrs || !kallsyms.names) {
+        kfree(kallsyms.addrs);
+        kfree(kallsyms.names);
+        kfree(buffer);
+        return -1;
+    }
+
+    kallsyms.buffer = buffer;
+    kallsyms.count = kallsyms_parse(buffer, buffer + size, count);
+    pr_info("kallsyms: %u symbols loaded\n", kallsyms.count);
+    return 0;
+}
+
+const char *kallsyms_lookup(uint32_t addr, uint32_t *offset) {
+    if (kallsyms.count == 0 || addr < kallsyms.addrs[0]) return NULL;
+
+    // Last symbol at or below addr
+    uint32_t lo = 0, hi = kallsyms.count - 1;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo + 1) / 2;
+        if (kallsyms.addrs[mid] <= addr) lo = mid;
+        else hi = mid - 1;
+    }
+
+    if (offset) *offset = addr - kallsyms.addrs[lo];
+    return kallsyms.names[lo];
+}
@@ -16,9 +16,12 @@
 #include "loopback.h"
 #include "fs.h"
 #include "blkdev.h"
+#include "zram.h"
 #include "device.h"
 #include "process.h"
 #include "pmm.h"
+#include "swap.h"
+#include "ksm.h"
 #include "vmm.h"
 #include "fat12.h"
 #include "vga_gfx.h" // Keep this from original, as it's not explicitly removed and might be used elsewhere
@@ -54,8 +57,10 @@ void kernel_main(void) {
     // Initialize signal subsystem
     signal_init();
     
-    // Initialize PMM
-    pmm_init(128 * 1024 * 1024); // 128 MB
+    // Initialize PMM from the BIOS E820 map left by the bootloader
+    memory_region_t regions[E820_MAX_ENTRIES];
+    uint32_t region_count = memory_detect(regions, E820_MAX_ENTRIES);
+    pmm_init(regions, region_count);
     
     // Initialize VMM
     vmm_init();
@@ -76,6 +81,15 @@ void kernel_main(void) {
     // Initialize work queue subsystem
     workqueue_init();
     
+    // Keep a pool of cleared pages filled at idle time
+    pmm_zero_pool_init();
+    
+    // Start background page reclaim (active once a swap area is added)
+    kswapd_init();
+    
+    // Merge identical user pages in the background
+    ksm_init();
+    
     // Initialize network subsystem
     netdev_init();
     socket_init();
@@ -86,6 +100,7 @@ void kernel_main(void) {
     
     // Initialize block device subsystem
     blkdev_init();
+    zram_init();
     
     // Initialize device subsystem
     device_init();
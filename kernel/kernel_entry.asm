@@ -1,10 +1,59 @@
 [BITS 32]
 [EXTERN _kernel_main]
 
+; The kernel is linked at 3GB + 0x10000 but loaded at physical 0x10000.
+; Until paging is on, symbols must be converted to physical addresses.
+KERNEL_VIRT_BASE equ 0xC0000000
+KERNEL_PDE       equ (KERNEL_VIRT_BASE >> 22)  ; 768
+BOOT_TABLES      equ 4                          ; 16MB mapped at boot
+RECURSIVE_PDE    equ 1023
+
 section .text
     global _kernel_entry
+    global _boot_page_directory
     
 _kernel_entry:
+    ; Fill the boot page tables: physical 0 - 16MB
+    mov edi, boot_page_tables - KERNEL_VIRT_BASE
+    mov eax, 0x003              ; Present | RW
+    mov ecx, BOOT_TABLES * 1024
+.fill_tables:
+    mov [edi], eax
+    add eax, 4096
+    add edi, 4
+    loop .fill_tables
+    
+    ; Map them twice: at 0 (so the next instructions survive enabling
+    ; paging) and at 3GB. vmm_init() drops the low mapping.
+    mov edi, boot_page_directory - KERNEL_VIRT_BASE
+    mov eax, (boot_page_tables - KERNEL_VIRT_BASE) + 0x003
+    xor ecx, ecx
+.fill_dir:
+    mov [edi + ecx * 4], eax
+    mov [edi + (KERNEL_PDE * 4) + ecx * 4], eax
+    add eax, 4096
+    inc ecx
+    cmp ecx, BOOT_TABLES
+    jne .fill_dir
+    
+    ; Last slot points back at the directory: page tables become
+    ; visible at 0xFFC00000
+    mov eax, (boot_page_directory - KERNEL_VIRT_BASE) + 0x003
+    mov [edi + RECURSIVE_PDE * 4], eax
+    
+    ; Enable paging (PG) and make read-only pages read-only for ring 0
+    ; too (WP): kernel writes to user buffers must hit copy-on-write
+    mov eax, boot_page_directory - KERNEL_VIRT_BASE
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80010000
+    mov cr0, eax
+    
+    ; Continue at the linked (higher half) address
+    mov eax, .higher_half
+    jmp eax
+    
+.higher_half:
     ; Set up stack
     mov esp, kernel_stack_top
     
@@ -104,6 +153,16 @@ _isr8:
 
 
 
+; Boot paging structures. Kept in .data rather than .bss so they are
+; part of the loaded image and start out zeroed.
+section .data
+    align 4096
+_boot_page_directory:
+boot_page_directory:
+    times 1024 dd 0
+boot_page_tables:
+    times (BOOT_TABLES * 1024) dd 0
+
 section .bss
     align 16
 kernel_stack_bottom:
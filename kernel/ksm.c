@@ -0,0 +1,321 @@
+#include "ksm.h"
+#include "mm.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "slab.h"
+#include "rbtree.h"
+#include "process.h"
+#include "ktimer.h"
+#include "printk.h"
+#include "string.h"
+#include "idt.h"
+
+// A KSM page: one frame mapped read-only by every merged copy
+typedef struct {
+    struct rb_node rb;
+    uint32_t checksum;
+    uint32_t phys;
+} ksm_stable_node_t;
+
+// A page seen once in this pass, waiting for a twin
+typedef struct {
+    struct rb_node rb;
+    uint32_t checksum;
+    mm_struct_t *mm;
+    uint32_t vaddr;
+    uint32_t phys;
+} ksm_rmap_item_t;
+
+static struct rb_root stable_tree = RB_ROOT;
+static struct rb_root unstable_tree = RB_ROOT;
+static uint32_t nr_unstable = 0;
+
+static kmem_cache_t *stable_node_cache;
+static kmem_cache_t *rmap_item_cache;
+
+static ksm_stats_t ksm_stats;
+
+// Where the next round continues
+static struct {
+    uint32_t mm_index;          // Position in the address space list
+    uint32_t addr;              // Next address in that address space
+} ksm_scan;
+
+static uint32_t ksmd_pid = 0;
+static struct ktimer_list ksmd_timer;
+
+// Helper: FNV-1a over the words of a page
+static uint32_t ksm_checksum(const void *data) {
+    const uint32_t *words = (const uint32_t *)data;
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < PAGE_SIZE / 4; i++) {
+        hash = (hash ^ words[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Helper: Read-only version of a user PTE (COW if it was writable)
+static inline uint32_t ksm_write_protect(uint32_t pte) {
+    if (pte & PTE_RW) pte = (pte & ~PTE_RW) | PTE_COW;
+    return pte;
+}
+
+// Helper: Is mm still a live address space?
+static int ksm_mm_live(mm_struct_t *mm) {
+    for (mm_struct_t *cur = mm_next(NULL); cur; cur = mm_next(cur)) {
+        if (cur == mm) return 1;
+    }
+    return 0;
+}
+
+// Helper: Link a node into a checksum-ordered tree (duplicates go right)
+static void ksm_tree_insert(struct rb_root *root, struct rb_node *node,
+                            uint32_t checksum, size_t key_offset) {
+    struct rb_node **link = &root->rb_node, *parent = NULL;
+    while (*link) {
+        uint32_t key = *(uint32_t *)((uint8_t *)*link + key_offset);
+        parent = *link;
+        link = (checksum < key) ? &(*link)->rb_left : &(*link)->rb_right;
+    }
+    rb_link_node(node, parent, link);
+    rb_insert_color(node, root);
+}
+
+// Helper: Leftmost node with this checksum
+static struct rb_node *ksm_tree_first(struct rb_root *root, uint32_t checksum,
+                                      size_t key_offset) {
+    struct rb_node *node = root->rb_node, *found = NULL;
+    while (node) {
+        uint32_t key = *(uint32_t *)((uint8_t *)node + key_offset);
+        if (checksum < key) {
+            node = node->rb_left;
+        } else if (checksum > key) {
+            node = node->rb_right;
+        } else {
+            found = node;
+            node = node->rb_left;
+        }
+    }
+    return found;
+}
+
+#define STABLE_KEY   offsetof(ksm_stable_node_t, checksum)
+#define UNSTABLE_KEY offsetof(ksm_rmap_item_t, checksum)
+
+// Helper: Is a stable node's frame still a KSM page?
+static int ksm_stable_valid(ksm_stable_node_t *node) {
+    page_t *page = pmm_phys_to_page(node->phys);
+    return page && (page->flags & PG_KSM) && page->refcount;
+}
+
+// Helper: Find a KSM page with these contents, dropping stale nodes
+static ksm_stable_node_t *ksm_stable_search(const void *data, uint32_t checksum) {
+    struct rb_node *rb = ksm_tree_first(&stable_tree, checksum, STABLE_KEY);
+
+    while (rb) {
+        ksm_stable_node_t *node = rb_entry(rb, ksm_stable_node_t, rb);
+        if (node->checksum != checksum) break;
+        rb = rb_next(rb);
+
+        if (!ksm_stable_valid(node)) {
+            rb_erase(&node->rb, &stable_tree);
+            kmem_cache_free(stable_node_cache, node);
+            continue;
+        }
+        if (memcmp(phys_to_virt(node->phys), data, PAGE_SIZE) == 0) return node;
+    }
+    return NULL;
+}
+
+// Helper: Find and unlink an unchanged earlier page with these contents
+static ksm_rmap_item_t *ksm_unstable_search(const void *data, uint32_t checksum) {
+    struct rb_node *rb = ksm_tree_first(&unstable_tree, checksum, UNSTABLE_KEY);
+
+    while (rb) {
+        ksm_rmap_item_t *item = rb_entry(rb, ksm_rmap_item_t, rb);
+        if (item->checksum != checksum) break;
+        rb = rb_next(rb);
+
+        // The twin must still be a private page mapped where we saw it
+        if (!ksm_mm_live(item->mm)) continue;
+        uint32_t pte = vmm_get_pte(item->mm->pgd, item->vaddr);
+        page_t *page = pmm_phys_to_page(item->phys);
+        if (!(pte & PTE_PRESENT) || (pte & 0xFFFFF000) != item->phys ||
+            page->refcount != 1 || (page->flags & PG_KSM)) continue;
+
+        if (memcmp(phys_to_virt(item->phys), data, PAGE_SIZE) == 0) {
+            rb_erase(&item->rb, &unstable_tree);
+            nr_unstable--;
+            return item;
+        }
+    }
+    return NULL;
+}
+
+// Helper: Point a mapping at a KSM page and drop its own frame
+static void ksm_merge(mm_struct_t *mm, uint32_t vaddr, uint32_t pte, uint32_t kpage) {
+    pmm_ref_block(kpage);
+    vmm_set_pte(mm->pgd, vaddr, kpage | (ksm_write_protect(pte) & 0xFFF));
+    pmm_unref_block(pte & 0xFFFFF000);
+}
+
+// Helper: Examine one user page
+static void ksm_scan_page(mm_struct_t *mm, uint32_t vaddr, uint32_t pte) {
+    uint32_t phys = pte & 0xFFFFF000;
+    page_t *page = pmm_phys_to_page(phys);
+
+    // Only private pages: shared ones are already deduplicated
+    if (!page || page->refcount != 1 || (page->flags & PG_KSM)) return;
+
+    ksm_stats.pages_scanned++;
+    const void *data = phys_to_virt(phys);
+    uint32_t checksum = ksm_checksum(data);
+
+    ksm_stable_node_t *kpage = ksm_stable_search(data, checksum);
+    if (kpage) {
+        ksm_merge(mm, vaddr, pte, kpage->phys);
+        return;
+    }
+
+    ksm_rmap_item_t *twin = ksm_unstable_search(data, checksum);
+    if (twin) {
+        ksm_stable_node_t *node = (ksm_stable_node_t *)kmem_cache_alloc(stable_node_cache, GFP_KERNEL);
+        if (node) {
+            // The twin's frame becomes the KSM page
+            uint32_t twin_pte = vmm_get_pte(twin->mm->pgd, twin->vaddr);
+            vmm_set_pte(twin->mm->pgd, twin->vaddr, ksm_write_protect(twin_pte));
+            pmm_phys_to_page(twin->phys)->flags |= PG_KSM;
+
+            node->checksum = checksum;
+            node->phys = twin->phys;
+            ksm_tree_insert(&stable_tree, &node->rb, checksum, STABLE_KEY);
+
+            ksm_merge(mm, vaddr, pte, twin->phys);
+        }
+        kmem_cache_free(rmap_item_cache, twin);
+        return;
+    }
+
+    ksm_rmap_item_t *item = (ksm_rmap_item_t *)kmem_cache_alloc(rmap_item_cache, GFP_KERNEL);
+    if (!item) return;
+    item->checksum = checksum;
+    item->mm = mm;
+    item->vaddr = vaddr;
+    item->phys = phys;
+    ksm_tree_insert(&unstable_tree, &item->rb, checksum, UNSTABLE_KEY);
+    nr_unstable++;
+}
+
+// Helper: End of a pass: count KSM pages, drop stale ones and forget
+// the unmatched pages
+static void ksm_finish_pass(void) {
+    uint32_t shared = 0, sharing = 0;
+
+    struct rb_node *rb = rb_first(&stable_tree);
+    while (rb) {
+        ksm_stable_node_t *node = rb_entry(rb, ksm_stable_node_t, rb);
+        rb = rb_next(rb);
+
+        if (!ksm_stable_valid(node)) {
+            rb_erase(&node->rb, &stable_tree);
+            kmem_cache_free(stable_node_cache, node);
+            continue;
+        }
+        shared++;
+        sharing += pmm_phys_to_page(node->phys)->refcount - 1;
+    }
+
+    ksm_stats.pages_shared = shared;
+    ksm_stats.pages_sharing = sharing;
+    ksm_stats.pages_unshared = nr_unstable;
+    ksm_stats.full_scans++;
+
+    while ((rb = rb_first(&unstable_tree))) {
+        rb_erase(rb, &unstable_tree);
+        kmem_cache_free(rmap_item_cache, rb_entry(rb, ksm_rmap_item_t, rb));
+    }
+    nr_unstable = 0;
+}
+
+// Helper: Scan up to nr present pages from the cursor. Runs with
+// interrupts off, so no address space or region can go away under it.
+static void ksm_scan_round(uint32_t nr) {
+    uint32_t eflags = irq_save();
+
+    mm_struct_t *mm = mm_next(NULL);
+    for (uint32_t i = 0; mm && i < ksm_scan.mm_index; i++) mm = mm_next(mm);
+
+    // Bound the walk over unpopulated addresses too
+    uint32_t budget = nr * 16;
+
+    for (; mm; mm = mm_next(mm)) {
+        vm_area_t *vma;
+        list_for_each_entry(vma, &mm->mmap, list) {
+            if (vma->end <= ksm_scan.addr) continue;
+
+            uint32_t addr = vma->start > ksm_scan.addr ? vma->start : ksm_scan.addr;
+            for (; addr < vma->end; addr += PAGE_SIZE) {
+                if (nr == 0 || budget == 0) {
+                    ksm_scan.addr = addr;
+                    irq_restore(eflags);
+                    return;
+                }
+                budget--;
+
+                uint32_t pte = vmm_get_pte(mm->pgd, addr);
+                if (pte & PTE_PRESENT) {
+                    ksm_scan_page(mm, addr, pte);
+                    nr--;
+                }
+            }
+        }
+
+        ksm_scan.mm_index++;
+        ksm_scan.addr = 0;
+    }
+
+    // Went past the last address space: the pass is complete
+    ksm_finish_pass();
+    ksm_scan.mm_index = 0;
+    ksm_scan.addr = 0;
+
+    irq_restore(eflags);
+}
+
+static void ksmd_wakeup(unsigned long pid) {
+    process_unblock((uint32_t)pid);
+}
+
+// Scanner thread: one round, then sleep
+static void ksmd(void) {
+    ksmd_pid = current_process->pid;
+    process_set_priority(ksmd_pid, 0);
+    ktimer_setup(&ksmd_timer, ksmd_wakeup, ksmd_pid);
+
+    while (1) {
+        ksm_scan_round(KSM_PAGES_TO_SCAN);
+
+        // The timer list is walked from the timer IRQ, and the wakeup
+        // must not fire before we are blocked
+        uint32_t eflags = irq_save();
+        ktimer_mod(&ksmd_timer, jiffies + msecs_to_jiffies(KSM_SLEEP_MS));
+        process_block(ksmd_pid);
+        irq_restore(eflags);
+    }
+}
+
+void ksm_init(void) {
+    stable_node_cache = kmem_cache_create("ksm_stable_node", sizeof(ksm_stable_node_t), 0, 0);
+    rmap_item_cache = kmem_cache_create("ksm_rmap_item", sizeof(ksm_rmap_item_t), 0, 0);
+    if (!stable_node_cache || !rmap_item_cache) {
+        pr_err("KSM: Cannot create caches\n");
+        return;
+    }
+
+    process_create(ksmd);
+    pr_info("KSM: ksmd started (%d pages every %d ms)\n", KSM_PAGES_TO_SCAN, KSM_SLEEP_MS);
+}
+
+void ksm_get_stats(ksm_stats_t *stats) {
+    if (stats) *stats = ksm_stats;
+}
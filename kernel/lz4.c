@@ -0,0 +1,157 @@
+#include "lz4.h"
+#include "string.h"
+
+// Block format: sequences of
+//   token (literal length << 4 | match length - 4)
+//   [literal length extension] literals
+//   offset (16-bit little endian) [match length extension]
+// Lengths of 15 continue in extension bytes (255 = keep going). The
+// last sequence has literals only.
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5     // The last 5 bytes are always literals
+#define LZ4_MFLIMIT       12    // The last match starts this far from the end
+#define LZ4_MAX_OFFSET    0xFFFF
+
+static inline uint32_t lz4_read32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t lz4_hash(uint32_t seq) {
+    return (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// Helper: Emit the extension bytes of a length
+static inline uint8_t *lz4_put_length(uint8_t *op, uint32_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// Helper: Emit token + literals; the match part is filled by the caller.
+// Returns the token or NULL if the output is full.
+static uint8_t *lz4_put_literals(uint8_t **op, uint8_t *oend, const uint8_t *lit,
+                                 uint32_t lit_len, uint32_t match_len) {
+    // Worst case: token, extensions, literals, offset
+    uint32_t need = 1 + lit_len + lit_len / 255 + 1 + 2 + match_len / 255 + 1;
+    if ((uint32_t)(oend - *op) < need) return 0;
+
+    uint8_t *token = (*op)++;
+    *token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+    if (lit_len >= 15) *op = lz4_put_length(*op, lit_len - 15);
+
+    memcpy(*op, lit, lit_len);
+    *op += lit_len;
+    return token;
+}
+
+uint32_t lz4_compress(const uint8_t *src, uint32_t src_len,
+                      uint8_t *dst, uint32_t dst_cap, void *wrkmem) {
+    if (src_len > 0x10000) return 0;
+
+    uint16_t *table = (uint16_t *)wrkmem;
+    memset(table, 0, LZ4_WORKMEM_SIZE);
+
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *end = src + src_len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_cap;
+
+    if (src_len >= LZ4_MFLIMIT) {
+        const uint8_t *mflimit = end - LZ4_MFLIMIT;
+        const uint8_t *matchlimit = end - LZ4_LAST_LITERALS;
+
+        while (ip < mflimit) {
+            uint32_t seq = lz4_read32(ip);
+            uint32_t h = lz4_hash(seq);
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint16_t)(ip - src);
+
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || lz4_read32(ref) != seq) {
+                ip++;
+                continue;
+            }
+
+            // Extend the match as far as the format allows
+            const uint8_t *mp = ip + LZ4_MIN_MATCH;
+            const uint8_t *rp = ref + LZ4_MIN_MATCH;
+            while (mp < matchlimit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+
+            uint32_t match_len = (uint32_t)(mp - ip) - LZ4_MIN_MATCH;
+            uint8_t *token = lz4_put_literals(&op, oend, anchor, (uint32_t)(ip - anchor), match_len);
+            if (!token) return 0;
+
+            uint32_t offset = (uint32_t)(ip - ref);
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
+
+            *token |= (uint8_t)(match_len >= 15 ? 15 : match_len);
+            if (match_len >= 15) op = lz4_put_length(op, match_len - 15);
+
+            ip = mp;
+            anchor = ip;
+        }
+    }
+
+    // Trailing literals
+    if (!lz4_put_literals(&op, oend, anchor, (uint32_t)(end - anchor), 0)) return 0;
+    return (uint32_t)(op - dst);
+}
+
+int lz4_decompress(const uint8_t *src, uint32_t src_len,
+                   uint8_t *dst, uint32_t dst_cap) {
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + src_len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        uint32_t lit_len = token >> 4;
+        if (lit_len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                lit_len += b;
+            } while (b == 255);
+        }
+
+        if ((uint32_t)(iend - ip) < lit_len || (uint32_t)(oend - op) < lit_len) return -1;
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == iend) break;  // Last sequence: literals only
+
+        if (iend - ip < 2) return -1;
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t)(op - dst)) return -1;
+
+        uint32_t match_len = token & 15;
+        if (match_len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                match_len += b;
+            } while (b == 255);
+        }
+        match_len += LZ4_MIN_MATCH;
+        if ((uint32_t)(oend - op) < match_len) return -1;
+
+        // Byte copy: the match may overlap the output (runs)
+        const uint8_t *match = op - offset;
+        while (match_len--) *op++ = *match++;
+    }
+
+    return (int)(op - dst);
+}
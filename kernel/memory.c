@@ -1,71 +1,604 @@
 #include "memory.h"
 #include "printk.h"
 #include "string.h"
+#include "page.h"
+#include "idt.h"
+#include "vmm.h"
+#include "slab.h"
+#include "shrinker.h"
+#include "memprof.h"
 
 // Heap
-// Let's place the heap at 2MB mark (0x200000) for now
-// and give it 1MB size.
-#define HEAP_START 0x200000
-#define HEAP_SIZE  0x100000
+// The heap lives in its own virtual range above the linear map
+// (KERNEL_HEAP_START - KERNEL_HEAP_END). It starts with HEAP_INITIAL_SIZE
+// mapped and grows at the top by mapping frames from the PMM whenever no
+// free block fits; under memory pressure a free block at the top is
+// unmapped again. The page tables of the range exist from vmm_init(),
+// so every address space sees the new pages at once.
+#define HEAP_INITIAL_SIZE 0x40000   // 256KB
+#define HEAP_GROW_MIN     0x10000   // Grow by at least 64KB
+
+// Two-level segregated fit (TLSF)
+// Free blocks sit in size classes: the first level splits by power of
+// two, the second level splits each power of two into HEAP_SL_COUNT
+// linear steps. A bitmap per level finds the first non-empty class that
+// is big enough with two bit scans, so kmalloc and kfree are O(1).
+// Every block records its physical neighbour below (boundary tag), so
+// a freed block merges with free blocks on both sides.
+#define HEAP_ALIGN_LOG2  3
+#define HEAP_ALIGN       (1 << HEAP_ALIGN_LOG2)
+#define HEAP_SL_LOG2     4
+#define HEAP_SL_COUNT    (1 << HEAP_SL_LOG2)
+#define HEAP_FL_SHIFT    (HEAP_SL_LOG2 + HEAP_ALIGN_LOG2)
+#define HEAP_FL_MAX      27     // Blocks up to 128MB
+#define HEAP_FL_COUNT    (HEAP_FL_MAX - HEAP_FL_SHIFT + 1)
+#define HEAP_SMALL_BLOCK (1 << HEAP_FL_SHIFT)   // Below this, first level 0
+
+// Low bit of the size field
+#define HEAP_BLOCK_FREE  0x1
 
 typedef struct heap_block {
-    size_t size;
-    uint8_t is_free;
-    struct heap_block *next;
+    struct heap_block *prev_phys;   // Block just below this one, NULL for the first
+    size_t size;                    // Payload size | HEAP_BLOCK_FREE
+    // Payload starts here; free blocks keep their list links in it
+    struct heap_block *next_free;
+    struct heap_block *prev_free;
 } heap_block_t;
 
-static heap_block_t *heap_head = (heap_block_t *)HEAP_START;
+#define HEAP_BLOCK_HEADER  offsetof(heap_block_t, next_free)
+#define HEAP_BLOCK_MIN     (sizeof(heap_block_t) - HEAP_BLOCK_HEADER)
+#define HEAP_BLOCK_MAX     ((size_t)1 << HEAP_FL_MAX)
+
+static struct {
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmap[HEAP_FL_COUNT];
+    heap_block_t *blocks[HEAP_FL_COUNT][HEAP_SL_COUNT];
+} heap;
+
+static heap_stats_t heap_counters;
+
+static uint32_t heap_brk = KERNEL_HEAP_START;   // End of the mapped heap
+static int heap_resizing = 0;   // Growth allocates frames, which may shrink
+
+static inline size_t block_size(const heap_block_t *block) {
+    return block->size & ~(size_t)HEAP_BLOCK_FREE;
+}
+
+static inline int block_is_free(const heap_block_t *block) {
+    return block->size & HEAP_BLOCK_FREE;
+}
+
+static inline void *block_to_ptr(heap_block_t *block) {
+    return (uint8_t *)block + HEAP_BLOCK_HEADER;
+}
+
+static inline heap_block_t *block_from_ptr(const void *ptr) {
+    return (heap_block_t *)((uint8_t *)ptr - HEAP_BLOCK_HEADER);
+}
+
+static inline heap_block_t *block_next(heap_block_t *block) {
+    return (heap_block_t *)((uint8_t *)block_to_ptr(block) + block_size(block));
+}
+
+static inline int heap_fls(uint32_t word) {
+    return 31 - __builtin_clz(word);
+}
+
+// Helper: Size class holding blocks of this size
+static void mapping_insert(size_t size, int *fl, int *sl) {
+    if (size < HEAP_SMALL_BLOCK) {
+        *fl = 0;
+        *sl = (int)size / (HEAP_SMALL_BLOCK / HEAP_SL_COUNT);
+    } else {
+        int bit = heap_fls(size);
+        *sl = (int)(size >> (bit - HEAP_SL_LOG2)) ^ HEAP_SL_COUNT;
+        *fl = bit - HEAP_FL_SHIFT + 1;
+    }
+}
+
+// Helper: First size class whose blocks all fit this size
+static void mapping_search(size_t size, int *fl, int *sl) {
+    if (size >= HEAP_SMALL_BLOCK) {
+        size += (1 << (heap_fls(size) - HEAP_SL_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+// Helper: Non-empty class at or above (fl, sl), NULL if none
+static heap_block_t *search_suitable_block(int *fl, int *sl) {
+    uint32_t sl_map = heap.sl_bitmap[*fl] & (~0u << *sl);
+    if (!sl_map) {
+        uint32_t fl_map = heap.fl_bitmap & (~0u << (*fl + 1));
+        if (!fl_map) return NULL;
+        *fl = __builtin_ctz(fl_map);
+        sl_map = heap.sl_bitmap[*fl];
+    }
+    *sl = __builtin_ctz(sl_map);
+    return heap.blocks[*fl][*sl];
+}
+
+static void insert_free_block(heap_block_t *block) {
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+
+    block->size |= HEAP_BLOCK_FREE;
+    block->prev_free = NULL;
+    block->next_free = heap.blocks[fl][sl];
+    if (block->next_free) block->next_free->prev_free = block;
+    heap.blocks[fl][sl] = block;
+
+    heap.fl_bitmap |= 1u << fl;
+    heap.sl_bitmap[fl] |= 1u << sl;
+}
+
+static void remove_free_block(heap_block_t *block) {
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+
+    if (block->prev_free) block->prev_free->next_free = block->next_free;
+    else heap.blocks[fl][sl] = block->next_free;
+    if (block->next_free) block->next_free->prev_free = block->prev_free;
+
+    if (!heap.blocks[fl][sl]) {
+        heap.sl_bitmap[fl] &= ~(1u << sl);
+        if (!heap.sl_bitmap[fl]) heap.fl_bitmap &= ~(1u << fl);
+    }
+    block->size &= ~(size_t)HEAP_BLOCK_FREE;
+}
+
+// Helper: Absorb a block's upper neighbour into it
+static void block_absorb(heap_block_t *block, heap_block_t *next) {
+    block->size += HEAP_BLOCK_HEADER + block_size(next);
+    block_next(block)->prev_phys = block;
+}
+
+// Helper: Cut a used block down to size, freeing the rest
+static void block_trim(heap_block_t *block, size_t size) {
+    if (block_size(block) < size + sizeof(heap_block_t)) return;
+
+    heap_block_t *rest = (heap_block_t *)((uint8_t *)block_to_ptr(block) + size);
+    rest->prev_phys = block;
+    rest->size = block_size(block) - size - HEAP_BLOCK_HEADER;
+    block->size = size;
+
+    heap_block_t *next = block_next(rest);
+    next->prev_phys = rest;
+    if (block_is_free(next)) {
+        remove_free_block(next);
+        block_absorb(rest, next);
+    }
+    insert_free_block(rest);
+}
+
+static inline size_t heap_adjust_size(size_t size) {
+    if (size < HEAP_BLOCK_MIN) size = HEAP_BLOCK_MIN;
+    return (size + HEAP_ALIGN - 1) & ~(size_t)(HEAP_ALIGN - 1);
+}
+
+// Helper: Take a free block of at least size bytes off its list
+static heap_block_t *heap_take_block(size_t size) {
+    int fl, sl;
+    mapping_search(size, &fl, &sl);
+    if (fl >= HEAP_FL_COUNT) return NULL;
+
+    heap_block_t *block = search_suitable_block(&fl, &sl);
+    if (block) remove_free_block(block);
+    return block;
+}
+
+// Helper: Map frames at the top of the heap. Returns the bytes mapped,
+// at least min_size, or 0.
+static uint32_t heap_map_pages(uint32_t min_size, uint32_t size) {
+    uint32_t mapped = 0;
+    for (; mapped < size; mapped += PAGE_SIZE) {
+        uint32_t frame = pmm_alloc_block();
+        if (!frame) break;
+        vmm_map_page(frame, heap_brk + mapped, PTE_PRESENT | PTE_RW);
+    }
+
+    if (mapped < min_size) {
+        vmm_unmap_range(vmm_get_kernel_directory(), heap_brk, mapped, 1);
+        return 0;
+    }
+    return mapped;
+}
+
+// Helper: Extend the heap so a block of size bytes can be found
+static int heap_grow(size_t size) {
+    if (heap_resizing) return 0;
+
+    // The new block must land in a class that mapping_search() accepts
+    size_t need = size + HEAP_BLOCK_HEADER;
+    if (size >= HEAP_SMALL_BLOCK) need += (1 << (heap_fls(size) - HEAP_SL_LOG2)) - 1;
+    need = (need + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    if (need > KERNEL_HEAP_END - heap_brk) return 0;
+
+    uint32_t want = need < HEAP_GROW_MIN ? HEAP_GROW_MIN : need;
+    if (want > KERNEL_HEAP_END - heap_brk) want = KERNEL_HEAP_END - heap_brk;
+
+    heap_resizing = 1;
+    uint32_t grown = heap_map_pages(need, want);
+    heap_resizing = 0;
+    if (!grown) return 0;
+
+    // The old end marker becomes the header of the new free block
+    heap_block_t *block = (heap_block_t *)(heap_brk - HEAP_BLOCK_HEADER);
+    block->size = grown - HEAP_BLOCK_HEADER;
+    heap_brk += grown;
+
+    heap_block_t *end = block_next(block);
+    end->prev_phys = block;
+    end->size = 0;
+
+    heap_block_t *prev = block->prev_phys;
+    if (prev && block_is_free(prev)) {
+        remove_free_block(prev);
+        block_absorb(prev, block);
+        block = prev;
+    }
+    insert_free_block(block);
+
+    heap_counters.total += grown;
+    heap_counters.grown += grown / PAGE_SIZE;
+    return 1;
+}
+
+// Helper: Where the heap could end if its free tail were unmapped.
+// Returns heap_brk if nothing can be released.
+static uint32_t heap_trim_point(void) {
+    heap_block_t *end = (heap_block_t *)(heap_brk - HEAP_BLOCK_HEADER);
+    heap_block_t *tail = end->prev_phys;
+    if (!tail || !block_is_free(tail)) return heap_brk;
+
+    // Keep the smallest block and the initial size
+    uint32_t new_brk = (uint32_t)block_to_ptr(tail) + HEAP_BLOCK_MIN + HEAP_BLOCK_HEADER;
+    new_brk = (new_brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (new_brk < KERNEL_HEAP_START + HEAP_INITIAL_SIZE) new_brk = KERNEL_HEAP_START + HEAP_INITIAL_SIZE;
+    return new_brk < heap_brk ? new_brk : heap_brk;
+}
+
+uint32_t heap_shrink(void) {
+    uint32_t eflags = irq_save();
+    uint32_t new_brk = heap_trim_point();
+    if (heap_resizing || new_brk == heap_brk) {
+        irq_restore(eflags);
+        return 0;
+    }
+
+    heap_block_t *end = (heap_block_t *)(heap_brk - HEAP_BLOCK_HEADER);
+    heap_block_t *tail = end->prev_phys;
+    remove_free_block(tail);
+    tail->size = new_brk - HEAP_BLOCK_HEADER - (uint32_t)block_to_ptr(tail);
+    end = block_next(tail);
+    end->prev_phys = tail;
+    end->size = 0;
+    insert_free_block(tail);
+
+    uint32_t released = heap_brk - new_brk;
+    vmm_unmap_range(vmm_get_kernel_directory(), new_brk, released, 1);
+    heap_brk = new_brk;
+
+    heap_counters.total -= released;
+    heap_counters.shrunk += released / PAGE_SIZE;
+    irq_restore(eflags);
+    return released / PAGE_SIZE;
+}
+
+// Add a region to the heap: one free block and a used end marker
+static void heap_add_region(uint32_t start, uint32_t size) {
+    heap_block_t *block = (heap_block_t *)start;
+    heap_block_t *end = (heap_block_t *)(start + size - HEAP_BLOCK_HEADER);
+
+    block->prev_phys = NULL;
+    block->size = size - 2 * HEAP_BLOCK_HEADER;
+    end->prev_phys = block;
+    end->size = 0;
+
+    insert_free_block(block);
+    heap_counters.total += size;
+}
 
 void heap_init(void) {
-    heap_head->size = HEAP_SIZE - sizeof(heap_block_t);
-    heap_head->is_free = 1;
-    heap_head->next = NULL;
+    memset(&heap, 0, sizeof(heap));
+
+    uint32_t size = heap_map_pages(HEAP_INITIAL_SIZE, HEAP_INITIAL_SIZE);
+    if (!size) {
+        pr_err("Heap: Cannot map %d KB\n", HEAP_INITIAL_SIZE / 1024);
+        return;
+    }
+    heap_add_region(heap_brk, size);
+    heap_brk += size;
 }
 
-void *kmalloc(size_t size) {
-    heap_block_t *current = heap_head;
-    
-    // Align size to 16 bytes for safety
-    size = (size + 15) & ~15;
-    
-    while (current) {
-        if (current->is_free && current->size >= size) {
-            // Found a block
-            
-            // Check if we can split it
-            if (current->size > size + sizeof(heap_block_t) + 16) {
-                heap_block_t *new_block = (heap_block_t*)((uint8_t*)current + sizeof(heap_block_t) + size);
-                new_block->size = current->size - size - sizeof(heap_block_t);
-                new_block->is_free = 1;
-                new_block->next = current->next;
-                
-                current->size = size;
-                current->next = new_block;
-            }
-            
-            current->is_free = 0;
-            return (void*)((uint8_t*)current + sizeof(heap_block_t));
+void *heap_alloc(size_t size) {
+    if (size == 0 || size > HEAP_BLOCK_MAX) return NULL;
+    size = heap_adjust_size(size);
+
+    uint32_t eflags = irq_save();
+    heap_block_t *block = heap_take_block(size);
+    if (!block && heap_grow(size)) block = heap_take_block(size);
+    if (!block) {
+        heap_counters.failures++;
+        irq_restore(eflags);
+        return NULL;
+    }
+
+    block_trim(block, size);
+    heap_counters.used += block_size(block) + HEAP_BLOCK_HEADER;
+    heap_counters.allocs++;
+    irq_restore(eflags);
+    return block_to_ptr(block);
+}
+
+// Helper: kmalloc_aligned() without profiler accounting
+static void *heap_alloc_aligned(size_t size, size_t align) {
+    if (align <= HEAP_ALIGN) return heap_alloc(size);
+    if (align & (align - 1) || size == 0 || size > HEAP_BLOCK_MAX) return NULL;
+    size = heap_adjust_size(size);
+
+    // Room to move the start up to the boundary and free the gap below it
+    uint32_t eflags = irq_save();
+    size_t search = size + align + sizeof(heap_block_t);
+    heap_block_t *block = heap_take_block(search);
+    if (!block && heap_grow(search)) block = heap_take_block(search);
+    if (!block) {
+        heap_counters.failures++;
+        irq_restore(eflags);
+        return NULL;
+    }
+
+    uintptr_t ptr = (uintptr_t)block_to_ptr(block);
+    uintptr_t aligned = ptr;
+    if (ptr & (align - 1)) {
+        // Leave a gap big enough to be a free block
+        aligned = (ptr + sizeof(heap_block_t) + align - 1) & ~(uintptr_t)(align - 1);
+    }
+
+    if (aligned != ptr) {
+        // Split off the gap as a free block of its own
+        heap_block_t *gap = block;
+        block = block_from_ptr((void *)aligned);
+        block->prev_phys = gap;
+        block->size = block_size(gap) - (aligned - ptr);
+        gap->size = aligned - ptr - HEAP_BLOCK_HEADER;
+        block_next(block)->prev_phys = block;
+
+        // The gap's lower neighbour is in use or it would have merged
+        insert_free_block(gap);
+    }
+
+    block_trim(block, size);
+    heap_counters.used += block_size(block) + HEAP_BLOCK_HEADER;
+    heap_counters.allocs++;
+    irq_restore(eflags);
+    return (void *)aligned;
+}
+
+void heap_free(void *ptr) {
+    if (!ptr) return;
+
+    heap_block_t *block = block_from_ptr(ptr);
+    uint32_t eflags = irq_save();
+
+    heap_counters.used -= block_size(block) + HEAP_BLOCK_HEADER;
+    heap_counters.frees++;
+
+    heap_block_t *next = block_next(block);
+    if (block_is_free(next)) {
+        remove_free_block(next);
+        block_absorb(block, next);
+    }
+
+    heap_block_t *prev = block->prev_phys;
+    if (prev && block_is_free(prev)) {
+        remove_free_block(prev);
+        block_absorb(prev, block);
+        block = prev;
+    }
+
+    insert_free_block(block);
+    irq_restore(eflags);
+}
+
+// Helper: Resize a heap block where it is, growing into a free block
+// above it. Returns 0 if that block is missing or too small.
+static int heap_resize(void *ptr, size_t size) {
+    if (size > HEAP_BLOCK_MAX) return 0;
+    size = heap_adjust_size(size);
+
+    uint32_t eflags = irq_save();
+    heap_block_t *block = block_from_ptr(ptr);
+    heap_block_t *next = block_next(block);
+    size_t old_size = block_size(block);
+
+    if (size > old_size) {
+        if (!block_is_free(next) || old_size + HEAP_BLOCK_HEADER + block_size(next) < size) {
+            irq_restore(eflags);
+            return 0;
         }
-        current = current->next;
+        remove_free_block(next);
+        block_absorb(block, next);
+    }
+
+    block_trim(block, size);
+    heap_counters.used += block_size(block) - old_size;
+    irq_restore(eflags);
+    return 1;
+}
+
+static inline int heap_contains(const void *ptr) {
+    return (uint32_t)ptr >= KERNEL_HEAP_START && (uint32_t)ptr < heap_brk;
+}
+
+// Helper: kmalloc() charged to caller in the profiler
+static void *kmalloc_caller(size_t size, gfp_t flags, void *caller) {
+    void *ptr;
+    kmem_cache_t *cache = kmalloc_slab(size);
+    if (cache) {
+        ptr = kmem_cache_alloc_noprof(cache, flags);
+    } else {
+        ptr = heap_alloc(size);
+        if (ptr && (flags & __GFP_ZERO)) memset(ptr, 0, size);
     }
-    return NULL;
+
+    memprof_alloc(MEMPROF_KMALLOC, ptr, size, caller);
+    return ptr;
+}
+
+void *kmalloc(size_t size) {
+    return kmalloc_caller(size, GFP_KERNEL, __builtin_return_address(0));
+}
+
+void *kzalloc(size_t size) {
+    return kmalloc_caller(size, __GFP_ZERO, __builtin_return_address(0));
+}
+
+void *kmalloc_aligned(size_t size, size_t align) {
+    void *ptr = heap_alloc_aligned(size, align);
+    memprof_alloc(MEMPROF_KMALLOC, ptr, size, __builtin_return_address(0));
+    return ptr;
 }
 
 void kfree(void *ptr) {
     if (!ptr) return;
-    
-    heap_block_t *block = (heap_block_t*)((uint8_t*)ptr - sizeof(heap_block_t));
-    block->is_free = 1;
-    
-    // Merge with next block if free
-    if (block->next && block->next->is_free) {
-        block->size += sizeof(heap_block_t) + block->next->size;
-        block->next = block->next->next;
+    memprof_free(MEMPROF_KMALLOC, ptr);
+
+    if (heap_contains(ptr)) {
+        heap_free(ptr);
+        return;
     }
+
+    kmem_cache_t *cache = virt_to_cache(ptr);
+    if (cache) kmem_cache_free_noprof(cache, ptr);
+    else pr_err("kfree: %p was not allocated by kmalloc\n", ptr);
+}
+
+size_t ksize(const void *ptr) {
+    if (!ptr) return 0;
+    if (heap_contains(ptr)) return block_size(block_from_ptr(ptr));
+
+    kmem_cache_t *cache = virt_to_cache(ptr);
+    return cache ? cache->object_size : 0;
+}
+
+void *krealloc(void *ptr, size_t size) {
+    if (!ptr) return kmalloc(size);
+    if (size == 0) {
+        kfree(ptr);
+        return NULL;
+    }
+
+    // Fits the size class (slab) or the block can be resized in place
+    size_t old_size = ksize(ptr);
+    if (heap_contains(ptr) ? heap_resize(ptr, size) : size <= old_size) {
+        if (memprof_enabled()) {
+            memprof_free(MEMPROF_KMALLOC, ptr);
+            memprof_alloc(MEMPROF_KMALLOC, ptr, size, __builtin_return_address(0));
+        }
+        return ptr;
+    }
+
+    void *new_ptr = kmalloc_caller(size, GFP_KERNEL, __builtin_return_address(0));
+    if (!new_ptr) return NULL;
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    kfree(ptr);
+    return new_ptr;
+}
+
+void heap_get_stats(heap_stats_t *stats) {
+    if (!stats) return;
+
+    uint32_t eflags = irq_save();
+    *stats = heap_counters;
+    stats->free_blocks = 0;
+    stats->largest_free = 0;
+
+    // Walk the free lists (diagnostics only, not on the allocation path)
+    uint32_t free_bytes = 0;
+    for (int fl = 0; fl < HEAP_FL_COUNT; fl++) {
+        for (int sl = 0; sl < HEAP_SL_COUNT; sl++) {
+            for (heap_block_t *b = heap.blocks[fl][sl]; b; b = b->next_free) {
+                stats->free_blocks++;
+                free_bytes += block_size(b);
+                if (block_size(b) > stats->largest_free) stats->largest_free = block_size(b);
+            }
+        }
+    }
+    irq_restore(eflags);
+
+    // Share of free memory that cannot be handed out as one block
+    // (in 16-byte units so the product fits 32 bits)
+    stats->fragmentation = free_bytes >= 16 ? 100 - (stats->largest_free / 16) * 100 / (free_bytes / 16) : 0;
 }
 
+// Assumed RAM size when the bootloader could not get an E820 map
+#define MEMORY_DEFAULT_SIZE (128 * 1024 * 1024)
+
+uint32_t memory_detect(memory_region_t *regions, uint32_t max_regions) {
+    uint32_t entries = *(volatile uint16_t*)phys_to_virt(E820_COUNT_ADDR);
+    memory_map_entry_t *map = (memory_map_entry_t*)phys_to_virt(E820_MAP_ADDR);
+    uint32_t count = 0;
+
+    if (entries > E820_MAX_ENTRIES) entries = E820_MAX_ENTRIES;
+
+    for (uint32_t i = 0; i < entries && count < max_regions; i++) {
+        // 32-bit kernel: ignore anything at or above 4GB
+        if (map[i].length == 0 || map[i].base >= 0x100000000ULL) continue;
+
+        uint64_t end = map[i].base + map[i].length;
+        if (end > 0x100000000ULL) end = 0x100000000ULL;
+        uint64_t length = end - map[i].base;
+        if (length > 0xFFFFF000ULL) length = 0xFFFFF000ULL;
+
+        memory_region_t region;
+        region.base = (uint32_t)map[i].base;
+        region.length = (uint32_t)length;
+        region.type = (map[i].type == MEMORY_AVAILABLE) ? MEMORY_REGION_USABLE : MEMORY_REGION_RESERVED;
+
+        // Insertion sort by base address
+        uint32_t j = count++;
+        while (j > 0 && regions[j - 1].base > region.base) {
+            regions[j] = regions[j - 1];
+            j--;
+        }
+        regions[j] = region;
+    }
+
+    if (count == 0 && max_regions > 0) {
+        pr_warn("E820 map unavailable, assuming %d MB\n", MEMORY_DEFAULT_SIZE / (1024 * 1024));
+        regions[0].base = 0;
+        regions[0].length = MEMORY_DEFAULT_SIZE;
+        regions[0].type = MEMORY_REGION_USABLE;
+        count = 1;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        pr_debug("E820: 0x%x - 0x%x %s\n", regions[i].base,
+                 regions[i].base + regions[i].length - 1,
+                 regions[i].type == MEMORY_REGION_USABLE ? "usable" : "reserved");
+    }
+
+    return count;
+}
+
+static uint32_t heap_shrink_count(void) {
+    return (heap_brk - heap_trim_point()) / PAGE_SIZE;
+}
+
+static uint32_t heap_shrink_scan(uint32_t nr) {
+    (void)nr;   // The whole free tail goes at once
+    return heap_shrink();
+}
+
+static struct shrinker heap_shrinker = {
+    .name = "heap",
+    .count = heap_shrink_count,
+    .scan = heap_shrink_scan
+};
+
 void memory_init(void) {
     heap_init();
+    register_shrinker(&heap_shrinker);
     
     pr_info("Memory initialized.\n");
 }
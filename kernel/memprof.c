@@ -0,0 +1,192 @@
+#include "memprof.h"
+#include "kallsyms.h"
+#include "allocbench.h"
+#include "ktimer.h"
+#include "printk.h"
+#include "string.h"
+#include "idt.h"
+
+// A live object and the site it is charged to
+typedef struct {
+    uint32_t ptr;               // 0 = empty slot
+    uint32_t size;
+    uint16_t site;
+    uint8_t type;
+} memprof_object_t;
+
+static memprof_site_t sites[MEMPROF_MAX_SITES];
+static memprof_object_t objects[MEMPROF_MAX_OBJECTS];
+static uint32_t nr_sites = 0;
+static uint32_t nr_objects = 0;
+
+static int enabled = 0;
+static uint32_t untracked = 0;  // Allocations with no room in a table
+
+static const char *type_names[MEMPROF_NR_TYPES] = {"kmalloc", "slab", "page"};
+
+static inline uint32_t memprof_hash(uint32_t key) {
+    return (key * 2654435761u) >> 16;
+}
+
+// Helper: Find or add the site for caller. Returns its index or -1.
+static int memprof_site(uint32_t caller, uint8_t type) {
+    uint32_t i = memprof_hash(caller ^ type) & (MEMPROF_MAX_SITES - 1);
+
+    for (uint32_t n = 0; n < MEMPROF_MAX_SITES; n++) {
+        memprof_site_t *site = &sites[i];
+        if (site->caller == caller && site->type == type) return (int)i;
+        if (site->caller == 0) {
+            // Keep one slot free so lookups always terminate
+            if (nr_sites == MEMPROF_MAX_SITES - 1) return -1;
+            site->caller = caller;
+            site->type = type;
+            site->first_seen = jiffies;
+            nr_sites++;
+            return (int)i;
+        }
+        i = (i + 1) & (MEMPROF_MAX_SITES - 1);
+    }
+    return -1;
+}
+
+// Helper: Slot of a live object, or of the empty slot ending its probe
+static uint32_t memprof_object_slot(uint32_t ptr, uint8_t type) {
+    uint32_t i = memprof_hash(ptr ^ type) & (MEMPROF_MAX_OBJECTS - 1);
+    while (objects[i].ptr && (objects[i].ptr != ptr || objects[i].type != type)) {
+        i = (i + 1) & (MEMPROF_MAX_OBJECTS - 1);
+    }
+    return i;
+}
+
+// Helper: Remove a slot, moving later entries of the probe back into it
+static void memprof_object_remove(uint32_t hole) {
+    uint32_t i = hole;
+    while (1) {
+        i = (i + 1) & (MEMPROF_MAX_OBJECTS - 1);
+        if (!objects[i].ptr) break;
+
+        // An entry may fill the hole if its home is not in (hole, i]
+        uint32_t home = memprof_hash(objects[i].ptr ^ objects[i].type) & (MEMPROF_MAX_OBJECTS - 1);
+        if (((i - home) & (MEMPROF_MAX_OBJECTS - 1)) >= ((i - hole) & (MEMPROF_MAX_OBJECTS - 1))) {
+            objects[hole] = objects[i];
+            hole = i;
+        }
+    }
+    objects[hole].ptr = 0;
+    nr_objects--;
+}
+
+void memprof_enable(int on) {
+    enabled = on ? 1 : 0;
+}
+
+int memprof_enabled(void) {
+    return enabled;
+}
+
+void memprof_reset(void) {
+    uint32_t eflags = irq_save();
+    memset(sites, 0, sizeof(sites));
+    memset(objects, 0, sizeof(objects));
+    nr_sites = 0;
+    nr_objects = 0;
+    untracked = 0;
+    irq_restore(eflags);
+}
+
+void memprof_alloc(memprof_type_t type, const void *ptr, uint32_t size, void *caller) {
+    allocbench_record(type, ptr, size, 0);
+    if (!enabled || !ptr) return;
+
+    uint32_t eflags = irq_save();
+    int index = memprof_site((uint32_t)caller, (uint8_t)type);
+    uint32_t slot = memprof_object_slot((uint32_t)ptr, (uint8_t)type);
+
+    // Keep one object slot free as well
+    if (index < 0 || (!objects[slot].ptr && nr_objects == MEMPROF_MAX_OBJECTS - 1)) {
+        untracked++;
+        irq_restore(eflags);
+        return;
+    }
+
+    memprof_site_t *site = &sites[index];
+    site->allocs++;
+    site->bytes += size;
+    site->live_objs++;
+    site->live_bytes += size;
+    site->last_seen = jiffies;
+
+    if (objects[slot].ptr) {
+        // Reused before its free was seen (allocated while tracking was off)
+        memprof_site_t *old = &sites[objects[slot].site];
+        old->live_objs--;
+        old->live_bytes -= objects[slot].size;
+    } else {
+        nr_objects++;
+    }
+    objects[slot].ptr = (uint32_t)ptr;
+    objects[slot].size = size;
+    objects[slot].site = (uint16_t)index;
+    objects[slot].type = (uint8_t)type;
+    irq_restore(eflags);
+}
+
+void memprof_free(memprof_type_t type, const void *ptr) {
+    allocbench_record(type, ptr, 0, 1);
+    if (!ptr || nr_objects == 0) return;
+
+    uint32_t eflags = irq_save();
+    uint32_t slot = memprof_object_slot((uint32_t)ptr, (uint8_t)type);
+    if (objects[slot].ptr) {
+        memprof_site_t *site = &sites[objects[slot].site];
+        site->frees++;
+        site->live_objs--;
+        site->live_bytes -= objects[slot].size;
+        memprof_object_remove(slot);
+    }
+    irq_restore(eflags);
+}
+
+void memprof_show(uint32_t max) {
+    if (kallsyms_load() < 0) pr_info("(no %s on the boot disk: addresses only)\n", KALLSYMS_FILE);
+
+    uint32_t eflags = irq_save();
+    uint32_t live_bytes = 0;
+    for (uint32_t i = 0; i < MEMPROF_MAX_SITES; i++) live_bytes += sites[i].live_bytes;
+    pr_info("Tracking %s: %u sites, %u live objects (%u KB), %u untracked\n",
+            enabled ? "on" : "off", nr_sites, nr_objects, live_bytes / 1024, untracked);
+    irq_restore(eflags);
+
+    // Largest live footprint first (selection: the table is small)
+    uint8_t shown[MEMPROF_MAX_SITES / 8];
+    memset(shown, 0, sizeof(shown));
+
+    for (uint32_t n = 0; n < max; n++) {
+        eflags = irq_save();
+        int best = -1;
+        for (uint32_t i = 0; i < MEMPROF_MAX_SITES; i++) {
+            memprof_site_t *site = &sites[i];
+            if (!site->caller || (shown[i / 8] & (1 << (i % 8)))) continue;
+            if (best < 0 || site->live_bytes > sites[best].live_bytes ||
+                (site->live_bytes == sites[best].live_bytes && site->allocs > sites[best].allocs)) {
+                best = (int)i;
+            }
+        }
+        memprof_site_t top;
+        if (best >= 0) top = sites[best];
+        irq_restore(eflags);
+        if (best < 0) break;
+        shown[best / 8] |= 1 << (best % 8);
+
+        unsigned long elapsed = jiffies - top.first_seen;
+        uint32_t rate = elapsed ? top.allocs * HZ / elapsed : top.allocs;
+
+        uint32_t offset;
+        const char *name = kallsyms_lookup(top.caller, &offset);
+        if (name) pr_info("  %s+0x%x", name, offset);
+        else pr_info("  0x%x", top.caller);
+        pr_info(" [%s]: %u allocs (%u/s), %u freed, live %u (%u bytes), total %u bytes\n",
+                type_names[top.type], top.allocs, rate, top.frees,
+                top.live_objs, top.live_bytes, top.bytes);
+    }
+}
@@ -0,0 +1,477 @@
+#include "mm.h"
+#include "process.h"
+#include "memory.h"
+#include "printk.h"
+#include "string.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "swap.h"
+
+// Every live address space, for walks that start from a physical frame
+static LIST_HEAD(mm_list);
+
+vm_file_t *vm_file_create(uint8_t *data, uint32_t size) {
+    vm_file_t *file = (vm_file_t *)kmalloc(sizeof(vm_file_t));
+    if (!file) return NULL;
+
+    file->data = data;
+    file->size = size;
+    file->refcount = 1;
+    return file;
+}
+
+void vm_file_put(vm_file_t *file) {
+    if (!file) return;
+
+    if (--file->refcount == 0) {
+        kfree(file->data);
+        kfree(file);
+    }
+}
+
+// Helper: Page table flags for a region
+static uint32_t mm_pte_flags(uint32_t vm_flags) {
+    uint32_t flags = PTE_PRESENT | PTE_USER;
+    if (vm_flags & VM_WRITE) flags |= PTE_RW;
+    return flags;
+}
+
+// Helper: Link a region into the tree and the sorted list.
+// Returns 0 if it overlaps an existing region.
+static int mm_link_area(mm_struct_t *mm, vm_area_t *vma) {
+    struct rb_node **link = &mm->mm_rb.rb_node;
+    struct rb_node *parent = NULL;
+
+    while (*link) {
+        vm_area_t *cur = rb_entry(*link, vm_area_t, rb);
+        parent = *link;
+
+        if (vma->end <= cur->start) link = &(*link)->rb_left;
+        else if (vma->start >= cur->end) link = &(*link)->rb_right;
+        else return 0;  // Overlap
+    }
+
+    rb_link_node(&vma->rb, parent, link);
+    rb_insert_color(&vma->rb, &mm->mm_rb);
+
+    // The tree successor tells us where the region goes in the list
+    struct rb_node *next = rb_next(&vma->rb);
+    if (next) list_add_tail(&vma->list, &rb_entry(next, vm_area_t, rb)->list);
+    else list_add_tail(&vma->list, &mm->mmap);
+
+    mm->map_count++;
+    return 1;
+}
+
+// Helper: Unlink and free a region (its pages must already be gone)
+static void mm_free_area(mm_struct_t *mm, vm_area_t *vma) {
+    rb_erase(&vma->rb, &mm->mm_rb);
+    list_del(&vma->list);
+    mm->map_count--;
+
+    vm_file_put(vma->file);
+    kfree(vma);
+}
+
+// Helper: Split a region at addr; the original keeps [start, addr).
+// Returns the new upper part or NULL on out of memory.
+static vm_area_t *mm_split_area(mm_struct_t *mm, vm_area_t *vma, uint32_t addr) {
+    vm_area_t *upper = (vm_area_t *)kmalloc(sizeof(vm_area_t));
+    if (!upper) return NULL;
+
+    // File fields are absolute addresses, so both halves keep them
+    *upper = *vma;
+    upper->start = addr;
+    if (upper->file) upper->file->refcount++;
+
+    vma->end = addr;
+    mm_link_area(mm, upper);
+    return upper;
+}
+
+mm_struct_t *mm_create(void) {
+    mm_struct_t *mm = (mm_struct_t *)kmalloc(sizeof(mm_struct_t));
+    if (!mm) return NULL;
+
+    mm->pgd = vmm_create_directory();
+    if (!mm->pgd) {
+        kfree(mm);
+        return NULL;
+    }
+
+    mm->mm_rb = RB_ROOT;
+    INIT_LIST_HEAD(&mm->mmap);
+    mm->map_count = 0;
+    mm->start_brk = USER_HEAP_START;
+    mm->brk = USER_HEAP_START;
+    mm->users = 1;
+    list_add_tail(&mm->mmlist, &mm_list);
+    return mm;
+}
+
+mm_struct_t *mm_dup(mm_struct_t *old) {
+    mm_struct_t *mm = (mm_struct_t *)kmalloc(sizeof(mm_struct_t));
+    if (!mm) return NULL;
+
+    mm->pgd = 0;
+    mm->mm_rb = RB_ROOT;
+    INIT_LIST_HEAD(&mm->mmap);
+    mm->map_count = 0;
+    mm->start_brk = old->start_brk;
+    mm->brk = old->brk;
+    mm->users = 1;
+    INIT_LIST_HEAD(&mm->mmlist);    // Listed once the directory exists
+
+    vm_area_t *vma;
+    list_for_each_entry(vma, &old->mmap, list) {
+        if (!mm_add_area(mm, vma->start, vma->end, vma->flags, vma->file,
+                         vma->file_offset, vma->file_vaddr, vma->file_size)) {
+            mm_put(mm);
+            return NULL;
+        }
+    }
+
+    // Populated pages are shared copy-on-write
+    mm->pgd = vmm_clone_directory(old->pgd);
+    if (!mm->pgd) {
+        mm_put(mm);
+        return NULL;
+    }
+
+    list_add_tail(&mm->mmlist, &mm_list);
+    return mm;
+}
+
+void mm_put(mm_struct_t *mm) {
+    if (!mm || --mm->users > 0) return;
+
+    vm_area_t *vma, *tmp;
+    list_for_each_entry_safe(vma, tmp, &mm->mmap, list) {
+        mm_free_area(mm, vma);
+    }
+
+    list_del(&mm->mmlist);
+
+    // Releases the user frames along with the tables
+    if (mm->pgd) vmm_free_directory(mm->pgd);
+    kfree(mm);
+}
+
+mm_struct_t *mm_next(mm_struct_t *mm) {
+    struct list_head *next = mm ? mm->mmlist.next : mm_list.next;
+    if (next == &mm_list) return NULL;
+    return list_entry(next, mm_struct_t, mmlist);
+}
+
+vm_area_t *mm_add_area(mm_struct_t *mm, uint32_t start, uint32_t end,
+                       uint32_t flags, vm_file_t *file, uint32_t file_offset,
+                       uint32_t file_vaddr, uint32_t file_size) {
+    if (!mm) return NULL;
+
+    start &= ~(PAGE_SIZE - 1);
+    end = (end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (end <= start || end > KERNEL_VIRT_BASE) return NULL;  // end == 0: wrapped
+
+    vm_area_t *vma = (vm_area_t *)kmalloc(sizeof(vm_area_t));
+    if (!vma) return NULL;
+
+    vma->start = start;
+    vma->end = end;
+    vma->flags = flags;
+    vma->file = file;
+    vma->file_offset = file_offset;
+    vma->file_vaddr = file_vaddr;
+    vma->file_size = file_size;
+
+    if (!mm_link_area(mm, vma)) {
+        kfree(vma);
+        return NULL;
+    }
+
+    if (file) file->refcount++;
+    return vma;
+}
+
+vm_area_t *mm_find_area(mm_struct_t *mm, uint32_t addr) {
+    if (!mm) return NULL;
+
+    struct rb_node *node = mm->mm_rb.rb_node;
+    while (node) {
+        vm_area_t *vma = rb_entry(node, vm_area_t, rb);
+
+        if (addr < vma->start) node = node->rb_left;
+        else if (addr >= vma->end) node = node->rb_right;
+        else return vma;
+    }
+    return NULL;
+}
+
+// Helper: First region ending above addr (lower bound for range walks)
+static vm_area_t *mm_find_area_after(mm_struct_t *mm, uint32_t addr) {
+    struct rb_node *node = mm->mm_rb.rb_node;
+    vm_area_t *found = NULL;
+
+    while (node) {
+        vm_area_t *vma = rb_entry(node, vm_area_t, rb);
+
+        if (addr < vma->end) {
+            found = vma;
+            if (addr >= vma->start) break;
+            node = node->rb_left;
+        } else {
+            node = node->rb_right;
+        }
+    }
+    return found;
+}
+
+int mm_unmap(mm_struct_t *mm, uint32_t start, uint32_t end) {
+    if (!mm || start >= end) return 0;
+
+    vm_area_t *vma = mm_find_area_after(mm, start);
+    while (vma && vma->start < end) {
+        // Trim the region to the range
+        if (vma->start < start) {
+            vma = mm_split_area(mm, vma, start);
+            if (!vma) return -1;
+        }
+        if (vma->end > end && !mm_split_area(mm, vma, end)) return -1;
+
+        vmm_unmap_range(mm->pgd, vma->start, vma->end - vma->start, 1);
+
+        vm_area_t *next = NULL;
+        if (vma->list.next != &mm->mmap) next = list_next_entry(vma, list);
+        mm_free_area(mm, vma);
+        vma = next;
+    }
+    return 0;
+}
+
+int mm_protect(mm_struct_t *mm, uint32_t start, uint32_t end, uint32_t flags) {
+    if (!mm || start >= end) return 0;
+
+    // The whole range must be mapped
+    uint32_t addr = start;
+    vm_area_t *vma = mm_find_area(mm, start);
+    for (vm_area_t *cur = vma; addr < end; ) {
+        if (!cur || cur->start > addr) return -1;
+        addr = cur->end;
+        cur = (cur->list.next != &mm->mmap) ? list_next_entry(cur, list) : NULL;
+    }
+
+    flags &= VM_READ | VM_WRITE | VM_EXEC;
+
+    while (vma && vma->start < end) {
+        if (vma->start < start) {
+            vma = mm_split_area(mm, vma, start);
+            if (!vma) return -1;
+        }
+        if (vma->end > end && !mm_split_area(mm, vma, end)) return -1;
+
+        vma->flags = (vma->flags & ~(VM_READ | VM_WRITE | VM_EXEC)) | flags;
+        vmm_protect_range(mm->pgd, vma->start, vma->end - vma->start,
+                          mm_pte_flags(vma->flags));
+
+        vma = (vma->list.next != &mm->mmap) ? list_next_entry(vma, list) : NULL;
+    }
+    return 0;
+}
+
+int mm_populate_page(mm_struct_t *mm, vm_area_t *vma, uint32_t addr) {
+    uint32_t page = addr & ~(PAGE_SIZE - 1);
+
+    uint32_t frame = pmm_alloc_zeroed();
+    if (!frame) return -1;
+
+    // Frames are reached through the kernel's linear map
+    uint8_t *data = (uint8_t *)phys_to_virt(frame);
+
+    // Copy the part of the page backed by the image
+    if (vma->file) {
+        uint32_t lo = page > vma->file_vaddr ? page : vma->file_vaddr;
+        uint32_t hi = vma->file_vaddr + vma->file_size;
+        if (hi > page + PAGE_SIZE) hi = page + PAGE_SIZE;
+
+        if (lo < hi) {
+            memcpy(data + (lo - page),
+                   vma->file->data + vma->file_offset + (lo - vma->file_vaddr),
+                   hi - lo);
+        }
+    }
+
+    // No memory for the page table: report the fault as out of memory
+    if (!vmm_map_page_dir(mm->pgd, frame, page, mm_pte_flags(vma->flags))) {
+        pmm_free_block(frame);
+        return -1;
+    }
+    lru_cache_add(frame, page);
+    return 0;
+}
+
+// Helper: Bring a swapped out page back. Returns 0 on success.
+static int mm_swap_in_page(mm_struct_t *mm, vm_area_t *vma, uint32_t addr, uint32_t entry) {
+    uint32_t page = addr & ~(PAGE_SIZE - 1);
+
+    // Hold an extra reference until the page is mapped: if mapping fails
+    // the PTE still names the slot, which must keep its data
+    swap_dup(entry);
+    uint32_t frame = swap_in_page(entry);
+    if (!frame) {
+        swap_free(entry);
+        return -1;
+    }
+
+    if (!vmm_map_page_dir(mm->pgd, frame, page, mm_pte_flags(vma->flags))) {
+        pmm_free_block(frame);
+        return -1;
+    }
+    swap_free(entry);
+    lru_cache_add(frame, page);
+    return 0;
+}
+
+int mm_handle_fault(uint32_t addr, uint32_t err_code) {
+    // Only not-present faults are demand faults
+    if (!current_process || !current_process->mm || (err_code & 1)) return 0;
+
+    mm_struct_t *mm = current_process->mm;
+    vm_area_t *vma = mm_find_area(mm, addr);
+    if (!vma) return 0;
+
+    if ((err_code & 2) && !(vma->flags & VM_WRITE)) return 0;
+
+    uint32_t pte = vmm_get_pte(mm->pgd, addr);
+    if (pte_is_swap(pte)) {
+        if (mm_swap_in_page(mm, vma, addr, pte) < 0) {
+            pr_err("mm: Failed to swap in 0x%x\n", addr);
+            return 0;
+        }
+        return 1;
+    }
+
+    if (mm_populate_page(mm, vma, addr) < 0) {
+        pr_err("mm: Out of memory populating 0x%x\n", addr);
+        return 0;
+    }
+    return 1;
+}
+
+// Helper: Point every user mapping of old_phys at new_phys.
+// Returns the number of PTEs changed.
+static uint32_t mm_replace_frame(uint32_t old_phys, uint32_t new_phys) {
+    uint32_t count = 0;
+    mm_struct_t *mm;
+    vm_area_t *vma;
+
+    list_for_each_entry(mm, &mm_list, mmlist) {
+        list_for_each_entry(vma, &mm->mmap, list) {
+            count += vmm_replace_frame_range(mm->pgd, vma->start, vma->end - vma->start,
+                                             old_phys, new_phys);
+        }
+    }
+    return count;
+}
+
+uint32_t mm_migrate_page(uint32_t old_phys) {
+    uint32_t refs = pmm_block_refcount(old_phys);
+
+    uint32_t new_phys = pmm_alloc_block();
+    if (!new_phys) return 0;
+
+    memcpy(phys_to_virt(new_phys), phys_to_virt(old_phys), PAGE_SIZE);
+
+    // A reference not backed by a user mapping pins the frame: undo
+    if (mm_replace_frame(old_phys, new_phys) != refs) {
+        mm_replace_frame(new_phys, old_phys);
+        pmm_free_block(new_phys);
+        return 0;
+    }
+
+    // The copy inherits the references (COW sharing stays intact)
+    for (uint32_t i = 1; i < refs; i++) pmm_ref_block(new_phys);
+
+    // A merged (KSM) page stops being one: its frame is gone
+    page_t *old_page = pmm_phys_to_page(old_phys);
+    uint32_t vaddr = old_page->index;
+    old_page->flags &= ~PG_KSM;
+    lru_cache_del(old_phys);
+    lru_cache_add(new_phys, vaddr);
+    return new_phys;
+}
+
+// Helper: Address space mapping phys at vaddr (first one found)
+static mm_struct_t *mm_rmap_owner(uint32_t phys, uint32_t vaddr) {
+    mm_struct_t *mm;
+    list_for_each_entry(mm, &mm_list, mmlist) {
+        uint32_t pte = vmm_get_pte(mm->pgd, vaddr);
+        if ((pte & PTE_PRESENT) && (pte & 0xFFFFF000) == phys) return mm;
+    }
+    return NULL;
+}
+
+int mm_page_referenced(uint32_t phys, uint32_t vaddr) {
+    int referenced = 0;
+    mm_struct_t *mm;
+
+    list_for_each_entry(mm, &mm_list, mmlist) {
+        uint32_t pte = vmm_get_pte(mm->pgd, vaddr);
+        if (!(pte & PTE_PRESENT) || (pte & 0xFFFFF000) != phys) continue;
+
+        if (pte & PTE_ACCESSED) {
+            // Flushed so the CPU sets the bit again on the next access
+            vmm_set_pte(mm->pgd, vaddr, pte & ~PTE_ACCESSED);
+            referenced++;
+        }
+    }
+    return referenced;
+}
+
+int mm_page_mkclean(uint32_t phys, uint32_t vaddr) {
+    mm_struct_t *mm = mm_rmap_owner(phys, vaddr);
+    if (!mm) return 0;
+
+    // Flushed so the CPU sets the bit again on the next write
+    vmm_set_pte(mm->pgd, vaddr, vmm_get_pte(mm->pgd, vaddr) & ~PTE_DIRTY);
+    return 1;
+}
+
+int mm_unmap_to_swap(uint32_t phys, uint32_t vaddr, uint32_t entry) {
+    mm_struct_t *mm = mm_rmap_owner(phys, vaddr);
+    if (!mm || (vmm_get_pte(mm->pgd, vaddr) & PTE_DIRTY)) return 0;
+
+    vmm_set_pte(mm->pgd, vaddr, entry);
+    return 1;
+}
+
+uint32_t mm_brk(mm_struct_t *mm, uint32_t new_brk) {
+    if (!mm) return 0;
+
+    if (new_brk < mm->start_brk || new_brk > USER_STACK_TOP - USER_STACK_SIZE) {
+        return mm->brk;
+    }
+
+    uint32_t old_end = (mm->brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint32_t new_end = (new_brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    if (new_end > old_end) {
+        vm_area_t *heap = (old_end > mm->start_brk) ? mm_find_area(mm, old_end - 1) : NULL;
+
+        if (heap) {
+            // Refuse to grow into another region
+            struct rb_node *next = rb_next(&heap->rb);
+            if (next && rb_entry(next, vm_area_t, rb)->start < new_end) {
+                return mm->brk;
+            }
+            heap->end = new_end;
+        } else if (!mm_add_area(mm, mm->start_brk, new_end,
+                                VM_READ | VM_WRITE, NULL, 0, 0, 0)) {
+            return mm->brk;
+        }
+    } else if (new_end < old_end) {
+        // Drop the pages past the new break
+        if (mm_unmap(mm, new_end, old_end) < 0) return mm->brk;
+    }
+
+    mm->brk = new_brk;
+    return mm->brk;
+}
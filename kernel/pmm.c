@@ -1,149 +1,657 @@
 #include "pmm.h"
 #include "printk.h"
 #include "string.h"
+#include "page.h"
+#include "process.h"
+#include "mm.h"
+#include "idt.h"
+#include "swap.h"
+#include "shrinker.h"
+#include "memprof.h"
+
+// Binary buddy allocator
+// Free memory is kept as naturally aligned blocks of 2^order pages, one
+// free list per order. Allocation splits the smallest block that fits,
+// freeing merges a block with its buddy for as long as the buddy is free,
+// so both are O(PMM_MAX_ORDER) instead of a scan over every frame.
 
-// Bitmap size calculation
 // 4GB RAM / 4KB Blocks = 1,048,576 Blocks
-// Bitmap needs 1 bit per block -> 1,048,576 bits
-// 1,048,576 / 32 bits per uint32_t = 32,768 uint32_t entries
 #define MAX_BLOCKS 1048576
-#define BITMAP_SIZE (MAX_BLOCKS / 32)
 
-static uint32_t pmm_bitmap[BITMAP_SIZE];
+// The first 4MB hold the kernel image and the ramdisk
+#define PMM_RESERVED_END 0x400000
+
+// RAM is reached through the kernel's linear map at 3GB, which covers
+// the first LOWMEM_END bytes of physical memory
+#define PMM_MAX_ADDRESS LOWMEM_END
+
+// Zeroed pool: frames the idle thread keeps cleared for pmm_alloc_zeroed()
+#define ZERO_POOL_TARGET  64    // Frames kept ready (256KB)
+#define ZERO_POOL_BATCH   8     // Frames cleared per wakeup before yielding
+
+// Pages asked of the shrinkers before an allocation fails
+#define PMM_SHRINK_BATCH  32
+
+// Per-order free lists
+typedef struct {
+    struct list_head free_list;
+    uint32_t nr_free;
+} free_area_t;
+
+static free_area_t free_area[PMM_MAX_ORDER];
+
+// Frame descriptors, placed in usable RAM just above the reserved 4MB
+static page_t *mem_map = 0;
 static uint32_t total_blocks = 0;
 static uint32_t used_blocks = 0;
 
-// Helper: Set bit in bitmap
-static inline void bitmap_set(uint32_t bit) {
-    pmm_bitmap[bit / 32] |= (1 << (bit % 32));
+// Pooled frames stay allocated (refcount 0) and are linked through page->list
+static LIST_HEAD(zero_pool);
+static pmm_zero_stats_t zero_stats;
+
+static pmm_compact_stats_t compact_stats;
+
+// Free frame watermarks (see pmm_set_watermarks)
+static uint32_t wmark_low = PMM_WMARK_LOW;
+static uint32_t wmark_high = PMM_WMARK_HIGH;
+
+static inline page_t *pfn_to_page(uint32_t pfn) {
+    return &mem_map[pfn];
 }
 
-// Helper: Clear bit in bitmap
-static inline void bitmap_unset(uint32_t bit) {
-    pmm_bitmap[bit / 32] &= ~(1 << (bit % 32));
+static inline uint32_t page_to_pfn(page_t *page) {
+    return (uint32_t)(page - mem_map);
 }
 
-// Helper: Test bit in bitmap
-static inline int bitmap_test(uint32_t bit) {
-    return pmm_bitmap[bit / 32] & (1 << (bit % 32));
+// Helper: Clear a frame a dword at a time
+static inline void pmm_clear_frame(uint32_t addr) {
+    void *dst = phys_to_virt(addr);
+    uint32_t count = PMM_BLOCK_SIZE / 4;
+    __asm__ volatile("rep stosl" : "+D"(dst), "+c"(count) : "a"(0) : "memory");
 }
 
-// Helper: Find first free bit (optimized with 32-bit scanning)
-static uint32_t bitmap_find_free(void) {
-    for (uint32_t i = 0; i < BITMAP_SIZE; i++) {
-        if (pmm_bitmap[i] != 0xFFFFFFFF) {
-            // This uint32_t has at least one free bit
-            for (uint32_t j = 0; j < 32; j++) {
-                uint32_t bit = i * 32 + j;
-                if (bit >= total_blocks) return 0xFFFFFFFF;
-                if (!bitmap_test(bit)) {
-                    return bit;
-                }
-            }
+// Helper: Add a free block of 2^order pages to its free list
+static inline void buddy_add_free(uint32_t pfn, uint32_t order) {
+    page_t *page = pfn_to_page(pfn);
+    page->flags |= PG_BUDDY;
+    page->order = order;
+    list_add(&page->list, &free_area[order].free_list);
+    free_area[order].nr_free++;
+}
+
+// Helper: Remove a free block from its free list
+static inline void buddy_del_free(uint32_t pfn, uint32_t order) {
+    page_t *page = pfn_to_page(pfn);
+    list_del(&page->list);
+    page->flags &= ~PG_BUDDY;
+    page->order = 0;
+    free_area[order].nr_free--;
+}
+
+// Helper: Is pfn the head of a free block of exactly this order?
+static inline int buddy_is_free(uint32_t pfn, uint32_t order) {
+    if (pfn >= total_blocks) return 0;
+    page_t *page = pfn_to_page(pfn);
+    return (page->flags & PG_BUDDY) && page->order == order;
+}
+
+// Helper: Find the head of the free block containing pfn
+static uint32_t buddy_find_free_head(uint32_t pfn, uint32_t *order_out) {
+    for (uint32_t order = 0; order < PMM_MAX_ORDER; order++) {
+        uint32_t head = pfn & ~((1u << order) - 1);
+        if (buddy_is_free(head, order)) {
+            if (order_out) *order_out = order;
+            return head;
+        }
+    }
+    return 0xFFFFFFFF; // Frame is allocated
+}
+
+// Helper: Free a block and merge it with its buddies
+static void buddy_free(uint32_t pfn, uint32_t order) {
+    while (order < PMM_MAX_ORDER - 1) {
+        uint32_t buddy = pfn ^ (1u << order);
+        if (!buddy_is_free(buddy, order)) break;
+
+        buddy_del_free(buddy, order);
+        pfn &= buddy;  // Merged block starts at the lower of the two
+        order++;
+    }
+    buddy_add_free(pfn, order);
+}
+
+// Helper: Free an arbitrary frame range as maximal aligned blocks
+static void buddy_free_range(uint32_t pfn, uint32_t count) {
+    while (count > 0) {
+        uint32_t order = 0;
+        while (order < PMM_MAX_ORDER - 1 &&
+               !(pfn & (1u << order)) &&
+               (2u << order) <= count) {
+            order++;
         }
+        buddy_free(pfn, order);
+        pfn += 1u << order;
+        count -= 1u << order;
     }
-    return 0xFFFFFFFF; // No free blocks
 }
 
-// Helper: Find contiguous free blocks
-static uint32_t bitmap_find_free_contiguous(uint32_t count) {
-    uint32_t found = 0;
-    uint32_t start = 0;
-    
-    for (uint32_t i = 0; i < total_blocks; i++) {
-        if (!bitmap_test(i)) {
-            if (found == 0) start = i;
-            found++;
-            if (found == count) return start;
+// Helper: Remove a single frame from whatever free block contains it
+static int buddy_take_frame(uint32_t pfn) {
+    uint32_t order;
+    uint32_t head = buddy_find_free_head(pfn, &order);
+    if (head == 0xFFFFFFFF) return 0;
+
+    buddy_del_free(head, order);
+
+    // Split down, returning the halves that do not contain pfn
+    while (order > 0) {
+        order--;
+        uint32_t half = 1u << order;
+        if (pfn >= head + half) {
+            buddy_add_free(head, order);
+            head += half;
         } else {
-            found = 0;
+            buddy_add_free(head + half, order);
         }
     }
-    
-    return 0xFFFFFFFF; // Not enough contiguous blocks
+    return 1;
+}
+
+// Helper: Smallest order whose block holds count pages
+static uint32_t count_to_order(uint32_t count) {
+    uint32_t order = 0;
+    while ((1u << order) < count) order++;
+    return order;
 }
 
-void pmm_init(uint32_t mem_size) {
+// Helper: Round an address range inward to whole frames
+static void region_to_frames(uint32_t base, uint32_t length, uint32_t *first, uint32_t *last) {
+    uint32_t end = base + length;
+    if (end < base) end = 0xFFFFF000; // Wrapped past 4GB
+    *first = (base + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
+    *last = end / PMM_BLOCK_SIZE;
+}
+
+void pmm_init(const memory_region_t *regions, uint32_t count) {
     pr_info("Initializing PMM...\n");
-    
-    total_blocks = mem_size / PMM_BLOCK_SIZE;
+
+    // Highest usable frame decides the size of mem_map
+    uint32_t usable_blocks = 0;
+    total_blocks = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (regions[i].type != MEMORY_REGION_USABLE) continue;
+        uint32_t first, last;
+        region_to_frames(regions[i].base, regions[i].length, &first, &last);
+        if (last > PMM_MAX_ADDRESS / PMM_BLOCK_SIZE) last = PMM_MAX_ADDRESS / PMM_BLOCK_SIZE;
+        if (last <= first) continue;
+        if (last > total_blocks) total_blocks = last;
+        usable_blocks += last - first;
+    }
     if (total_blocks > MAX_BLOCKS) {
         total_blocks = MAX_BLOCKS;
     }
-    
-    used_blocks = 0;
-    
-    // Clear bitmap (0 = Free) - using optimized memset
-    memset((uint8_t*)pmm_bitmap, 0, BITMAP_SIZE * sizeof(uint32_t));
-    
-    // Mark the first 4MB as used (Kernel + BIOS Area + VGA)
-    // 4MB / 4KB = 1024 blocks.
-    for (uint32_t i = 0; i < 1024; i++) {
-        bitmap_set(i);
-        used_blocks++;
-    }
-    
+
+    for (int i = 0; i < PMM_MAX_ORDER; i++) {
+        INIT_LIST_HEAD(&free_area[i].free_list);
+        free_area[i].nr_free = 0;
+    }
+
+    // Frame descriptors go at the start of the first usable region that
+    // fits them, clear of the reserved low 4MB (Kernel + BIOS Area + VGA +
+    // Heap). The VMM is not up yet, so they must lie in the RAM mapped by
+    // kernel_entry.asm.
+    uint32_t map_size = total_blocks * sizeof(page_t);
+    uint32_t map_pages = (map_size + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
+    uint32_t map_first = 0, map_last = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (regions[i].type != MEMORY_REGION_USABLE) continue;
+        uint32_t first, last;
+        region_to_frames(regions[i].base, regions[i].length, &first, &last);
+        if (first < PMM_RESERVED_END / PMM_BLOCK_SIZE) first = PMM_RESERVED_END / PMM_BLOCK_SIZE;
+        if (last > total_blocks) last = total_blocks;
+        if (last > first && last - first >= map_pages &&
+            first + map_pages <= BOOT_MAPPED_END / PMM_BLOCK_SIZE) {
+            map_first = first;
+            map_last = first + map_pages;
+            break;
+        }
+    }
+
+    if (!map_last) {
+        pr_crit("PMM: No room for frame descriptors!\n");
+        total_blocks = 0;
+        used_blocks = 0;
+        return;
+    }
+
+    mem_map = (page_t*)phys_to_virt(map_first * PMM_BLOCK_SIZE);
+    memset((uint8_t*)mem_map, 0, map_size);
+
+    // Everything starts allocated (holes, reserved ranges, low 4MB);
+    // only usable RAM is handed to the buddy lists
+    used_blocks = total_blocks;
+    uint32_t prev_last = PMM_RESERVED_END / PMM_BLOCK_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        if (regions[i].type != MEMORY_REGION_USABLE) continue;
+        uint32_t first, last;
+        region_to_frames(regions[i].base, regions[i].length, &first, &last);
+        if (first < prev_last) first = prev_last; // Regions are sorted; skip overlaps
+        if (last > total_blocks) last = total_blocks;
+        if (last <= first) continue;
+        prev_last = last;
+
+        // Carve the mem_map frames out of the range
+        if (map_first < last && map_last > first) {
+            if (map_first > first) {
+                buddy_free_range(first, map_first - first);
+                used_blocks -= map_first - first;
+            }
+            if (last > map_last) {
+                buddy_free_range(map_last, last - map_last);
+                used_blocks -= last - map_last;
+            }
+        } else {
+            buddy_free_range(first, last - first);
+            used_blocks -= last - first;
+        }
+    }
+
+    // Firmware-reserved ranges overlapping usable RAM stay reserved
+    for (uint32_t i = 0; i < count; i++) {
+        if (regions[i].type != MEMORY_REGION_USABLE &&
+            regions[i].base / PMM_BLOCK_SIZE < total_blocks) {
+            pmm_reserve_region(regions[i].base, regions[i].length);
+        }
+    }
+
     // Display memory info
-    uint32_t total_mb = (total_blocks * PMM_BLOCK_SIZE) / (1024 * 1024);
-    pr_info("PMM: Total Memory: %d MB\n", total_mb);
+    pr_info("PMM: Usable Memory: %d MB, %d MB free\n",
+            usable_blocks / (1024 * 1024 / PMM_BLOCK_SIZE),
+            (total_blocks - used_blocks) / (1024 * 1024 / PMM_BLOCK_SIZE));
 }
 
-uint32_t pmm_alloc_block(void) {
-    uint32_t block = bitmap_find_free();
-    
-    if (block == 0xFFFFFFFF) {
+// Helper: Smallest order >= order with a free block (PMM_MAX_ORDER if none)
+static uint32_t buddy_find_order(uint32_t order) {
+    while (order < PMM_MAX_ORDER && list_empty(&free_area[order].free_list)) {
+        order++;
+    }
+    return order;
+}
+
+// Helper: Give up to nr pooled frames back to the buddy lists.
+// Returns the number of frames released.
+static uint32_t pmm_drain_zero_pool(uint32_t nr) {
+    uint32_t drained = 0;
+    while (drained < nr && !list_empty(&zero_pool)) {
+        page_t *page = list_first_entry(&zero_pool, page_t, list);
+        list_del(&page->list);
+        page->flags &= ~PG_ZEROED;
+        buddy_free(page_to_pfn(page), 0);
+        used_blocks--;
+        zero_stats.pooled--;
+        drained++;
+    }
+    return drained;
+}
+
+uint32_t pmm_alloc_order(uint32_t order) {
+    if (order >= PMM_MAX_ORDER) return 0;
+
+    // Background threads (zeroing, kswapd) allocate and free too
+    uint32_t eflags = irq_save();
+
+    uint32_t current = buddy_find_order(order);
+
+    // Caches can give memory back (zeroed pool, empty slabs, heap)
+    if (current == PMM_MAX_ORDER && shrink_slab(PMM_SHRINK_BATCH + (1u << order))) {
+        current = buddy_find_order(order);
+    }
+
+    // Then push user pages out to swap, with interrupts back on for the I/O
+    if (current == PMM_MAX_ORDER) {
+        irq_restore(eflags);
+        try_to_free_pages(SWAP_CLUSTER);
+        eflags = irq_save();
+        current = buddy_find_order(order);
+    }
+
+    if (current == PMM_MAX_ORDER) {
+        irq_restore(eflags);
         pr_err("PMM: Out of Memory!\n");
         return 0;
     }
-    
-    bitmap_set(block);
-    used_blocks++;
-    return block * PMM_BLOCK_SIZE;
+
+    page_t *page = list_first_entry(&free_area[current].free_list, page_t, list);
+    uint32_t pfn = page_to_pfn(page);
+    buddy_del_free(pfn, current);
+
+    // Split, putting the upper halves back on the free lists
+    while (current > order) {
+        current--;
+        buddy_add_free(pfn + (1u << current), current);
+    }
+
+    pfn_to_page(pfn)->refcount = 1;
+    used_blocks += 1u << order;
+    irq_restore(eflags);
+
+    if (total_blocks - used_blocks < wmark_low) wakeup_kswapd();
+    return pfn * PMM_BLOCK_SIZE;
 }
 
-void pmm_free_block(uint32_t addr) {
-    uint32_t block = addr / PMM_BLOCK_SIZE;
-    
-    if (block < total_blocks && bitmap_test(block)) {
-        bitmap_unset(block);  // Corrected function name
-        used_blocks--;
+void pmm_free_order(uint32_t addr, uint32_t order) {
+    uint32_t pfn = addr / PMM_BLOCK_SIZE;
+
+    if (order >= PMM_MAX_ORDER || pfn + (1u << order) > total_blocks) return;
+    if (pfn & ((1u << order) - 1)) return; // Not a block of this order
+
+    if (order == 0) memprof_free(MEMPROF_PAGE, (void *)addr);
+
+    uint32_t eflags = irq_save();
+    if (buddy_find_free_head(pfn, 0) == 0xFFFFFFFF) { // Else double free
+        page_t *page = pfn_to_page(pfn);
+        if (page->flags & PG_LRU) lru_cache_del(addr);
+        page->refcount = 0;
+        page->flags &= ~(PG_MOVABLE | PG_KSM | PG_SLAB);
+        buddy_free(pfn, order);
+        used_blocks -= 1u << order;
+    }
+    irq_restore(eflags);
+}
+
+uint32_t pmm_alloc_zeroed(void) {
+    uint32_t eflags = irq_save();
+    if (!list_empty(&zero_pool)) {
+        page_t *page = list_first_entry(&zero_pool, page_t, list);
+        list_del(&page->list);
+        page->flags &= ~PG_ZEROED;
+        page->refcount = 1;
+        zero_stats.pooled--;
+        zero_stats.hits++;
+        irq_restore(eflags);
+
+        uint32_t addr = page_to_pfn(page) * PMM_BLOCK_SIZE;
+        memprof_alloc(MEMPROF_PAGE, (void *)addr, PMM_BLOCK_SIZE, __builtin_return_address(0));
+        return addr;
+    }
+    zero_stats.misses++;
+    irq_restore(eflags);
+
+    // Pool empty: pay for the clear here
+    uint32_t addr = pmm_alloc_order(0);
+    if (addr) pmm_clear_frame(addr);
+    memprof_alloc(MEMPROF_PAGE, (void *)addr, PMM_BLOCK_SIZE, __builtin_return_address(0));
+    return addr;
+}
+
+// Helper: Top the pool up by at most ZERO_POOL_BATCH frames.
+// Returns the number of frames added.
+static uint32_t pmm_refill_zero_pool(void) {
+    uint32_t added = 0;
+
+    while (added < ZERO_POOL_BATCH && zero_stats.pooled < ZERO_POOL_TARGET &&
+           total_blocks - used_blocks > wmark_high) {
+        uint32_t addr = pmm_alloc_order(0);
+        if (!addr) break;
+
+        // Clearing runs with interrupts on; the frame is ours already
+        pmm_clear_frame(addr);
+
+        uint32_t eflags = irq_save();
+        page_t *page = pfn_to_page(addr / PMM_BLOCK_SIZE);
+        page->refcount = 0;
+        page->flags |= PG_ZEROED;
+        list_add(&page->list, &zero_pool);
+        zero_stats.pooled++;
+        zero_stats.refilled++;
+        irq_restore(eflags);
+
+        added++;
+    }
+    return added;
+}
+
+// Zeroing thread: runs at the lowest priority, so it only gets a small
+// share of the CPU while other tasks are runnable
+static void pmm_zero_thread(void) {
+    process_set_priority(current_process->pid, 0);
+
+    while (1) {
+        pmm_refill_zero_pool();
+        process_yield();
     }
 }
 
+static uint32_t zero_pool_count(void) {
+    return zero_stats.pooled;
+}
+
+// Cleared frames are only a cache: the first thing to give back
+static uint32_t zero_pool_scan(uint32_t nr) {
+    uint32_t eflags = irq_save();
+    uint32_t drained = pmm_drain_zero_pool(nr);
+    irq_restore(eflags);
+    return drained;
+}
+
+static struct shrinker zero_pool_shrinker = {
+    .name = "zero-pool",
+    .count = zero_pool_count,
+    .scan = zero_pool_scan
+};
+
+void pmm_zero_pool_init(void) {
+    register_shrinker(&zero_pool_shrinker);
+    process_create(pmm_zero_thread);
+    pr_info("PMM: Zeroed page pool (%d frames) enabled\n", ZERO_POOL_TARGET);
+}
+
+uint32_t pmm_alloc_block(void) {
+    uint32_t addr = pmm_alloc_order(0);
+    memprof_alloc(MEMPROF_PAGE, (void *)addr, PMM_BLOCK_SIZE, __builtin_return_address(0));
+    return addr;
+}
+
+void pmm_free_block(uint32_t addr) {
+    pmm_free_order(addr, 0);
+}
+
 uint32_t pmm_alloc_blocks(uint32_t count) {
     if (count == 0) return 0;
-    if (count == 1) return pmm_alloc_block();
-    
-    uint32_t start_block = bitmap_find_free_contiguous(count);
-    
-    if (start_block == 0xFFFFFFFF) {
+    if (count == 1) return pmm_alloc_order(0);
+
+    uint32_t order = count_to_order(count);
+    if (order >= PMM_MAX_ORDER) {
         pr_err("PMM: Cannot allocate contiguous blocks!\n");
         return 0;
     }
-    
-    // Mark all blocks as used
-    for (uint32_t i = 0; i < count; i++) {
-        bitmap_set(start_block + i);
-        used_blocks++;
+
+    uint32_t addr = pmm_alloc_order(order);
+    if (!addr) {
+        // Free memory may just be scattered: move user pages out of the way
+        addr = pmm_compact(order);
+    }
+    if (!addr) {
+        compact_stats.highorder_fail++;
+        pr_err("PMM: Cannot allocate contiguous blocks!\n");
+        return 0;
+    }
+    compact_stats.highorder_success++;
+
+    // Give back the unused tail of the power-of-two block
+    uint32_t excess = (1u << order) - count;
+    if (excess) {
+        buddy_free_range(addr / PMM_BLOCK_SIZE + count, excess);
+        used_blocks -= excess;
     }
-    
-    return start_block * PMM_BLOCK_SIZE;
+
+    return addr;
 }
 
 void pmm_free_blocks(uint32_t addr, uint32_t count) {
-    for (uint32_t i = 0; i < count; i++) {
-        pmm_free_block(addr + (i * PMM_BLOCK_SIZE));
+    uint32_t pfn = addr / PMM_BLOCK_SIZE;
+
+    // Free runs of allocated frames as aligned blocks, skipping free ones
+    uint32_t run = 0;
+    for (uint32_t i = 0; i <= count; i++) {
+        uint32_t cur = pfn + i;
+        int allocated = (i < count && cur < total_blocks &&
+                         buddy_find_free_head(cur, 0) == 0xFFFFFFFF);
+        if (allocated) {
+            run++;
+        } else if (run) {
+            buddy_free_range(cur - run, run);
+            used_blocks -= run;
+            run = 0;
+        }
+    }
+}
+
+// Helper: Choose the aligned block of 2^order frames holding the fewest
+// allocated frames, all of them movable. Returns its pfn or 0xFFFFFFFF.
+static uint32_t compact_pick_block(uint32_t order) {
+    uint32_t size = 1u << order;
+    uint32_t best = 0xFFFFFFFF, best_used = size + 1;
+
+    // The low 4MB is never handed out
+    uint32_t pfn = (PMM_RESERVED_END / PMM_BLOCK_SIZE + size - 1) & ~(size - 1);
+    for (; pfn + size <= total_blocks; pfn += size) {
+        uint32_t used = 0;
+
+        for (uint32_t i = 0; i < size; ) {
+            uint32_t free_order;
+            uint32_t head = buddy_find_free_head(pfn + i, &free_order);
+            if (head != 0xFFFFFFFF) {
+                i = head + (1u << free_order) - pfn;  // Skip the free block
+                continue;
+            }
+
+            if (!(pfn_to_page(pfn + i)->flags & PG_MOVABLE)) {
+                used = size + 1;  // Pinned frame: unusable candidate
+                break;
+            }
+            used++;
+            i++;
+        }
+
+        if (used < best_used) {
+            best = pfn;
+            best_used = used;
+        }
+    }
+    return best;
+}
+
+// Helper: Give back every frame compaction claimed in a block
+static void compact_release(uint32_t pfn, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        page_t *page = pfn_to_page(pfn + i);
+        if (page->flags & PG_ISOLATED) {
+            page->flags &= ~PG_ISOLATED;
+            page->refcount = 0;
+            buddy_free(pfn + i, 0);
+            used_blocks--;
+        }
     }
 }
 
+uint32_t pmm_compact(uint32_t order) {
+    if (order == 0 || order >= PMM_MAX_ORDER) return 0;
+
+    // Page contents and the PTEs pointing at them must not change while
+    // a page moves, so the whole run keeps interrupts off
+    uint32_t eflags = irq_save();
+
+    // Pooled frames are cheapest to move: drop them first
+    pmm_drain_zero_pool(zero_stats.pooled);
+
+    uint32_t size = 1u << order;
+    uint32_t pfn = compact_pick_block(order);
+    if (pfn == 0xFFFFFFFF) {
+        compact_stats.compact_fail++;
+        irq_restore(eflags);
+        return 0;
+    }
+
+    // Claim the free frames first so migration targets land elsewhere
+    for (uint32_t i = 0; i < size; i++) {
+        if (buddy_take_frame(pfn + i)) {
+            used_blocks++;
+            pfn_to_page(pfn + i)->flags |= PG_ISOLATED;
+        }
+    }
+
+    for (uint32_t i = 0; i < size; i++) {
+        page_t *page = pfn_to_page(pfn + i);
+        if (page->flags & PG_ISOLATED) continue;
+
+        if (!mm_migrate_page((pfn + i) * PMM_BLOCK_SIZE)) {
+            compact_stats.migrate_failed++;
+            compact_stats.compact_fail++;
+            compact_release(pfn, size);
+            irq_restore(eflags);
+            return 0;
+        }
+
+        // Every mapping moved: the old frame is ours now
+        page->flags = (page->flags & ~PG_MOVABLE) | PG_ISOLATED;
+        page->refcount = 0;
+        compact_stats.pages_migrated++;
+    }
+
+    // Hand the block out as one allocation
+    for (uint32_t i = 0; i < size; i++) {
+        pfn_to_page(pfn + i)->flags &= ~PG_ISOLATED;
+    }
+    pfn_to_page(pfn)->refcount = 1;
+    compact_stats.compact_success++;
+
+    irq_restore(eflags);
+    return pfn * PMM_BLOCK_SIZE;
+}
+
+page_t *pmm_phys_to_page(uint32_t addr) {
+    uint32_t pfn = addr / PMM_BLOCK_SIZE;
+    if (pfn >= total_blocks) return 0;
+    return pfn_to_page(pfn);
+}
+
+uint32_t pmm_page_to_phys(page_t *page) {
+    return page_to_pfn(page) * PMM_BLOCK_SIZE;
+}
+
+void pmm_ref_block(uint32_t addr) {
+    uint32_t pfn = addr / PMM_BLOCK_SIZE;
+    if (pfn < total_blocks) {
+        pfn_to_page(pfn)->refcount++;
+    }
+}
+
+void pmm_unref_block(uint32_t addr) {
+    uint32_t pfn = addr / PMM_BLOCK_SIZE;
+    if (pfn >= total_blocks) return;
+
+    page_t *page = pfn_to_page(pfn);
+    if (page->refcount > 1) {
+        page->refcount--;
+    } else {
+        pmm_free_block(pfn * PMM_BLOCK_SIZE);
+    }
+}
+
+uint32_t pmm_block_refcount(uint32_t addr) {
+    uint32_t pfn = addr / PMM_BLOCK_SIZE;
+    if (pfn >= total_blocks) return 0;
+    return pfn_to_page(pfn)->refcount;
+}
+
 void pmm_reserve_region(uint32_t start, uint32_t size) {
     uint32_t start_block = start / PMM_BLOCK_SIZE;
     uint32_t block_count = (size + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
-    
+
     for (uint32_t i = 0; i < block_count; i++) {
         uint32_t block = start_block + i;
-        if (block < total_blocks && !bitmap_test(block)) {
-            bitmap_set(block);
+        if (block < total_blocks && buddy_take_frame(block)) {
             used_blocks++;
         }
     }
@@ -161,3 +669,33 @@ uint32_t pmm_get_free_memory(void) {
 uint32_t pmm_get_total_memory(void) {
     return total_blocks * PMM_BLOCK_SIZE;
 }
+
+int pmm_set_watermarks(uint32_t low, uint32_t high) {
+    if (low == 0 || low >= high || high >= total_blocks) return -1;
+
+    uint32_t eflags = irq_save();
+    wmark_low = low;
+    wmark_high = high;
+    irq_restore(eflags);
+    return 0;
+}
+
+void pmm_get_watermarks(uint32_t *low, uint32_t *high) {
+    if (low) *low = wmark_low;
+    if (high) *high = wmark_high;
+}
+
+void pmm_get_order_stats(uint32_t *free_blocks) {
+    if (!free_blocks) return;
+    for (int i = 0; i < PMM_MAX_ORDER; i++) {
+        free_blocks[i] = free_area[i].nr_free;
+    }
+}
+
+void pmm_get_zero_stats(pmm_zero_stats_t *stats) {
+    if (stats) *stats = zero_stats;
+}
+
+void pmm_get_compact_stats(pmm_compact_stats_t *stats) {
+    if (stats) *stats = compact_stats;
+}
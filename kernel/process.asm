@@ -44,3 +44,16 @@ _enter_user_mode:
     
     ; IRET will load CS, EIP, EFLAGS, SS, ESP from stack
     iretd
+
+; First code run by a forked child (via switch_to_task's RET)
+; Stack holds a copy of the parent's int 0x80 frame: [PUSHA regs] [EIP] [CS] [EFLAGS] [ESP] [SS]
+global _fork_return
+_fork_return:
+    mov ax, 0x23        ; User Data Selector
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    
+    popa                ; Restore user registers (EAX = 0)
+    iretd               ; Back to user mode after the fork call
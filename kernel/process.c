@@ -6,40 +6,250 @@
 #include "tss.h"
 #include "vmm.h"
 #include "pmm.h"
+#include "swap.h"
 #include "string.h"
+#include "idt.h"
+#include "mm.h"
+#include "timer.h"
 
 process_t *current_process = NULL;
-LIST_HEAD(ready_queue);  // Linux-style list head for ready queue
+LIST_HEAD(task_list);    // Every task, in creation order
 uint32_t next_pid = 1;
 
+// Fair run queue (see process.h)
+static struct rb_root fair_tree = RB_ROOT;
+static struct rb_node *fair_leftmost = NULL;    // Least virtual runtime
+static uint32_t nr_queued = 0;
+static uint32_t queued_weight = 0;              // Sum of queued weights
+static uint64_t min_vruntime = 0;               // Never goes back
+
+static volatile int need_resched = 0;           // Set by wakeup preemption
+static int yield_pending = 0;
+
+static struct list_head pid_hash[PID_HASH_SIZE];
+static uint32_t nr_tasks = 0;
+
+// A task that killed itself: freed once another task runs
+static process_t *dead_task = NULL;
+static int in_schedule = 0;
+
 // Slab cache for process structures
 static kmem_cache_t *process_cache = NULL;
 
+// Context switch / address space switch counters
+static sched_stats_t sched_stats;
+
 // Scheduler configuration
-#define DEFAULT_TIME_SLICE 10
 #define DEFAULT_PRIORITY 128
 
-// Calculate time slice based on priority
-static uint32_t calculate_time_slice(uint8_t priority) {
-    // Priority 0-127: 5-10 ticks
-    // Priority 128-255: 10-20 ticks
-    return DEFAULT_TIME_SLICE + (priority / 64);
+// Load weight of nice -20..19: each level is ~10% more or less CPU
+static const uint32_t nice_to_weight[40] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+     9548,  7620,  6100,  4904,  3906,
+     3121,  2501,  1991,  1586,  1277,
+     1024,   820,   655,   526,   423,
+      335,   272,   215,   172,   137,
+      110,    87,    70,    56,    45,
+       36,    29,    23,    18,    15,
+};
+
+// Map priority 0-255 onto nice 19..-19 (DEFAULT_PRIORITY is nice 0)
+static uint32_t priority_to_weight(uint8_t priority) {
+    int nice = ((int)DEFAULT_PRIORITY - (int)priority) * 20 / 128;
+    if (nice > 19) nice = 19;
+    return nice_to_weight[nice + 20];
 }
 
 extern void switch_to_task(process_t *next);
 
+static inline int vruntime_before(uint64_t a, uint64_t b) {
+    return (int64_t)(a - b) < 0;
+}
+
+// Helper: Running time delta scaled to virtual time for a task's weight
+static uint64_t calc_delta_fair(uint32_t delta, process_t *proc) {
+    if (proc->weight == NICE_0_WEIGHT) return delta;
+    if (delta > (0xFFFFFFFFu / NICE_0_WEIGHT)) delta = 0xFFFFFFFFu / NICE_0_WEIGHT;
+    return delta * NICE_0_WEIGHT / proc->weight;
+}
+
+static inline int task_runnable(process_t *proc) {
+    return proc->state == PROCESS_READY || proc->state == PROCESS_RUNNING;
+}
+
+// Helper: Queue a READY task by virtual runtime (equal keys go right, FIFO)
+static void enqueue_task(process_t *proc) {
+    struct rb_node **link = &fair_tree.rb_node, *parent = NULL;
+    int leftmost = 1;
+
+    while (*link) {
+        parent = *link;
+        process_t *entry = rb_entry(parent, process_t, run_node);
+        if (vruntime_before(proc->vruntime, entry->vruntime)) {
+            link = &parent->rb_left;
+        } else {
+            link = &parent->rb_right;
+            leftmost = 0;
+        }
+    }
+
+    rb_link_node(&proc->run_node, parent, link);
+    rb_insert_color(&proc->run_node, &fair_tree);
+    if (leftmost) fair_leftmost = &proc->run_node;
+
+    nr_queued++;
+    queued_weight += proc->weight;
+    proc->on_rq = 1;
+}
+
+static void dequeue_task(process_t *proc) {
+    if (!proc->on_rq) return;
+
+    if (fair_leftmost == &proc->run_node) fair_leftmost = rb_next(&proc->run_node);
+    rb_erase(&proc->run_node, &fair_tree);
+    nr_queued--;
+    queued_weight -= proc->weight;
+    proc->on_rq = 0;
+}
+
+// Helper: Advance min_vruntime to the least runtime of the running
+// task and the queue (it only moves forward)
+static void update_min_vruntime(void) {
+    process_t *curr = current_process;
+    uint64_t vruntime = min_vruntime;
+    int found = 0;
+
+    if (curr && task_runnable(curr)) {
+        vruntime = curr->vruntime;
+        found = 1;
+    }
+    if (fair_leftmost) {
+        process_t *left = rb_entry(fair_leftmost, process_t, run_node);
+        if (!found || vruntime_before(left->vruntime, vruntime)) vruntime = left->vruntime;
+        found = 1;
+    }
+    if (found && vruntime_before(min_vruntime, vruntime)) min_vruntime = vruntime;
+}
+
+// Helper: Charge the running task for the time since it was last charged
+static void update_curr(uint64_t now) {
+    process_t *curr = current_process;
+    if (!curr || !vruntime_before(curr->exec_start, now)) return;
+
+    uint64_t delta = now - curr->exec_start;
+    curr->exec_start = now;
+    curr->sum_exec_runtime += delta;
+    curr->vruntime += calc_delta_fair(delta > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)delta, curr);
+    update_min_vruntime();
+}
+
+// Helper: Wall-clock slice of a task: its weight's share of the period
+static uint32_t sched_slice(process_t *proc) {
+    uint32_t nr = nr_queued + (proc->on_rq ? 0 : 1);
+    uint32_t total = queued_weight + (proc->on_rq ? 0 : proc->weight);
+    uint32_t period = SCHED_LATENCY_US;
+    if (nr > SCHED_NR_LATENCY) period = nr * SCHED_MIN_GRANULARITY_US;
+
+    // Share in 1/1024ths (period / 16 keeps the product in 32 bits)
+    uint32_t share = (proc->weight << 10) / total;
+    return (period / 16) * share / 64;
+}
+
+// Helper: Starting virtual runtime of a new or woken task
+static void place_task(process_t *proc, int initial) {
+    uint64_t vruntime = min_vruntime;
+
+    if (initial) {
+        // New tasks start one slice back, so forking cannot jump the queue
+        vruntime += calc_delta_fair(sched_slice(proc), proc);
+    } else {
+        // Sleepers get at most half a period of credit
+        vruntime -= SCHED_LATENCY_US / 2;
+    }
+
+    // Never gain runtime by sleeping
+    if (vruntime_before(proc->vruntime, vruntime)) proc->vruntime = vruntime;
+}
+
+// Helper: Should the running task give way at this tick?
+static int check_preempt_tick(process_t *curr) {
+    uint32_t ideal = sched_slice(curr);
+    uint64_t ran = curr->sum_exec_runtime - curr->prev_sum_exec_runtime;
+
+    if (ran > ideal) return 1;
+    if (ran < SCHED_MIN_GRANULARITY_US || !fair_leftmost) return 0;
+
+    // Far ahead of the queue even before the slice ends
+    process_t *left = rb_entry(fair_leftmost, process_t, run_node);
+    return (int64_t)(curr->vruntime - left->vruntime) > (int64_t)ideal;
+}
+
+// Helper: Preempt the running task for a woken one that is well ahead
+static void check_preempt_wakeup(process_t *proc) {
+    process_t *curr = current_process;
+    if (!curr || curr == proc || !task_runnable(curr)) return;
+
+    update_curr(timer_get_uptime_us());
+    uint64_t gran = calc_delta_fair(SCHED_WAKEUP_GRANULARITY_US, proc);
+    if ((int64_t)(curr->vruntime - proc->vruntime) > (int64_t)gran) {
+        need_resched = 1;
+        sched_stats.wakeup_preemptions++;
+    }
+}
+
+// Helper: Take the task with the least virtual runtime (NULL if none)
+static process_t *pick_next_task(void) {
+    if (!fair_leftmost) return NULL;
+
+    process_t *next = rb_entry(fair_leftmost, process_t, run_node);
+    dequeue_task(next);
+    return next;
+}
+
+// Helper: Make a new task known and runnable
+static void process_add(process_t *proc) {
+    list_add_tail(&proc->tasks, &task_list);
+    list_add(&proc->pid_chain, &pid_hash[proc->pid % PID_HASH_SIZE]);
+    nr_tasks++;
+
+    proc->state = PROCESS_READY;
+    proc->weight = priority_to_weight(proc->priority);
+    proc->on_rq = 0;
+    place_task(proc, 1);
+    enqueue_task(proc);
+}
+
+// Helper: Free a task's kernel stack and descriptor (address space gone)
+static void process_release(process_t *proc) {
+    kfree((void*)(proc->kernel_stack_top - 4096));
+    kmem_cache_free(process_cache, proc);
+}
+
+// Helper: Free a task that killed itself, once it is off the CPU
+static void reap_dead_task(void) {
+    if (dead_task && dead_task != current_process) {
+        process_release(dead_task);
+        dead_task = NULL;
+    }
+}
+
 void process_init(void) {
     pr_info("Initializing Multitasking...\n");
     
+    for (int i = 0; i < PID_HASH_SIZE; i++) {
+        INIT_LIST_HEAD(&pid_hash[i]);
+    }
+    
     // Create slab cache for process structures
-    process_cache = kmem_cache_create("process_cache", sizeof(process_t), 0, 0);
+    process_cache = kmem_cache_create("process_cache", sizeof(process_t), 0, SLAB_HWCACHE_ALIGN);
     if (!process_cache) {
         pr_err("Failed to create process cache!\n");
         return;
     }
     
     // Allocate kernel process from cache
-    process_t *kernel_proc = (process_t*)kmem_cache_alloc(process_cache);
+    process_t *kernel_proc = (process_t*)kmem_cache_alloc(process_cache, __GFP_ZERO);
     kernel_proc->pid = 0;
     kernel_proc->esp = 0;
     kernel_proc->cr3 = vmm_get_kernel_directory();
@@ -47,11 +257,12 @@ void process_init(void) {
     uint32_t current_esp;
     __asm__ volatile("mov %%esp, %0" : "=r"(current_esp));
     kernel_proc->kernel_stack_top = current_esp;
+    kernel_proc->exec_start = timer_get_uptime_us();
     
     // Initialize new fields
     kernel_proc->state = PROCESS_RUNNING;
-    kernel_proc->priority = 128;
-    kernel_proc->time_slice = 0;
+    kernel_proc->priority = DEFAULT_PRIORITY;
+    kernel_proc->weight = priority_to_weight(kernel_proc->priority);
     kernel_proc->total_runtime = 0;
     strcpy(kernel_proc->name, "kernel");
     
@@ -61,23 +272,25 @@ void process_init(void) {
         kernel_proc->signal_handlers[i] = (sighandler_t)0;  // SIG_DFL
     }
     
-    // Initialize list node and add to ready queue
-    INIT_LIST_HEAD(&kernel_proc->list);
-    list_add_tail(&kernel_proc->list, &ready_queue);
+    // Kernel threads have no user address space
+    kernel_proc->mm = NULL;
+    
+    // Running, so known but not queued
+    list_add_tail(&kernel_proc->tasks, &task_list);
+    list_add(&kernel_proc->pid_chain, &pid_hash[0]);
+    nr_tasks++;
     
     current_process = kernel_proc;
 }
 
 void process_create(void (*entry_point)(void)) {
     // Allocate process from slab cache
-    process_t *proc = (process_t*)kmem_cache_alloc(process_cache);
+    process_t *proc = (process_t*)kmem_cache_alloc(process_cache, __GFP_ZERO);
     proc->pid = next_pid++;
     proc->cr3 = vmm_get_kernel_directory();
     
     // Initialize new fields
-    proc->state = PROCESS_READY;
     proc->priority = 100;
-    proc->time_slice = calculate_time_slice(proc->priority);
     proc->total_runtime = 0;
     strcpy(proc->name, "kernel_task");
     
@@ -87,12 +300,16 @@ void process_create(void (*entry_point)(void)) {
         proc->signal_handlers[i] = (sighandler_t)0;  // SIG_DFL
     }
     
+    proc->mm = NULL;
+    
     uint32_t *stack = (uint32_t*)kmalloc(4096);
     uint32_t *top = stack + 1024;
     
     proc->kernel_stack_top = (uint32_t)top;
     
+    // Frame for switch_to_task: POPA, POPF, then RET into the entry point
     *(--top) = (uint32_t)entry_point;
+    *(--top) = 0x202; // EFLAGS (interrupts on)
     *(--top) = 0; // EAX
     *(--top) = 0; // ECX
     *(--top) = 0; // EDX
@@ -101,184 +318,228 @@ void process_create(void (*entry_point)(void)) {
     *(--top) = 0; // EBP
     *(--top) = 0; // ESI
     *(--top) = 0; // EDI
-    *(--top) = 0x202; // EFLAGS
     
     proc->esp = (uint32_t)top;
     
-    // Add to ready queue using Linux-style list
-    INIT_LIST_HEAD(&proc->list);
-    list_add_tail(&proc->list, &ready_queue);
+    uint32_t eflags = irq_save();
+    process_add(proc);
+    irq_restore(eflags);
 }
 
 extern void enter_user_mode(void);
 
 void process_create_user(void (*entry_point)(void)) {
-    // 1. Allocate PCB from slab cache
-    process_t *proc = (process_t*)kmem_cache_alloc(process_cache);
-    proc->pid = next_pid++;
-    proc->cr3 = vmm_get_kernel_directory();
+    // 1. Allocate PCB, kernel stack and a private address space
+    process_t *proc = process_alloc_user("user_task");
+    if (!proc) {
+        pr_err("Failed to create user process\n");
+        return;
+    }
+
+    // 2. Code & Stack regions
+    // Code: 0x400000
+    // Stack: 0x401000 (grows down from 0x402000)
+    uint32_t phys_code = pmm_alloc_block();
+    if (!phys_code ||
+        !mm_add_area(proc->mm, 0x400000, 0x401000, VM_READ | VM_WRITE | VM_EXEC, NULL, 0, 0, 0) ||
+        !mm_add_area(proc->mm, 0x401000, 0x402000, VM_READ | VM_WRITE | VM_GROWSDOWN, NULL, 0, 0, 0)) {
+        if (phys_code) pmm_free_block(phys_code);
+        process_free_user(proc);
+        pr_err("Failed to create user process\n");
+        return;
+    }
 
-    // 2. Allocate Kernel Stack (4KB)
+    // 3. Copy Code into its frame and map it in the process directory only
+    // entry_point is the source buffer address here
+    memcpy(phys_to_virt(phys_code), (void*)entry_point, 4096);
+    vmm_map_page_dir(proc->cr3, phys_code, 0x400000, PTE_PRESENT | PTE_RW | PTE_USER);
+    lru_cache_add(phys_code, 0x400000);
+
+    // 4. Enter user mode at the start of the code; the stack page is
+    // populated on first use
+    process_start_user(proc, 0x400000, 0x402000);
+}
+
+process_t *process_alloc_user(const char *name) {
+    process_t *proc = (process_t*)kmem_cache_alloc(process_cache, __GFP_ZERO);
+    if (!proc) return NULL;
+    
+    // Empty address space sharing the kernel mappings
+    proc->mm = mm_create();
+    if (!proc->mm) {
+        kmem_cache_free(process_cache, proc);
+        return NULL;
+    }
+    proc->cr3 = proc->mm->pgd;
+    
     uint32_t *kstack = (uint32_t*)kmalloc(4096);
-    uint32_t *ktop = kstack + 1024;
+    if (!kstack) {
+        mm_put(proc->mm);
+        kmem_cache_free(process_cache, proc);
+        return NULL;
+    }
+    proc->kernel_stack_top = (uint32_t)(kstack + 1024);
+    proc->esp = 0;
+    proc->pid = next_pid++;
     
-    proc->kernel_stack_top = (uint32_t)ktop; // Save Top for TSS
-
-    // 3. Allocate User Pages (Code & Stack)
-    uint32_t phys_code = pmm_alloc_block();
-    uint32_t phys_stack = pmm_alloc_block();
+    proc->state = PROCESS_BLOCKED;      // Not runnable until started
+    proc->priority = DEFAULT_PRIORITY;
+    proc->total_runtime = 0;
+    strncpy(proc->name, name, sizeof(proc->name) - 1);
+    proc->name[sizeof(proc->name) - 1] = '\0';
     
-    // Map them at User Virtual Addresses with USER permissions
-    // Code: 0x400000
-    // Stack: 0x401000
-    // Flags: 0x07 (Present | RW | User)
-    vmm_map_page(phys_code, 0x400000, 0x07);
-    vmm_map_page(phys_stack, 0x401000, 0x07);
+    proc->pending_signals = 0;
+    for (int i = 0; i < 32; i++) {
+        proc->signal_handlers[i] = (sighandler_t)0;  // SIG_DFL
+    }
     
-    // Copy Code to 0x400000
-    // entry_point is the source buffer address here
-    memcpy((void*)0x400000, (void*)entry_point, 4096);
+    return proc;
+}
 
-    // 4. Setup Trap Frame for IRET (User Mode Switch)
-    // Stack: [SS] [ESP] [EFLAGS] [CS] [EIP]
-    // Stack grows down from 0x402000 (0x401000 + 4096)
-    uint32_t user_esp = 0x402000;
+void process_free_user(process_t *proc) {
+    if (!proc) return;
+    
+    mm_put(proc->mm);
+    kfree((void*)(proc->kernel_stack_top - 4096));
+    kmem_cache_free(process_cache, proc);
+}
 
+void process_start_user(process_t *proc, uint32_t entry, uint32_t user_esp) {
+    uint32_t *ktop = (uint32_t*)proc->kernel_stack_top;
+    
+    // Trap frame for IRET into ring 3
     *(--ktop) = 0x23;                   // User SS (Ring 3 Data)
     *(--ktop) = user_esp;               // User ESP
     *(--ktop) = 0x202;                  // User EFLAGS (IE=1)
     *(--ktop) = 0x1B;                   // User CS (Ring 3 Code)
-    *(--ktop) = 0x400000;               // User EIP (Start of Code)
-
-    // 5. Setup Stack Frame for switch_to_task
-    // RET will jump to enter_user_mode (which does IRET)
-    *(--ktop) = (uint32_t)enter_user_mode;
-
-    // PUSHA/POPA Registers
-    *(--ktop) = 0; // EAX
-    *(--ktop) = 0; // ECX
-    *(--ktop) = 0; // EDX
-    *(--ktop) = 0; // EBX
-    *(--ktop) = 0; // ESP
-    *(--ktop) = 0; // EBP
-    *(--ktop) = 0; // ESI
-    *(--ktop) = 0; // EDI
+    *(--ktop) = entry;                  // User EIP
     
-    *(--ktop) = 0x202;                  // Kernel EFLAGS
-
+    // Frame for switch_to_task: POPA, POPF, then RET into enter_user_mode
+    *(--ktop) = (uint32_t)enter_user_mode;
+    *(--ktop) = 0x002;                  // Kernel EFLAGS (IF restored by IRET)
+    for (int i = 0; i < 8; i++) {
+        *(--ktop) = 0;                  // PUSHA registers
+    }
     proc->esp = (uint32_t)ktop;
-
-    // 6. Add to Queue using Linux-style list
-    INIT_LIST_HEAD(&proc->list);
-    list_add_tail(&proc->list, &ready_queue);
+    
+    uint32_t eflags = irq_save();
+    process_add(proc);
+    irq_restore(eflags);
 }
 
 void schedule(void) {
     if (!current_process) return;
     
-    // Decrement time slice for current process
-    if (current_process->time_slice > 0) {
-        current_process->time_slice--;
-        current_process->total_runtime++;
+    uint32_t eflags = irq_save();
+    reap_dead_task();
+    
+    process_t *prev = current_process;
+    need_resched = 0;
+    
+    // Deliver pending signals before switching (may block or kill prev)
+    in_schedule = 1;
+    do_signal();
+    
+    // Charge prev up to now
+    uint64_t now = timer_get_uptime_us();
+    update_curr(now);
+    
+    // A runnable prev goes back in the tree and keeps the CPU if it is
+    // still leftmost; a yielding one only after every other task
+    process_t *next;
+    if (!task_runnable(prev)) {
+        next = pick_next_task();
+    } else if (yield_pending) {
+        next = pick_next_task();
+        prev->state = PROCESS_READY;
+        if (next) enqueue_task(prev);
+        else next = prev;
+    } else {
+        prev->state = PROCESS_READY;
+        enqueue_task(prev);
+        next = pick_next_task();
     }
+    yield_pending = 0;
+    in_schedule = 0;
     
-    // If time slice expired or process is blocked, find next READY process
-    if (current_process->time_slice == 0 || current_process->state == PROCESS_BLOCKED) {
-        // Reset time slice for current process
-        if (current_process->state == PROCESS_READY || current_process->state == PROCESS_RUNNING) {
-            current_process->time_slice = calculate_time_slice(current_process->priority);
-            current_process->state = PROCESS_READY;
-        }
-        
-        // Find next READY process using proper round-robin
-        process_t *next = NULL;
-        process_t *pos;
-        int found = 0;
-        
-        // Start from the NEXT process in the list (proper round-robin)
-        pos = list_entry(current_process->list.next, process_t, list);
-        
-        // Search from current->next to end of list
-        while (&pos->list != &ready_queue) {
-            if (pos != current_process && 
-                (pos->state == PROCESS_READY || pos->state == PROCESS_RUNNING)) {
-                next = pos;
-                found = 1;
-                break;
-            }
-            pos = list_entry(pos->list.next, process_t, list);
-        }
-        
-        // If not found, wrap around and search from beginning to current
-        if (!found) {
-            list_for_each_entry(pos, &ready_queue, list) {
-                if (pos == current_process) break;
-                if (pos->state == PROCESS_READY || pos->state == PROCESS_RUNNING) {
-                    next = pos;
-                    found = 1;
-                    break;
-                }
-            }
-        }
-        
-        // If no other ready process found, keep running current
-        if (!found || next == NULL) {
-            current_process->state = PROCESS_RUNNING;
-            return;
-        }
-        
-        // Don't switch if we're switching to ourselves
-        if (next == current_process) {
-            current_process->state = PROCESS_RUNNING;
-            return;
-        }
-        
-        // Update states
-        if (current_process->state == PROCESS_RUNNING) {
-            current_process->state = PROCESS_READY;
-        }
-        next->state = PROCESS_RUNNING;
-        next->time_slice = calculate_time_slice(next->priority);
-        
-        // Update TSS
-        set_kernel_stack(next->kernel_stack_top);
-        
-        // Switch Page Directory
-        if (next->cr3) {
-            vmm_switch_directory(next->cr3);
-        }
-        
-        // Deliver pending signals before switching
-        do_signal();
-        
-        // Context switch
-        switch_to_task(next);
+    // Nothing else is ready: keep running current
+    if (!next) next = prev;
+    
+    next->state = PROCESS_RUNNING;
+    next->exec_start = now;
+    next->prev_sum_exec_runtime = next->sum_exec_runtime;  // New slice
+    
+    if (next == prev) {
+        irq_restore(eflags);
+        return;
+    }
+    
+    // Update TSS
+    set_kernel_stack(next->kernel_stack_top);
+    
+    // Switch Page Directory. Every CR3 load flushes the non-global
+    // TLB entries, so only do it when the address space changes.
+    // Kernel threads only touch the shared kernel half and keep
+    // running on whichever directory is loaded (lazy TLB).
+    sched_stats.context_switches++;
+    if (!next->mm) {
+        sched_stats.lazy_switches++;
+    } else if (next->cr3 != vmm_get_current_directory()) {
+        vmm_switch_directory(next->cr3);
+        sched_stats.cr3_reloads++;
     } else {
-        // Still have time slice, just update runtime
-        current_process->state = PROCESS_RUNNING;
+        sched_stats.cr3_skips++;
     }
+    
+    // Context switch; prev continues here when it is picked again
+    switch_to_task(next);
+    
+    reap_dead_task();
+    irq_restore(eflags);
 }
 
 void process_yield(void) {
     if (current_process) {
-        current_process->time_slice = 0; // Force reschedule
+        yield_pending = 1; // Let every other ready task go first
     }
     schedule();
 }
 
+void scheduler_tick(void) {
+    process_t *curr = current_process;
+    if (!curr) return;
+    
+    uint32_t eflags = irq_save();
+    curr->total_runtime++;
+    update_curr(timer_get_uptime_us());
+    if (task_runnable(curr) && check_preempt_tick(curr)) {
+        need_resched = 1;
+        if (fair_leftmost) sched_stats.tick_preemptions++;
+    }
+    irq_restore(eflags);
+    
+    schedule_if_needed();
+}
+
+void schedule_if_needed(void) {
+    if (need_resched) {
+        schedule();
+    }
+}
+
+static const char *process_state_name(process_state_t state) {
+    return (state == PROCESS_RUNNING) ? "RUNNING" :
+           (state == PROCESS_READY)   ? "READY" :
+           (state == PROCESS_BLOCKED) ? "BLOCKED" : "UNKNOWN";
+}
+
 void process_debug_list(void) {
     pr_info("PID  | State\n");
     pr_info("---- | -----\n");
     
-    if (list_empty(&ready_queue)) return;
-    
     process_t *proc;
-    list_for_each_entry(proc, &ready_queue, list) {
-        pr_info("%d    | %s", proc->pid, 
-            (proc->state == PROCESS_RUNNING) ? "RUNNING" :
-            (proc->state == PROCESS_READY)   ? "READY" :
-            (proc->state == PROCESS_BLOCKED) ? "BLOCKED" : "UNKNOWN");
-            
+    list_for_each_entry(proc, &task_list, tasks) {
+        pr_info("%d    | %s", proc->pid, process_state_name(proc->state));
         if (proc == current_process) pr_info(" (*)");
         pr_info("\n");
     }
@@ -286,7 +547,7 @@ void process_debug_list(void) {
 
 process_t *process_find_by_pid(uint32_t pid) {
     process_t *proc;
-    list_for_each_entry(proc, &ready_queue, list) {
+    list_for_each_entry(proc, &pid_hash[pid % PID_HASH_SIZE], pid_chain) {
         if (proc->pid == pid) {
             return proc;
         }
@@ -296,29 +557,47 @@ process_t *process_find_by_pid(uint32_t pid) {
 
 int process_kill(uint32_t pid) {
     if (pid == 0) return 0; // Cannot kill kernel
-    if (list_empty(&ready_queue)) return 0;
     
-    process_t *proc, *tmp;
-    list_for_each_entry_safe(proc, tmp, &ready_queue, list) {
-        if (proc->pid == pid) {
-            // Remove from list
-            list_del(&proc->list);
-            
-            // Free process back to slab cache
-            // NOTE: Memory leak here for stack/page directory.
-            // Fixing memory leaks is a separate task.
-            kmem_cache_free(process_cache, proc);
-            
-            // If we killed the running process, we MUST schedule immediately
-            if (proc == current_process) {
-                schedule();
-                // We never return here if we switched away
-            }
-            return 1;
+    uint32_t eflags = irq_save();
+    process_t *proc = process_find_by_pid(pid);
+    if (!proc) {
+        irq_restore(eflags);
+        return 0;
+    }
+    
+    // Off the run queue and out of the task list and PID hash
+    dequeue_task(proc);
+    list_del(&proc->tasks);
+    list_del(&proc->pid_chain);
+    nr_tasks--;
+    proc->state = PROCESS_TERMINATED;
+    
+    // Tear down the address space. Step off it first if it is
+    // loaded (by the process itself or by a lazy kernel thread).
+    if (proc->mm) {
+        if (vmm_get_current_directory() == proc->cr3) {
+            vmm_switch_directory(vmm_get_kernel_directory());
+            sched_stats.cr3_reloads++;
         }
+        mm_put(proc->mm);
+        proc->mm = NULL;
     }
     
-    return 0;
+    if (proc != current_process) {
+        process_release(proc);
+        irq_restore(eflags);
+        return 1;
+    }
+    
+    // Still running on its kernel stack: freed after the switch. From
+    // inside schedule() (a fatal signal) the switch is already coming.
+    dead_task = proc;
+    if (!in_schedule) {
+        schedule();
+        // We never return here if we switched away
+    }
+    irq_restore(eflags);
+    return 1;
 }
 
 // ============================================================================
@@ -326,69 +605,82 @@ int process_kill(uint32_t pid) {
 // ============================================================================
 
 void process_set_priority(uint32_t pid, uint8_t priority) {
-    if (list_empty(&ready_queue)) return;
-    
-    process_t *proc;
-    list_for_each_entry(proc, &ready_queue, list) {
-        if (proc->pid == pid) {
-            proc->priority = priority;
-            proc->time_slice = calculate_time_slice(priority);
-            return;
-        }
+    uint32_t eflags = irq_save();
+    process_t *proc = process_find_by_pid(pid);
+    if (proc) {
+        // Virtual runtime so far stays; only the rate changes
+        uint32_t weight = priority_to_weight(priority);
+        if (proc->on_rq) queued_weight += weight - proc->weight;
+        proc->priority = priority;
+        proc->weight = weight;
     }
+    irq_restore(eflags);
 }
 
 void process_block(uint32_t pid) {
-    if (list_empty(&ready_queue)) return;
-    
-    process_t *proc;
-    list_for_each_entry(proc, &ready_queue, list) {
-        if (proc->pid == pid) {
-            proc->state = PROCESS_BLOCKED;
-            // If blocking current process, force reschedule
-            if (proc == current_process) {
-                schedule();
-            }
-            return;
+    uint32_t eflags = irq_save();
+    process_t *proc = process_find_by_pid(pid);
+    if (proc && proc->state != PROCESS_BLOCKED) {
+        dequeue_task(proc);
+        proc->state = PROCESS_BLOCKED;
+        // If blocking current process, force reschedule
+        if (proc == current_process) {
+            schedule();
         }
     }
+    irq_restore(eflags);
 }
 
 void process_unblock(uint32_t pid) {
-    if (list_empty(&ready_queue)) return;
-    
-    process_t *proc;
-    list_for_each_entry(proc, &ready_queue, list) {
-        if (proc->pid == pid && proc->state == PROCESS_BLOCKED) {
-            proc->state = PROCESS_READY;
-            return;
+    uint32_t eflags = irq_save();
+    process_t *proc = process_find_by_pid(pid);
+    if (proc && proc->state == PROCESS_BLOCKED) {
+        proc->state = PROCESS_READY;
+        if (proc != current_process) {
+            place_task(proc, 0);
+            enqueue_task(proc);
+            check_preempt_wakeup(proc);
         }
     }
+    irq_restore(eflags);
 }
 
 void process_get_stats(uint32_t pid, uint32_t *runtime, uint8_t *priority, process_state_t *state) {
-    if (list_empty(&ready_queue)) return;
-    
-    process_t *proc;
-    list_for_each_entry(proc, &ready_queue, list) {
-        if (proc->pid == pid) {
-            if (runtime) *runtime = proc->total_runtime;
-            if (priority) *priority = proc->priority;
-            if (state) *state = proc->state;
-            return;
-        }
+    process_t *proc = process_find_by_pid(pid);
+    if (proc) {
+        if (runtime) *runtime = proc->total_runtime;
+        if (priority) *priority = proc->priority;
+        if (state) *state = proc->state;
     }
 }
 
+void process_get_sched_stats(sched_stats_t *stats) {
+    if (!stats) return;
+    *stats = sched_stats;
+    stats->nr_running = nr_queued + (current_process && task_runnable(current_process) ? 1 : 0);
+    stats->nr_tasks = nr_tasks;
+}
+
+extern void fork_return(void);
+
 // Fork implementation - clone current process
+// Must be entered from the int 0x80 path of a user process: the child
+// resumes from a copy of the parent's user trap frame with EAX = 0.
 int process_fork(void) {
     if (!current_process) {
         pr_err("fork: No current process\n");
         return -1;
     }
     
+    // The user trap frame sits at the top of the parent's kernel stack
+    registers_t *parent_regs = (registers_t *)(current_process->kernel_stack_top - sizeof(registers_t));
+    if ((parent_regs->cs & 0x3) != 3) {
+        pr_err("fork: Not called from user mode\n");
+        return -1;
+    }
+    
     // Allocate new process structure
-    process_t *child = (process_t *)kmem_cache_alloc(process_cache);
+    process_t *child = (process_t *)kmem_cache_alloc(process_cache, GFP_KERNEL);
     if (!child) {
         pr_err("fork: Failed to allocate process\n");
         return -1;
@@ -397,38 +689,54 @@ int process_fork(void) {
     // Copy parent process data
     memcpy(child, current_process, sizeof(process_t));
     
-    // Assign new PID
-    child->pid = next_pid++;
-    
-    // Clone page directory
-    child->cr3 = vmm_clone_directory();
-    if (child->cr3 == 0) {
+    // Copy the address space (copy-on-write: costs page tables, not pages)
+    child->mm = current_process->mm ? mm_dup(current_process->mm) : NULL;
+    if (!child->mm) {
         kmem_cache_free(process_cache, child);
-        pr_err("fork: Failed to clone page directory\n");
+        pr_err("fork: Failed to copy address space\n");
         return -1;
     }
+    child->cr3 = child->mm->pgd;
     
     // Allocate new kernel stack
-    child->kernel_stack_top = (uint32_t)kmalloc(4096) + 4096;
+    uint32_t *kstack = (uint32_t *)kmalloc(4096);
+    if (!kstack) {
+        mm_put(child->mm);
+        kmem_cache_free(process_cache, child);
+        pr_err("fork: Failed to allocate kernel stack\n");
+        return -1;
+    }
+    uint32_t *ktop = kstack + 1024;
+    child->kernel_stack_top = (uint32_t)ktop;
+    
+    // Only the trap frame is copied, not the whole kernel stack
+    ktop -= sizeof(registers_t) / sizeof(uint32_t);
+    memcpy(ktop, parent_regs, sizeof(registers_t));
+    ((registers_t *)ktop)->eax = 0;     // fork() returns 0 in the child
+    
+    // Frame for switch_to_task: POPA, POPF, then RET into fork_return
+    *(--ktop) = (uint32_t)fork_return;
+    *(--ktop) = 0x002;                  // Kernel EFLAGS (IF restored by IRET)
+    for (int i = 0; i < 8; i++) {
+        *(--ktop) = 0;                  // PUSHA registers
+    }
+    child->esp = (uint32_t)ktop;
     
-    // Copy kernel stack
-    memcpy((void *)(child->kernel_stack_top - 4096),
-           (void *)(current_process->kernel_stack_top - 4096),
-           4096);
+    // Assign new PID
+    child->pid = next_pid++;
     
-    // Reset state
-    child->state = PROCESS_READY;
-    child->time_slice = calculate_time_slice(child->priority);
+    // Reset state (the child keeps the parent's virtual runtime)
+    child->sum_exec_runtime = 0;
+    child->prev_sum_exec_runtime = 0;
     child->total_runtime = 0;
     
     // Clear pending signals
     child->pending_signals = 0;
     
-    // Initialize list node
-    INIT_LIST_HEAD(&child->list);
-    
-    // Add to ready queue
-    list_add_tail(&child->list, &ready_queue);
+    // Add to the task list and the run queue
+    uint32_t eflags = irq_save();
+    process_add(child);
+    irq_restore(eflags);
     
     pr_info("fork: Created child process %d from parent %d\n", 
             child->pid, current_process->pid);
@@ -18,6 +18,11 @@
 #include "device.h"
 #include "elf.h"
 #include "pmm.h"
+#include "swap.h"
+#include "ksm.h"
+#include "shrinker.h"
+#include "memprof.h"
+#include "allocbench.h"
 #include "timer.h"
 #include "rtc.h"
 
@@ -63,6 +68,15 @@ static void shell_add_history(const char* cmd) {
     history_idx = history_count;
 }
 
+// CPU-bound kernel thread for the cpuhog command
+static volatile uint32_t cpuhog_spins = 0;
+
+static void cpuhog_thread(void) {
+    while (1) {
+        cpuhog_spins++;
+    }
+}
+
 static void shell_print_prompt(void) {
     vga_print_color("ValcOS", vga_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
     vga_print_color("> ", vga_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
@@ -86,8 +100,17 @@ static void shell_execute_command(const char* cmd) {
         vga_print("  about      - Show OS information\n");
         vga_print("  echo       - Print text to screen\n");
         vga_print("  timer_info - Display timer statistics\n");
+        vga_print("  sched_stats - Show context switch statistics\n");
+        vga_print("  cpuhog     - Start CPU-bound threads [count] (stop with kill)\n");
+        vga_print("  kbdlat     - Show keyboard-to-echo latency [reset]\n");
+        vga_print("  compact    - Compact physical memory [order]\n");
+        vga_print("  shrinkers  - Show reclaim watermarks and shrinkers [low high]\n");
+        vga_print("  swapon     - Swap to block device <name>, or show swap\n");
+        vga_print("  ksm        - Show same-page merging statistics\n");
         vga_print("  mem_stats  - Enhanced memory statistics\n");
         vga_print("  slabinfo   - Show slab allocator statistics\n");
+        vga_print("  memprof    - Allocation profiler [on|off|reset|<top N>]\n");
+        vga_print("  allocbench - Record/replay allocator traces [record|stop|save <f>|replay <f> [n]]\n");
         vga_print("  loglevel   - Set kernel log level <0-7>\n");
         vga_print("  test_log   - Test kernel logging\n");
         vga_print("  ktimers    - Show active kernel timers\n");
@@ -274,6 +297,217 @@ static void shell_execute_command(const char* cmd) {
         vga_print(buf);
         vga_print("\n\n");
     }
+    else if (strcmp(cmd, "sched_stats") == 0) {
+        sched_stats_t stats;
+        process_get_sched_stats(&stats);
+        
+        pr_info("\nScheduler Statistics:\n");
+        pr_info("  Context Switches:    %u\n", stats.context_switches);
+        pr_info("  CR3 Reloads:         %u\n", stats.cr3_reloads);
+        pr_info("  CR3 Reloads Skipped: %u (same address space)\n", stats.cr3_skips);
+        pr_info("  Lazy TLB Switches:   %u (kernel threads)\n", stats.lazy_switches);
+        pr_info("  Slice Preemptions:   %u\n", stats.tick_preemptions);
+        pr_info("  Wakeup Preemptions:  %u\n", stats.wakeup_preemptions);
+        pr_info("  Runnable Tasks:      %u of %u\n\n", stats.nr_running, stats.nr_tasks);
+    }
+    else if (strncmp(cmd, "cpuhog", 6) == 0 && (cmd[6] == 0 || cmd[6] == ' ')) {
+        // Parse: cpuhog [count], default 1
+        uint32_t count = 1;
+        const char *p = cmd + 6;
+        while (*p == ' ') p++;
+        if (*p >= '0' && *p <= '9') {
+            count = 0;
+            while (*p >= '0' && *p <= '9') count = count * 10 + (*p++ - '0');
+        }
+        
+        if (count == 0 || count > 8) {
+            pr_info("\nUsage: cpuhog [count 1-8]\n\n");
+        } else {
+            for (uint32_t i = 0; i < count; i++) process_create(cpuhog_thread);
+            pr_info("\nStarted %u CPU-bound thread(s): see top, stop with kill <pid>\n\n", count);
+        }
+    }
+    else if (strncmp(cmd, "kbdlat", 6) == 0 && (cmd[6] == 0 || cmd[6] == ' ')) {
+        const char *arg = cmd + 6;
+        while (*arg == ' ') arg++;
+        
+        if (strcmp(arg, "reset") == 0) {
+            keyboard_reset_latency();
+            pr_info("\nKeyboard latency statistics cleared\n\n");
+        } else if (*arg == 0) {
+            keyboard_latency_t lat;
+            keyboard_get_latency(&lat);
+            
+            pr_info("\nKeyboard-to-Echo Latency (%u keys):\n", lat.samples);
+            if (lat.samples) {
+                pr_info("  Average: %u us, max %u us, last %u us\n",
+                        lat.total_us / lat.samples, lat.max_us, lat.last_us);
+                for (int i = 0; i < KEYBOARD_LATENCY_BUCKETS - 1; i++) {
+                    pr_info("  < %u ms: %u\n", 1u << i, lat.buckets[i]);
+                }
+                pr_info("  >= %u ms: %u\n", 1u << (KEYBOARD_LATENCY_BUCKETS - 2),
+                        lat.buckets[KEYBOARD_LATENCY_BUCKETS - 1]);
+            }
+            pr_info("\n");
+        } else {
+            pr_info("\nUsage: kbdlat [reset]\n\n");
+        }
+    }
+    else if (strncmp(cmd, "compact", 7) == 0 && (cmd[7] == 0 || cmd[7] == ' ')) {
+        // Parse: compact [order], default 16 pages (64KB)
+        uint32_t order = 4;
+        const char *p = cmd + 7;
+        while (*p == ' ') p++;
+        if (*p >= '0' && *p <= '9') {
+            order = 0;
+            while (*p >= '0' && *p <= '9') order = order * 10 + (*p++ - '0');
+        }
+        
+        if (order == 0 || order >= PMM_MAX_ORDER) {
+            pr_info("\nUsage: compact [order 1-%d]\n\n", PMM_MAX_ORDER - 1);
+        } else {
+            // Build the block, then free it so it stays available
+            uint32_t block = pmm_compact(order);
+            if (block) {
+                pmm_free_order(block, order);
+                pr_info("\nCompaction: free %u KB block at 0x%x\n",
+                        (PMM_BLOCK_SIZE << order) / 1024, block);
+            } else {
+                pr_info("\nCompaction: no movable %u KB range found\n",
+                        (PMM_BLOCK_SIZE << order) / 1024);
+            }
+            
+            pmm_compact_stats_t cs;
+            pmm_get_compact_stats(&cs);
+            pr_info("  Pages Migrated:      %u (%u failed)\n", cs.pages_migrated, cs.migrate_failed);
+            pr_info("  Compaction Runs:     %u ok, %u failed\n", cs.compact_success, cs.compact_fail);
+            pr_info("  High-order Allocs:   %u ok, %u failed\n\n", cs.highorder_success, cs.highorder_fail);
+        }
+    }
+    else if (strncmp(cmd, "memprof", 7) == 0 && (cmd[7] == 0 || cmd[7] == ' ')) {
+        const char *arg = cmd + 7;
+        while (*arg == ' ') arg++;
+        
+        if (strcmp(arg, "on") == 0) {
+            memprof_enable(1);
+            pr_info("\nAllocation profiling on\n\n");
+        } else if (strcmp(arg, "off") == 0) {
+            memprof_enable(0);
+            pr_info("\nAllocation profiling off\n\n");
+        } else if (strcmp(arg, "reset") == 0) {
+            memprof_reset();
+            pr_info("\nAllocation profile cleared\n\n");
+        } else if (*arg == 0 || (*arg >= '0' && *arg <= '9')) {
+            // Parse: memprof [top N], default 10 sites
+            uint32_t top = 10;
+            if (*arg) {
+                top = 0;
+                while (*arg >= '0' && *arg <= '9') top = top * 10 + (*arg++ - '0');
+            }
+            pr_info("\n");
+            memprof_show(top);
+            pr_info("\n");
+        } else {
+            pr_info("\nUsage: memprof [on|off|reset|<top N>]\n\n");
+        }
+    }
+    else if (strncmp(cmd, "allocbench", 10) == 0 && (cmd[10] == 0 || cmd[10] == ' ')) {
+        const char *arg = cmd + 10;
+        while (*arg == ' ') arg++;
+        
+        if (strcmp(arg, "record") == 0) {
+            allocbench_record_start();
+            pr_info("\nRecording allocations\n\n");
+        } else if (strcmp(arg, "stop") == 0) {
+            allocbench_record_stop();
+            pr_info("\n");
+            allocbench_show();
+            pr_info("\n");
+        } else if (strncmp(arg, "save ", 5) == 0 && arg[5]) {
+            int count = allocbench_save(arg + 5);
+            if (count >= 0) pr_info("\nSaved %d events to %s\n\n", count, arg + 5);
+        } else if (strncmp(arg, "replay ", 7) == 0 && arg[7]) {
+            // Parse: replay <file> [iterations], default 1
+            char filename[32];
+            const char *p = arg + 7;
+            int len = 0;
+            while (*p && *p != ' ' && len < 31) filename[len++] = *p++;
+            filename[len] = '\0';
+            
+            uint32_t iterations = 1;
+            while (*p == ' ') p++;
+            if (*p >= '0' && *p <= '9') {
+                iterations = 0;
+                while (*p >= '0' && *p <= '9') iterations = iterations * 10 + (*p++ - '0');
+            }
+            
+            pr_info("\n");
+            allocbench_replay(filename, iterations);
+            pr_info("\n");
+        } else if (*arg == 0) {
+            pr_info("\n");
+            allocbench_show();
+            pr_info("\n");
+        } else {
+            pr_info("\nUsage: allocbench [record|stop|save <file>|replay <file> [runs]]\n\n");
+        }
+    }
+    else if (strncmp(cmd, "shrinkers", 9) == 0 && (cmd[9] == 0 || cmd[9] == ' ')) {
+        // Parse: shrinkers [low high], watermarks in pages
+        uint32_t marks[2] = {0, 0};
+        int count = 0;
+        const char *p = cmd + 9;
+        while (count < 2) {
+            while (*p == ' ') p++;
+            if (*p < '0' || *p > '9') break;
+            while (*p >= '0' && *p <= '9') marks[count] = marks[count] * 10 + (*p++ - '0');
+            count++;
+        }
+        while (*p == ' ') p++;
+        
+        if (count == 1 || *p) {
+            pr_info("\nUsage: shrinkers [low high]\n\n");
+        } else if (count == 2 && pmm_set_watermarks(marks[0], marks[1]) < 0) {
+            pr_info("\nshrinkers: Need 0 < low < high < total pages\n\n");
+        } else {
+            uint32_t low, high;
+            pmm_get_watermarks(&low, &high);
+            pr_info("\nWatermarks: low %u pages (%u KB), high %u pages (%u KB)\n",
+                    low, low * (PMM_BLOCK_SIZE / 1024), high, high * (PMM_BLOCK_SIZE / 1024));
+            pr_info("Free:       %u KB\n", pmm_get_free_memory() / 1024);
+            pr_info("Shrinkers:\n");
+            shrinker_show();
+            pr_info("\n");
+        }
+    }
+    else if (strncmp(cmd, "swapon", 6) == 0 && (cmd[6] == 0 || cmd[6] == ' ')) {
+        const char *name = cmd + 6;
+        while (*name == ' ') name++;
+        
+        if (*name) {
+            struct block_device *bdev = blkdev_find(name);
+            if (!bdev) pr_info("\nswapon: No such block device: %s\n", name);
+            else if (swapon(bdev) < 0) pr_info("\nswapon: Cannot swap to %s\n", name);
+        }
+        
+        swap_stats_t ss;
+        swap_get_stats(&ss);
+        pr_info("\nSwap: %u/%u pages used\n", ss.used_slots, ss.total_slots);
+        pr_info("  Swapped Out/In:    %u / %u\n", ss.swapped_out, ss.swapped_in);
+        pr_info("  LRU Active:        %u\n", ss.nr_active);
+        pr_info("  LRU Inactive:      %u\n", ss.nr_inactive);
+        pr_info("  kswapd Wakeups:    %u\n", ss.kswapd_wakeups);
+        pr_info("  Direct Reclaims:   %u\n\n", ss.direct_reclaims);
+    }
+    else if (strcmp(cmd, "ksm") == 0) {
+        ksm_stats_t ks;
+        ksm_get_stats(&ks);
+        pr_info("\nKSM: %u full scans, %u pages scanned\n", ks.full_scans, ks.pages_scanned);
+        pr_info("  Pages Shared:      %u\n", ks.pages_shared);
+        pr_info("  Pages Sharing:     %u (%u KB saved)\n", ks.pages_sharing,
+                ks.pages_sharing * (PMM_BLOCK_SIZE / 1024));
+        pr_info("  Pages Unshared:    %u\n\n", ks.pages_unshared);
+    }
     else if (strcmp(cmd, "mem_stats") == 0) {
         uint32_t total, used;
         pmm_get_stats(&total, &used);
@@ -300,6 +534,26 @@ static void shell_execute_command(const char* cmd) {
         idx=0; n=total_mem/1024;
         if(n==0) buf[idx++]='0'; else { char t[16]; int j=0; while(n>0){t[j++]='0'+(n%10);n/=10;} while(j>0) buf[idx++]=t[--j]; } buf[idx]=0;
         vga_print(buf);
+
+        uint32_t free_blocks[PMM_MAX_ORDER];
+        pmm_get_order_stats(free_blocks);
+        vga_print("\n  Buddy Free Lists (order:count):");
+        for (int order = 0; order < PMM_MAX_ORDER; order++) {
+            pr_info(" %d:%u", order, free_blocks[order]);
+        }
+
+        pmm_zero_stats_t zs;
+        pmm_get_zero_stats(&zs);
+        pr_info("\n  Zeroed Pool: %u ready, %u hits, %u misses, %u cleared at idle",
+                zs.pooled, zs.hits, zs.misses, zs.refilled);
+
+        heap_stats_t hs;
+        heap_get_stats(&hs);
+        pr_info("\n  Heap: %u/%u KB used, %u allocs, %u frees, %u failed",
+                hs.used / 1024, hs.total / 1024, hs.allocs, hs.frees, hs.failures);
+        pr_info("\n  Heap Free Blocks: %u, largest %u bytes, fragmentation %u%%",
+                hs.free_blocks, hs.largest_free, hs.fragmentation);
+        pr_info("\n  Heap Pages Grown/Released: %u / %u", hs.grown, hs.shrunk);
         vga_print("\n\n");
     }
     else if (strcmp(cmd, "slabinfo") == 0) {
@@ -402,7 +656,7 @@ static void shell_execute_command(const char* cmd) {
     }
     else if (strcmp(cmd, "lsblk") == 0) {
         pr_info("Block Devices:\n");
-        pr_info("Block device subsystem initialized\n");
+        blkdev_show_devices();
     }
     else if (strcmp(cmd, "lsdev") == 0) {
         pr_info("Devices:\n");
@@ -587,14 +841,11 @@ static void shell_execute_command(const char* cmd) {
         vga_print("---- | -------- | ------- | --------\n");
         
         // We need to iterate through processes and display stats
-        extern struct list_head ready_queue;
-        extern process_t *current_process;
-        
-        if (list_empty(&ready_queue)) {
+        if (list_empty(&task_list)) {
             vga_print("No processes.\n\n");
         } else {
             process_t *proc;
-            list_for_each_entry(proc, &ready_queue, list) {
+            list_for_each_entry(proc, &task_list, tasks) {
                 char buf[16]; int idx;
                 
                 // PID
@@ -661,6 +912,7 @@ void shell_run(void) {
         
         if (c == '\n') {
             vga_putchar('\n');
+            keyboard_echoed();
             cmd_buffer[cmd_pos] = '\0';
             shell_add_history(cmd_buffer);
             shell_execute_command(cmd_buffer);
@@ -672,6 +924,7 @@ void shell_run(void) {
             if (cmd_pos > 0) {
                 cmd_pos--;
                 vga_putchar('\b'); // Visual backspace
+                keyboard_echoed();
             }
         }
         else if (c == 0x11) { // UP Arrow
@@ -698,6 +951,7 @@ void shell_run(void) {
         else if (c >= 0x20 && cmd_pos < CMD_BUFFER_SIZE - 1) { // Standard printable
             cmd_buffer[cmd_pos++] = c;
             vga_putchar(c); // Echo character
+            keyboard_echoed();
         }
     }
 }
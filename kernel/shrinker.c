@@ -0,0 +1,59 @@
+#include "shrinker.h"
+#include "printk.h"
+#include "idt.h"
+
+static LIST_HEAD(shrinker_list);
+static int shrinking = 0;      // Shrinkers never recurse into each other
+
+int register_shrinker(struct shrinker *shrinker) {
+    if (!shrinker || !shrinker->scan) return -1;
+
+    shrinker->nr_calls = 0;
+    shrinker->pages_reclaimed = 0;
+
+    uint32_t eflags = irq_save();
+    list_add_tail(&shrinker->list, &shrinker_list);
+    irq_restore(eflags);
+    return 0;
+}
+
+void unregister_shrinker(struct shrinker *shrinker) {
+    if (!shrinker) return;
+
+    uint32_t eflags = irq_save();
+    list_del(&shrinker->list);
+    irq_restore(eflags);
+}
+
+uint32_t shrink_slab(uint32_t nr) {
+    uint32_t eflags = irq_save();
+    if (shrinking) {
+        irq_restore(eflags);
+        return 0;
+    }
+    shrinking = 1;
+
+    uint32_t freed = 0;
+    struct shrinker *shrinker;
+    list_for_each_entry(shrinker, &shrinker_list, list) {
+        if (freed >= nr) break;
+
+        uint32_t pages = shrinker->scan(nr - freed);
+        shrinker->nr_calls++;
+        shrinker->pages_reclaimed += pages;
+        freed += pages;
+    }
+
+    shrinking = 0;
+    irq_restore(eflags);
+    return freed;
+}
+
+void shrinker_show(void) {
+    struct shrinker *shrinker;
+    list_for_each_entry(shrinker, &shrinker_list, list) {
+        uint32_t count = shrinker->count ? shrinker->count() : 0;
+        pr_info("  %s: %u pages reclaimable, %u calls, %u pages reclaimed\n",
+                shrinker->name, count, shrinker->nr_calls, shrinker->pages_reclaimed);
+    }
+}
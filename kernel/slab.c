@@ -3,43 +3,103 @@
 #include "pmm.h"
 #include "printk.h"
 #include "string.h"
+#include "page.h"
+#include "idt.h"
+#include "shrinker.h"
+#include "memprof.h"
 
 // Global list of all caches
 static LIST_HEAD(cache_list);
 
-// Common size caches (for general kmalloc replacement)
+// Size class caches behind kmalloc()
 kmem_cache_t *kmalloc_caches[8] = {NULL};
 
-// Helper: Calculate number of objects that fit in a slab
-static uint32_t calculate_objects_per_slab(size_t obj_size) {
-    // Use one 4KB page per slab for simplicity
-    size_t slab_size = PMM_BLOCK_SIZE;
-    size_t usable_size = slab_size - sizeof(slab_t);
-    return usable_size / obj_size;
+// Objects at least this big get their slab descriptor off the slab page,
+// where it would take a large share of the space
+#define SLAB_OFF_SLAB_MIN (PMM_BLOCK_SIZE / 8)
+
+// Helper: Lay out a cache's slabs: the smallest order leaving at most
+// 1/8 of the slab unused, where the first object goes, how many fit and
+// how many colours the leftover space allows
+static void calculate_slab_layout(kmem_cache_t *cache) {
+    size_t header = 0;
+    if (cache->object_size >= SLAB_OFF_SLAB_MIN) {
+        cache->flags |= SLAB_OFF_SLAB;
+    } else {
+        header = (sizeof(slab_t) + cache->align - 1) & ~(cache->align - 1);
+    }
+    cache->obj_offset = header;
+    cache->objects_per_slab = 0;
+    
+    size_t left_over = 0;
+    for (uint32_t order = 0; order <= SLAB_MAX_ORDER; order++) {
+        size_t slab_size = PMM_BLOCK_SIZE << order;
+        if (slab_size < header + cache->object_size) continue;
+        
+        cache->order = order;
+        cache->objects_per_slab = (slab_size - header) / cache->object_size;
+        left_over = slab_size - header - cache->objects_per_slab * cache->object_size;
+        if (left_over * 8 <= slab_size) break;
+    }
+    
+    cache->colour_off = cache->align > SLAB_CACHE_LINE ? cache->align : SLAB_CACHE_LINE;
+    cache->colour = left_over / cache->colour_off + 1;
+    cache->colour_next = 0;
+}
+
+// Helper: Slab owning an object (from the page descriptor)
+static inline slab_t *virt_to_slab(const void *obj) {
+    // Slab pages are only reached through the linear map
+    if ((uint32_t)obj < KERNEL_VIRT_BASE || (uint32_t)obj >= KERNEL_MAP_START) return NULL;
+    
+    page_t *page = pmm_phys_to_page(virt_to_phys(obj));
+    if (!page || !(page->flags & PG_SLAB)) return NULL;
+    return (slab_t*)page->index;
 }
 
 // Helper: Allocate a new slab
 static slab_t *slab_create(kmem_cache_t *cache) {
-    // Allocate slab descriptor from general heap
-    slab_t *slab = (slab_t*)kmalloc(sizeof(slab_t));
-    if (!slab) return NULL;
-    
-    // Allocate memory for objects (one 4KB page)
-    uint32_t phys_addr = pmm_alloc_block();
-    if (!phys_addr) {
-        kfree(slab);
-        return NULL;
+    // Allocate memory for objects (2^order contiguous pages)
+    uint32_t nr_pages = 1u << cache->order;
+    uint32_t phys_addr = pmm_alloc_blocks(nr_pages);
+    if (!phys_addr) return NULL;
+    
+    // Frames are reached through the kernel's linear map
+    void *mem = phys_to_virt(phys_addr);
+    slab_t *slab;
+    
+    if (cache->flags & SLAB_OFF_SLAB) {
+        // Allocate slab descriptor from general heap (not from a kmalloc
+        // cache, which may be the one growing here)
+        slab = (slab_t*)heap_alloc(sizeof(slab_t));
+        if (!slab) {
+            pmm_free_order(phys_addr, cache->order);
+            return NULL;
+        }
+    } else {
+        slab = (slab_t*)mem;
     }
     
-    // For now, use physical address directly (identity mapping)
-    // In a real system, you'd map this to virtual memory
-    slab->mem = (void*)phys_addr;
+    // Each page points at its slab, so frees find it directly
+    for (uint32_t i = 0; i < nr_pages; i++) {
+        page_t *page = pmm_phys_to_page(phys_addr + i * PMM_BLOCK_SIZE);
+        page->flags |= PG_SLAB;
+        page->index = (uint32_t)slab;
+    }
+    
+    slab->cache = cache;
+    slab->mem = mem;
     slab->inuse = 0;
-    slab->objects = calculate_objects_per_slab(cache->object_size);
+    slab->objects = cache->objects_per_slab;
+    
+    // Colour: shift this slab's objects by the next line offset so that
+    // objects of different slabs do not all compete for the same lines
+    size_t offset = cache->obj_offset + cache->colour_next * cache->colour_off;
+    if (++cache->colour_next >= cache->colour) cache->colour_next = 0;
     
     // Initialize free list
-    slab->freelist = slab->mem;
-    slab_obj_t *obj = (slab_obj_t*)slab->mem;
+    slab->freelist = (uint8_t*)mem + offset;
+    slab_obj_t *obj = (slab_obj_t*)slab->freelist;
     
     for (uint32_t i = 0; i < slab->objects - 1; i++) {
         slab_obj_t *next = (slab_obj_t*)((uint8_t*)obj + cache->object_size);
@@ -58,50 +118,114 @@ static slab_t *slab_create(kmem_cache_t *cache) {
 static void slab_destroy(kmem_cache_t *cache, slab_t *slab) {
     if (!slab) return;
     
-    // Free the memory page
-    pmm_free_block((uint32_t)slab->mem);
-    
-    // Remove from list
+    // Remove from list (before the page holding it may go)
     list_del(&slab->list);
     
+    // Free the memory pages
+    uint32_t phys_addr = virt_to_phys(slab->mem);
+    for (uint32_t i = 0; i < (1u << cache->order); i++) {
+        pmm_phys_to_page(phys_addr + i * PMM_BLOCK_SIZE)->flags &= ~PG_SLAB;
+    }
+    
     // Free slab descriptor
-    kfree(slab);
+    if (cache->flags & SLAB_OFF_SLAB) heap_free(slab);
+    pmm_free_order(phys_addr, cache->order);
     
     cache->num_slabs--;
 }
 
+// Helper: Pages held by empty slabs beyond the one each cache keeps
+static uint32_t slab_shrink_count(void) {
+    uint32_t pages = 0;
+    kmem_cache_t *cache;
+    uint32_t eflags = irq_save();
+    
+    list_for_each_entry(cache, &cache_list, list) {
+        uint32_t empty = 0;
+        slab_t *slab;
+        list_for_each_entry(slab, &cache->slabs_empty, list) {
+            empty++;
+        }
+        if (empty > 1) pages += (empty - 1) << cache->order;
+    }
+    
+    irq_restore(eflags);
+    return pages;
+}
+
+// Helper: Shrink caches in turn until nr pages are freed
+static uint32_t slab_shrink_scan(uint32_t nr) {
+    uint32_t pages = 0;
+    kmem_cache_t *cache;
+    
+    list_for_each_entry(cache, &cache_list, list) {
+        if (pages >= nr) break;
+        pages += (uint32_t)kmem_cache_shrink(cache) << cache->order;
+    }
+    return pages;
+}
+
+static struct shrinker slab_shrinker = {
+    .name = "slab",
+    .count = slab_shrink_count,
+    .scan = slab_shrink_scan
+};
+
 void slab_init(void) {
     pr_info("Initializing Slab Allocator...\n");
     
-    // Create common size caches for general allocation
-    // These can replace kmalloc for common sizes
+    // Create common size caches for general allocation (kmalloc)
     const size_t sizes[] = {32, 64, 128, 256, 512, 1024, 2048, 4096};
     const char *names[] = {"kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256",
                            "kmalloc-512", "kmalloc-1024", "kmalloc-2048", "kmalloc-4096"};
     
     for (int i = 0; i < 8; i++) {
-        kmalloc_caches[i] = kmem_cache_create(names[i], sizes[i], 0, 0);
+        kmalloc_caches[i] = kmem_cache_create(names[i], sizes[i], 0, SLAB_HWCACHE_ALIGN);
         if (!kmalloc_caches[i]) {
             pr_warn("Failed to create %s cache\n", names[i]);
         }
     }
     
+    register_shrinker(&slab_shrinker);
+    
     pr_info("Slab Allocator initialized.\n");
 }
 
+kmem_cache_t *kmalloc_slab(size_t size) {
+    if (size == 0 || size > KMALLOC_MAX_CACHE_SIZE) return NULL;
+    
+    int index = 0;
+    while ((size_t)(KMALLOC_MIN_CACHE_SIZE << index) < size) index++;
+    return kmalloc_caches[index];
+}
+
+kmem_cache_t *virt_to_cache(const void *obj) {
+    slab_t *slab = virt_to_slab(obj);
+    return slab ? slab->cache : NULL;
+}
+
 kmem_cache_t *kmem_cache_create(const char *name, size_t size, 
                                 size_t align, uint32_t flags) {
     // Allocate cache descriptor
-    kmem_cache_t *cache = (kmem_cache_t*)kmalloc(sizeof(kmem_cache_t));
+    kmem_cache_t *cache = (kmem_cache_t*)heap_alloc(sizeof(kmem_cache_t));
     if (!cache) return NULL;
     
     // Initialize cache
     strncpy(cache->name, name, 31);
     cache->name[31] = '\0';
+    cache->size = size;
     cache->object_size = size;
     cache->align = align ? align : sizeof(void*);  // Default alignment
     cache->flags = flags;
     
+    // Cache line alignment: small objects are packed several to a line
+    // (at a power-of-two fraction of it) but never straddle two lines
+    if (flags & SLAB_HWCACHE_ALIGN) {
+        size_t ralign = SLAB_CACHE_LINE;
+        while (size <= ralign / 2) ralign /= 2;
+        if (ralign > cache->align) cache->align = ralign;
+    }
+    
     // Align object size
     cache->object_size = (cache->object_size + cache->align - 1) & ~(cache->align - 1);
     
@@ -110,6 +234,12 @@ kmem_cache_t *kmem_cache_create(const char *name, size_t size,
         cache->object_size = sizeof(slab_obj_t);
     }
     
+    calculate_slab_layout(cache);
+    if (cache->objects_per_slab == 0) {  // Larger than a slab
+        heap_free(cache);
+        return NULL;
+    }
+    
     // Initialize slab lists
     INIT_LIST_HEAD(&cache->slabs_full);
     INIT_LIST_HEAD(&cache->slabs_partial);
@@ -119,6 +249,9 @@ kmem_cache_t *kmem_cache_create(const char *name, size_t size,
     cache->num_objs = 0;
     cache->num_active = 0;
     cache->num_slabs = 0;
+    cache->magazine.avail = 0;
+    cache->mag_hits = 0;
+    cache->mag_misses = 0;
     
     // Add to global cache list
     INIT_LIST_HEAD(&cache->list);
@@ -149,12 +282,11 @@ void kmem_cache_destroy(kmem_cache_t *cache) {
     list_del(&cache->list);
     
     // Free cache descriptor
-    kfree(cache);
+    heap_free(cache);
 }
 
-void *kmem_cache_alloc(kmem_cache_t *cache) {
-    if (!cache) return NULL;
-    
+// Helper: Take an object from the slab lists (interrupts off)
+static void *slab_alloc_obj(kmem_cache_t *cache) {
     slab_t *slab = NULL;
     
     // Try to allocate from partial slab first
@@ -187,45 +319,12 @@ void *kmem_cache_alloc(kmem_cache_t *cache) {
         list_add(&slab->list, &cache->slabs_partial);
     }
     
-    // Update statistics
-    cache->num_active++;
-    cache->num_objs++;
-    
-    // Zero out the object (optional, but helpful)
-    memset(obj, 0, cache->object_size);
-    
     return (void*)obj;
 }
 
-void kmem_cache_free(kmem_cache_t *cache, void *obj) {
-    if (!cache || !obj) return;
-    
-    // Find which slab this object belongs to
-    // For simplicity, we'll search all slabs (inefficient but works)
-    // A real implementation would use page-aligned slabs and calculate slab from address
-    
-    slab_t *slab = NULL;
-    slab_t *pos;
-    
-    // Search in full slabs
-    list_for_each_entry(pos, &cache->slabs_full, list) {
-        if (obj >= pos->mem && obj < (void*)((uint8_t*)pos->mem + PMM_BLOCK_SIZE)) {
-            slab = pos;
-            break;
-        }
-    }
-    
-    // Search in partial slabs
-    if (!slab) {
-        list_for_each_entry(pos, &cache->slabs_partial, list) {
-            if (obj >= pos->mem && obj < (void*)((uint8_t*)pos->mem + PMM_BLOCK_SIZE)) {
-                slab = pos;
-                break;
-            }
-        }
-    }
-    
-    if (!slab) return;  // Object not found (error)
+// Helper: Put an object back on its slab (interrupts off)
+static void slab_free_obj(kmem_cache_t *cache, void *obj) {
+    slab_t *slab = virt_to_slab(obj);
     
     // Add object back to free list
     slab_obj_t *free_obj = (slab_obj_t*)obj;
@@ -240,9 +339,149 @@ void kmem_cache_free(kmem_cache_t *cache, void *obj) {
     } else {
         list_add(&slab->list, &cache->slabs_partial);
     }
+}
+
+// Helper: Fill an empty magazine with half a load from the slabs
+static void magazine_refill(kmem_cache_t *cache) {
+    slab_magazine_t *mag = &cache->magazine;
+    while (mag->avail < SLAB_MAGAZINE_SIZE / 2) {
+        void *obj = slab_alloc_obj(cache);
+        if (!obj) break;
+        mag->objects[mag->avail++] = obj;
+    }
+}
+
+// Helper: Return the coldest objects of a full magazine to the slabs,
+// keeping the most recently freed half
+static void magazine_flush(kmem_cache_t *cache, uint32_t nr) {
+    slab_magazine_t *mag = &cache->magazine;
+    if (nr > mag->avail) nr = mag->avail;
+    
+    for (uint32_t i = 0; i < nr; i++) {
+        slab_free_obj(cache, mag->objects[i]);
+    }
+    for (uint32_t i = nr; i < mag->avail; i++) {
+        mag->objects[i - nr] = mag->objects[i];
+    }
+    mag->avail -= nr;
+}
+
+// Helper: Check that obj came from cache
+static int slab_owns(kmem_cache_t *cache, const void *obj) {
+    slab_t *slab = virt_to_slab(obj);
+    if (slab && slab->cache == cache) return 1;
+    
+    pr_err("kmem_cache_free: %p does not belong to %s\n", obj, cache->name);
+    return 0;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache, gfp_t flags) {
+    void *obj = kmem_cache_alloc_noprof(cache, flags);
+    memprof_alloc(MEMPROF_SLAB, obj, cache ? cache->object_size : 0, __builtin_return_address(0));
+    return obj;
+}
+
+void *kmem_cache_alloc_noprof(kmem_cache_t *cache, gfp_t flags) {
+    if (!cache) return NULL;
+    
+    // kmalloc() is used from interrupt handlers too
+    uint32_t eflags = irq_save();
+    
+    slab_magazine_t *mag = &cache->magazine;
+    if (mag->avail) {
+        cache->mag_hits++;
+    } else {
+        cache->mag_misses++;
+        magazine_refill(cache);
+        if (!mag->avail) {
+            irq_restore(eflags);
+            return NULL;
+        }
+    }
+    void *obj = mag->objects[--mag->avail];
+    
+    // Update statistics
+    cache->num_active++;
+    cache->num_objs++;
+    irq_restore(eflags);
+    
+    if (flags & __GFP_ZERO) memset(obj, 0, cache->object_size);
+    
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (cache && obj) memprof_free(MEMPROF_SLAB, obj);
+    kmem_cache_free_noprof(cache, obj);
+}
+
+void kmem_cache_free_noprof(kmem_cache_t *cache, void *obj) {
+    if (!cache || !obj || !slab_owns(cache, obj)) return;
+    
+    uint32_t eflags = irq_save();
+    
+    slab_magazine_t *mag = &cache->magazine;
+    if (mag->avail < SLAB_MAGAZINE_SIZE) {
+        cache->mag_hits++;
+    } else {
+        cache->mag_misses++;
+        magazine_flush(cache, SLAB_MAGAZINE_SIZE / 2);
+    }
+    mag->objects[mag->avail++] = obj;
     
     // Update statistics
     cache->num_active--;
+    irq_restore(eflags);
+}
+
+int kmem_cache_alloc_bulk(kmem_cache_t *cache, gfp_t flags, size_t nr, void **objs) {
+    if (!cache || !objs) return 0;
+    
+    uint32_t eflags = irq_save();
+    
+    // Hot objects first, then straight from the slabs
+    slab_magazine_t *mag = &cache->magazine;
+    size_t i = 0;
+    while (i < nr && mag->avail) objs[i++] = mag->objects[--mag->avail];
+    
+    for (; i < nr; i++) {
+        objs[i] = slab_alloc_obj(cache);
+        if (!objs[i]) {
+            // All or nothing
+            while (i--) slab_free_obj(cache, objs[i]);
+            irq_restore(eflags);
+            return 0;
+        }
+    }
+    
+    cache->num_active += nr;
+    cache->num_objs += nr;
+    irq_restore(eflags);
+    
+    for (i = 0; i < nr; i++) {
+        if (flags & __GFP_ZERO) memset(objs[i], 0, cache->object_size);
+        memprof_alloc(MEMPROF_SLAB, objs[i], cache->object_size, __builtin_return_address(0));
+    }
+    return (int)nr;
+}
+
+void kmem_cache_free_bulk(kmem_cache_t *cache, size_t nr, void **objs) {
+    if (!cache || !objs) return;
+    
+    uint32_t eflags = irq_save();
+    
+    slab_magazine_t *mag = &cache->magazine;
+    for (size_t i = 0; i < nr; i++) {
+        if (!objs[i] || !slab_owns(cache, objs[i])) continue;
+        memprof_free(MEMPROF_SLAB, objs[i]);
+        
+        // Refill the magazine, the rest goes back to the slabs
+        if (mag->avail < SLAB_MAGAZINE_SIZE) mag->objects[mag->avail++] = objs[i];
+        else slab_free_obj(cache, objs[i]);
+        cache->num_active--;
+    }
+    
+    irq_restore(eflags);
 }
 
 int kmem_cache_shrink(kmem_cache_t *cache) {
@@ -250,6 +489,10 @@ int kmem_cache_shrink(kmem_cache_t *cache) {
     
     int freed = 0;
     slab_t *slab, *tmp;
+    uint32_t eflags = irq_save();
+    
+    // Cached objects keep their slabs busy
+    magazine_flush(cache, cache->magazine.avail);
     
     // Free empty slabs (keep at least one)
     int empty_count = 0;
@@ -266,15 +509,28 @@ int kmem_cache_shrink(kmem_cache_t *cache) {
         }
     }
     
+    irq_restore(eflags);
     return freed;
 }
 
 void kmem_cache_info(kmem_cache_t *cache) {
     if (!cache) return;
     
+    // Share of each slab not holding requested object bytes: leftover
+    // space, on-slab descriptor and per-object alignment padding
+    uint32_t slab_size = PMM_BLOCK_SIZE << cache->order;
+    uint32_t waste = (slab_size - cache->objects_per_slab * cache->size) * 100 / slab_size;
+    
     pr_info("Cache: %s\n", cache->name);
-    pr_info("  Object size:    %u bytes\n", cache->object_size);
+    pr_info("  Object size:    %u bytes (%u requested, align %u)\n",
+            cache->object_size, cache->size, cache->align);
+    pr_info("  Slab:           %u KB, %u objects%s, %u colours\n",
+            slab_size / 1024, cache->objects_per_slab,
+            (cache->flags & SLAB_OFF_SLAB) ? " (off-slab descriptors)" : "", cache->colour);
+    pr_info("  Waste:          %u%%\n", waste);
     pr_info("  Active objects: %u\n", cache->num_active);
+    pr_info("  Magazine:       %u/%u cached, %u hits, %u misses\n",
+            cache->magazine.avail, SLAB_MAGAZINE_SIZE, cache->mag_hits, cache->mag_misses);
     pr_info("  Total slabs:    %u\n", cache->num_slabs);
     pr_info("\n");
 }
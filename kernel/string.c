@@ -86,3 +86,14 @@ void* memcpy(void* dest, const void* src, size_t num) {
     }
     return dest;
 }
+
+int memcmp(const void* ptr1, const void* ptr2, size_t num) {
+    const unsigned char* a = (const unsigned char*)ptr1;
+    const unsigned char* b = (const unsigned char*)ptr2;
+    while (num--) {
+        if (*a != *b) return *a - *b;
+        a++;
+        b++;
+    }
+    return 0;
+}
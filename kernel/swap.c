@@ -0,0 +1,310 @@
+#include "swap.h"
+#include "mm.h"
+#include "memory.h"
+#include "printk.h"
+#include "string.h"
+#include "process.h"
+#include "idt.h"
+#include "shrinker.h"
+
+// The swap area: one block device, one reference count per page slot
+static struct {
+    struct block_device *bdev;
+    uint8_t *slot_map;          // References per slot, 0 = free
+    uint32_t nr_slots;
+    uint32_t next;              // Where the next slot search starts
+} swap_area;
+
+// LRU lists, most recently added/used at the head
+static LIST_HEAD(lru_active);
+static LIST_HEAD(lru_inactive);
+
+static swap_stats_t swap_stats;
+
+static uint32_t kswapd_pid = 0;
+static int kswapd_sleeping = 0;
+static int reclaiming = 0;      // Reclaim never recurses into itself
+
+// Helper: Claim a free slot. Returns its number or 0xFFFFFFFF.
+static uint32_t swap_alloc_slot(void) {
+    for (uint32_t i = 0; i < swap_area.nr_slots; i++) {
+        uint32_t slot = (swap_area.next + i) % swap_area.nr_slots;
+        if (!swap_area.slot_map[slot]) {
+            swap_area.slot_map[slot] = 1;
+            swap_area.next = slot + 1;
+            swap_stats.used_slots++;
+            return slot;
+        }
+    }
+    return 0xFFFFFFFF;
+}
+
+// Helper: Move one page between a frame and a slot
+static int swap_io(uint32_t slot, uint32_t phys, int rw) {
+    struct bio *bio = blkdev_alloc_bio(slot * SWAP_SECTORS_PER_PAGE, PMM_BLOCK_SIZE, rw);
+    if (!bio) return -1;
+
+    if (rw == WRITE) memcpy(bio->data, phys_to_virt(phys), PMM_BLOCK_SIZE);
+    int ret = blkdev_submit_bio(swap_area.bdev, bio);
+    if (ret >= 0 && rw == READ) memcpy(phys_to_virt(phys), bio->data, PMM_BLOCK_SIZE);
+
+    blkdev_free_bio(bio);
+    return ret < 0 ? -1 : 0;
+}
+
+int swapon(struct block_device *bdev) {
+    if (!bdev || swap_area.bdev) return -1;
+
+    uint32_t nr_slots = bdev->size / SWAP_SECTORS_PER_PAGE;
+    if (nr_slots == 0) return -1;
+
+    uint8_t *slot_map = (uint8_t *)kmalloc(nr_slots);
+    if (!slot_map) return -1;
+    memset(slot_map, 0, nr_slots);
+
+    swap_area.slot_map = slot_map;
+    swap_area.nr_slots = nr_slots;
+    swap_area.next = 0;
+    swap_area.bdev = bdev;
+    swap_stats.total_slots = nr_slots;
+    swap_stats.used_slots = 0;
+
+    pr_info("Adding %u KB swap on %s\n", nr_slots * (PMM_BLOCK_SIZE / 1024), bdev->name);
+    return 0;
+}
+
+void swap_dup(uint32_t entry) {
+    uint32_t slot = swap_entry_slot(entry);
+    if (slot < swap_area.nr_slots && swap_area.slot_map[slot] < 0xFF) {
+        swap_area.slot_map[slot]++;
+    }
+}
+
+void swap_free(uint32_t entry) {
+    uint32_t slot = swap_entry_slot(entry);
+    if (slot >= swap_area.nr_slots || !swap_area.slot_map[slot]) return;
+
+    if (--swap_area.slot_map[slot] == 0) {
+        swap_stats.used_slots--;
+        blkdev_discard(swap_area.bdev, slot * SWAP_SECTORS_PER_PAGE, SWAP_SECTORS_PER_PAGE);
+    }
+}
+
+uint32_t swap_in_page(uint32_t entry) {
+    uint32_t slot = swap_entry_slot(entry);
+    if (!swap_area.bdev || slot >= swap_area.nr_slots) return 0;
+
+    uint32_t frame = pmm_alloc_block();
+    if (!frame) return 0;
+
+    if (swap_io(slot, frame, READ) < 0) {
+        pr_err("swap: Read error on slot %u\n", slot);
+        pmm_free_block(frame);
+        return 0;
+    }
+
+    swap_free(entry);
+    swap_stats.swapped_in++;
+    return frame;
+}
+
+void lru_cache_add(uint32_t phys, uint32_t vaddr) {
+    page_t *page = pmm_phys_to_page(phys);
+    if (!page || (page->flags & PG_LRU)) return;
+
+    uint32_t eflags = irq_save();
+    page->index = vaddr & ~(PMM_BLOCK_SIZE - 1);
+    page->flags |= PG_LRU | PG_MOVABLE;
+    list_add(&page->list, &lru_inactive);
+    swap_stats.nr_inactive++;
+    irq_restore(eflags);
+}
+
+void lru_cache_del(uint32_t phys) {
+    page_t *page = pmm_phys_to_page(phys);
+    if (!page || !(page->flags & PG_LRU)) return;
+
+    uint32_t eflags = irq_save();
+    list_del(&page->list);
+    if (page->flags & PG_ACTIVE) swap_stats.nr_active--;
+    else swap_stats.nr_inactive--;
+    page->flags &= ~(PG_LRU | PG_ACTIVE);
+    irq_restore(eflags);
+}
+
+// Helper: Write an isolated page to swap and free its frame, or put it
+// back on the inactive list. The copy runs with interrupts enabled, so a
+// write to the page meanwhile keeps it. Returns 1 if the frame was freed.
+static int swap_out_page(page_t *page) {
+    uint32_t phys = pmm_page_to_phys(page);
+
+    uint32_t eflags = irq_save();
+    uint32_t slot = swap_alloc_slot();
+    int ok = slot != 0xFFFFFFFF && mm_page_mkclean(phys, page->index);
+    irq_restore(eflags);
+
+    if (ok && swap_io(slot, phys, WRITE) < 0) ok = 0;
+
+    eflags = irq_save();
+    // Forked, written to or unmapped while the I/O ran: the page stays
+    if (ok && (page->refcount != 2 ||
+               !mm_unmap_to_swap(phys, page->index, swap_entry(slot)))) {
+        ok = 0;
+    }
+
+    if (ok) {
+        pmm_free_block(phys);
+        swap_stats.swapped_out++;
+    } else {
+        if (slot != 0xFFFFFFFF) swap_free(swap_entry(slot));
+        list_add(&page->list, &lru_inactive);
+        page->flags |= PG_LRU;
+        swap_stats.nr_inactive++;
+        pmm_unref_block(phys);  // Frees it if its mapping went away
+    }
+    irq_restore(eflags);
+    return ok;
+}
+
+// Helper: Demote unreferenced pages from the tail of the active list
+static void shrink_active_list(uint32_t nr_to_scan) {
+    uint32_t eflags = irq_save();
+    while (nr_to_scan-- && !list_empty(&lru_active)) {
+        page_t *page = list_last_entry(&lru_active, page_t, list);
+
+        if (mm_page_referenced(pmm_page_to_phys(page), page->index)) {
+            list_move(&page->list, &lru_active);
+            continue;
+        }
+
+        list_move(&page->list, &lru_inactive);
+        page->flags &= ~PG_ACTIVE;
+        swap_stats.nr_active--;
+        swap_stats.nr_inactive++;
+    }
+    irq_restore(eflags);
+}
+
+// Helper: Take the tail of the inactive list off for swap-out, promoting
+// it instead if it was used since it was last looked at. The page is
+// pinned so it cannot be freed, migrated or merged during its I/O.
+// Returns NULL if the page stays on the lists.
+static page_t *isolate_inactive_page(void) {
+    uint32_t eflags = irq_save();
+    if (list_empty(&lru_inactive)) {
+        irq_restore(eflags);
+        return NULL;
+    }
+
+    page_t *page = list_last_entry(&lru_inactive, page_t, list);
+
+    if (mm_page_referenced(pmm_page_to_phys(page), page->index)) {
+        list_move(&page->list, &lru_active);
+        page->flags |= PG_ACTIVE;
+        swap_stats.nr_inactive--;
+        swap_stats.nr_active++;
+        page = NULL;
+    } else if (page->refcount != 1) {
+        // Pages shared after fork stay: each mapping would need the entry
+        list_move(&page->list, &lru_inactive);  // Rotate
+        page = NULL;
+    } else {
+        list_del(&page->list);
+        page->flags &= ~PG_LRU;
+        page->refcount++;
+        swap_stats.nr_inactive--;
+    }
+    irq_restore(eflags);
+    return page;
+}
+
+// Helper: Reclaim from the tail of the inactive list
+static uint32_t shrink_inactive_list(uint32_t nr_to_scan, uint32_t nr_to_reclaim) {
+    uint32_t reclaimed = 0;
+
+    while (nr_to_scan-- && reclaimed < nr_to_reclaim && !list_empty(&lru_inactive)) {
+        page_t *page = isolate_inactive_page();
+        if (page && swap_out_page(page)) reclaimed++;
+    }
+    return reclaimed;
+}
+
+uint32_t try_to_free_pages(uint32_t nr) {
+    uint32_t eflags = irq_save();
+    if (!swap_area.bdev || reclaiming) {
+        irq_restore(eflags);
+        return 0;
+    }
+    reclaiming = 1;
+    irq_restore(eflags);
+
+    // Keep the inactive list at least as long as the active one
+    if (swap_stats.nr_active > swap_stats.nr_inactive) {
+        shrink_active_list(swap_stats.nr_active - swap_stats.nr_inactive);
+    }
+
+    uint32_t reclaimed = shrink_inactive_list(swap_stats.nr_inactive, nr);
+
+    // Everything was referenced once: a second pass finds it aged
+    if (reclaimed < nr) {
+        shrink_active_list(swap_stats.nr_active);
+        reclaimed += shrink_inactive_list(swap_stats.nr_inactive, nr - reclaimed);
+    }
+
+    if (current_process && current_process->pid != kswapd_pid) {
+        swap_stats.direct_reclaims++;
+    }
+
+    reclaiming = 0;
+    return reclaimed;
+}
+
+void wakeup_kswapd(void) {
+    if (!kswapd_sleeping) return;
+
+    kswapd_sleeping = 0;
+    swap_stats.kswapd_wakeups++;
+    process_unblock(kswapd_pid);
+}
+
+// Helper: Free frames below the high watermark
+static uint32_t kswapd_shortfall(void) {
+    uint32_t free = pmm_get_free_memory() / PMM_BLOCK_SIZE, high;
+    pmm_get_watermarks(NULL, &high);
+    return free < high ? high - free : 0;
+}
+
+// Background reclaim thread: sleeps until memory runs low, then shrinks
+// caches and swaps out until the high watermark is restored
+static void kswapd(void) {
+    kswapd_pid = current_process->pid;
+
+    while (1) {
+        while (kswapd_shortfall()) {
+            // Caches are cheaper to give back than user pages
+            uint32_t freed = shrink_slab(SWAP_CLUSTER);
+            if (kswapd_shortfall()) freed += try_to_free_pages(SWAP_CLUSTER);
+            if (!freed) break;
+            process_yield();
+        }
+
+        // No wakeup may slip in between the flag and the block
+        uint32_t eflags = irq_save();
+        kswapd_sleeping = 1;
+        process_block(kswapd_pid);
+        irq_restore(eflags);
+    }
+}
+
+void kswapd_init(void) {
+    uint32_t low, high;
+    pmm_get_watermarks(&low, &high);
+
+    process_create(kswapd);
+    pr_info("kswapd started (watermarks %u/%u KB)\n",
+            low * (PMM_BLOCK_SIZE / 1024), high * (PMM_BLOCK_SIZE / 1024));
+}
+
+void swap_get_stats(swap_stats_t *stats) {
+    if (stats) *stats = swap_stats;
+}
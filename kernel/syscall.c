@@ -5,9 +5,7 @@
 #include "signal.h"
 #include "elf.h"
 #include "memory.h"
-
-// Heap management
-static void *heap_end = (void *)0x80000000;  // Start heap at 2GB
+#include "mm.h"
 
 void sys_exit(int status) {
     pr_info("Process %d exiting with status %d\n", current_process->pid, status);
@@ -58,18 +56,19 @@ int sys_getpid(void) {
 }
 
 int sys_brk(void *addr) {
-    // Simple heap management
+    if (!current_process || !current_process->mm) return -1;
+    mm_struct_t *mm = current_process->mm;
+    
+    // brk(0) queries the current break
     if (addr == NULL) {
-        return (int)heap_end;
+        return (int)mm->brk;
     }
     
-    // Validate address
-    if (addr < (void *)0x80000000 || addr > (void *)0xC0000000) {
-        return -1;  // Invalid address
+    // Heap pages are populated on first touch
+    if (mm_brk(mm, (uint32_t)addr) != (uint32_t)addr) {
+        return -1;  // Invalid address or out of memory
     }
-    
-    heap_end = addr;
-    return (int)heap_end;
+    return (int)mm->brk;
 }
 
 void syscall_handler(registers_t *regs) {
@@ -3,6 +3,8 @@
 #include "string.h"
 #include "vga.h"
 #include "process.h"
+#include "mm.h"
+#include "swap.h"
 
 // Page Directory Entry (PDE)
 // Bit 0: Present
@@ -11,162 +13,690 @@
 // ...
 // Bit 12-31: Page Table Address (Physical)
 
+// Bit 7: Page Size (PSE: entry maps a 4MB page instead of a table)
+// Bit 22-31: 4MB Page Address (Physical, PSE only)
+
 // Page Table Entry (PTE)
 // Bit 12-31: Physical Frame Address
 
 #define PAGES_PER_TABLE 1024
 #define TABLES_PER_DIR  1024
 
-// Kernel Page Directory (pointers to Page Tables)
+// First directory slot of the kernel half (0xC0000000)
+#define KERNEL_PDE_START (KERNEL_VIRT_BASE >> 22)
+
+// Boot page directory built by kernel_entry.asm; it becomes the kernel's
+extern uint32_t boot_page_directory[];
+
+// Kernel Page Directory (virtual pointer and physical address for CR3)
 static uint32_t *kernel_directory = 0;
+static uint32_t kernel_directory_phys = 0;
+
+// CPUID.1:EDX feature bits
+#define CPUID_FEAT_PSE  (1 << 3)
+#define CPUID_FEAT_PGE  (1 << 13)
+
+// CR4 bits
+#define CR4_PSE         (1 << 4)
+#define CR4_PGE         (1 << 7)
+
+// 4MB pages available and enabled
+static int pse_enabled = 0;
+
+// Global pages enabled: kernel mappings are tagged PTE_GLOBAL so they
+// survive CR3 reloads (they are identical in every address space)
+static int pge_enabled = 0;
 
 uint32_t vmm_get_kernel_directory(void) {
-    return (uint32_t)kernel_directory;
+    return kernel_directory_phys;
 }
 
 void vmm_switch_directory(uint32_t dir_phys) {
     __asm__ volatile("mov %0, %%cr3" :: "r"(dir_phys));
 }
 
-void vmm_map_page(uint32_t phys, uint32_t virt, uint32_t flags) {
-    // 1. Calculate Directory Index and Table Index
-    uint32_t pd_index = virt >> 22;
-    uint32_t pt_index = (virt >> 12) & 0x03FF;
+uint32_t vmm_get_current_directory(void) {
+    uint32_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    return cr3;
+}
+
+// Helper: Find the page table behind one directory slot, allocating it
+// when create is set. Tables of the active directory are reached
+// through the recursive slot, others through the linear map.
+static uint32_t *vmm_get_table(uint32_t dir_phys, uint32_t pd_index, uint32_t flags, int create) {
+    // The recursive slot is not a page table
+    if (pd_index == RECURSIVE_PDE) return 0;
+    
+    // Kernel tables are shared by every directory: edit the kernel's
+    if (pd_index >= KERNEL_PDE_START) dir_phys = kernel_directory_phys;
     
-    // 2. Check if Page Table exists
-    uint32_t pde = kernel_directory[pd_index];
+    int active = (dir_phys == vmm_get_current_directory());
+    uint32_t *dir = active ? (uint32_t*)PAGE_DIR_VIRT : (uint32_t*)phys_to_virt(dir_phys);
+    
+    // Check if Page Table exists
+    uint32_t pde = dir[pd_index];
+    
+    // 4MB page: there is no table to walk
+    if (pde & PTE_PSE) return 0;
     
     uint32_t *table; // Virtual address of the table
     
     if (!(pde & PTE_PRESENT)) {
-        // Table not present, allocate it
+        if (!create) return 0;
+        
+        // Table not present, allocate it. Not from pmm_alloc_zeroed():
+        // during vmm_init the frame may not be mapped yet, so clear it
+        // through the window that maps the table below.
         uint32_t new_table_phys = pmm_alloc_block();
         if (!new_table_phys) {
             vga_print("VMM: Out of memory alloc table!\n");
-            return;
+            return 0;
         }
         
-        // In our identity mapped Kernel, Phys = Virt for this stage
-        table = (uint32_t*)new_table_phys;
+        // Add Entry to Directory
+        uint32_t user = (pd_index < KERNEL_PDE_START) ? (flags & PTE_USER) : 0;
+        dir[pd_index] = new_table_phys | PTE_PRESENT | PTE_RW | user;
+        
+        if (active) {
+            table = (uint32_t*)(PAGE_TABLES_BASE + pd_index * PAGE_SIZE);
+            __asm__ volatile("invlpg (%0)" :: "r" (table) : "memory");
+        } else {
+            table = (uint32_t*)phys_to_virt(new_table_phys);
+        }
         
         // Clear the new table
         memset((uint8_t*)table, 0, 4096);
-        
-        // Add Entry to Directory
-        kernel_directory[pd_index] = new_table_phys | PTE_PRESENT | PTE_RW | (flags & PTE_USER); 
     } else {
         // Table exists
-        if (flags & PTE_USER) {
-            kernel_directory[pd_index] |= PTE_USER;
+        if ((flags & PTE_USER) && pd_index < KERNEL_PDE_START) {
+            dir[pd_index] |= PTE_USER;
         }
         
-        // Extract Physical Address
-        uint32_t table_phys = pde & 0xFFFFF000;
-        table = (uint32_t*)table_phys; 
+        if (active) {
+            table = (uint32_t*)(PAGE_TABLES_BASE + pd_index * PAGE_SIZE);
+        } else {
+            table = (uint32_t*)phys_to_virt(pde & 0xFFFFF000);
+        }
     }
     
-    // 3. Set Page Table Entry
-    table[pt_index] = (phys & 0xFFFFF000) | flags;
+    return table;
+}
+
+// Helper: Find the PTE for virt in a directory (see vmm_get_table)
+static uint32_t *vmm_walk(uint32_t dir_phys, uint32_t virt, uint32_t flags, int create) {
+    uint32_t *table = vmm_get_table(dir_phys, virt >> 22, flags, create);
+    if (!table) return 0;
     
-    // 4. Invalidate TLB
+    return &table[(virt >> 12) & 0x03FF];
+}
+
+// Helper: Invalidate one TLB entry if dir is the active directory
+// (kernel mappings are shared, so they are always live)
+static inline void vmm_invalidate(uint32_t dir_phys, uint32_t virt) {
+    if (virt >= KERNEL_VIRT_BASE || dir_phys == vmm_get_current_directory()) {
+        __asm__ volatile("invlpg (%0)" :: "r" (virt) : "memory");
+    }
+}
+
+void vmm_map_page(uint32_t phys, uint32_t virt, uint32_t flags) {
+    uint32_t *pte = vmm_walk(kernel_directory_phys, virt, flags, 1);
+    if (!pte) return;
+    
+    if (pge_enabled && virt >= KERNEL_VIRT_BASE) flags |= PTE_GLOBAL;
+    
+    // Set Page Table Entry
+    *pte = (phys & 0xFFFFF000) | flags;
+    
+    // Invalidate TLB
     __asm__ volatile("invlpg (%0)" :: "r" (virt) : "memory");
 }
 
 void vmm_unmap_page(uint32_t virt) {
-    uint32_t pd_index = virt >> 22;
-    uint32_t pt_index = (virt >> 12) & 0x03FF;
+    uint32_t *pte = vmm_walk(kernel_directory_phys, virt, 0, 0);
+    if (!pte) return; // Table doesn't exist
     
-    uint32_t pde = kernel_directory[pd_index];
-    if (!(pde & PTE_PRESENT)) return; // Table doesn't exist
-    
-    uint32_t *table = (uint32_t*)(pde & 0xFFFFF000);
-    table[pt_index] = 0; // Clear entry
+    *pte = 0; // Clear entry
     
     // Invalidate TLB
     __asm__ volatile("invlpg (%0)" :: "r" (virt) : "memory");
 }
 
-uint32_t vmm_get_physical_address(uint32_t virt) {
-    uint32_t pd_index = virt >> 22;
-    uint32_t pt_index = (virt >> 12) & 0x03FF;
-    uint32_t offset = virt & 0xFFF;
+int vmm_map_page_dir(uint32_t dir_phys, uint32_t phys, uint32_t virt, uint32_t flags) {
+    // The top 1GB belongs to the kernel in every address space
+    if ((flags & PTE_USER) && virt >= KERNEL_VIRT_BASE) {
+        vga_print("VMM: User mapping in kernel space refused!\n");
+        return 0;
+    }
     
-    uint32_t pde = kernel_directory[pd_index];
-    if (!(pde & PTE_PRESENT)) return 0;
+    uint32_t *pte = vmm_walk(dir_phys, virt, flags, 1);
+    if (!pte) return 0;
     
-    uint32_t *table = (uint32_t*)(pde & 0xFFFFF000);
-    uint32_t pte = table[pt_index];
+    *pte = (phys & 0xFFFFF000) | flags;
+    vmm_invalidate(dir_phys, virt);
+    return 1;
+}
+
+uint32_t vmm_unmap_page_dir(uint32_t dir_phys, uint32_t virt) {
+    uint32_t *pte = vmm_walk(dir_phys, virt, 0, 0);
+    if (!pte || !(*pte & PTE_PRESENT)) return 0;
     
-    if (!(pte & PTE_PRESENT)) return 0;
+    uint32_t phys = *pte & 0xFFFFF000;
+    *pte = 0;
+    vmm_invalidate(dir_phys, virt);
     
-    return (pte & 0xFFFFF000) | offset;
+    return phys;
 }
 
-void vmm_enable_paging(void) {
-    uint32_t cr0;
-    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
-    cr0 |= 0x80000000;
-    __asm__ volatile("mov %0, %%cr0" :: "r"(cr0));
+uint32_t vmm_get_pte(uint32_t dir_phys, uint32_t virt) {
+    uint32_t *pte = vmm_walk(dir_phys, virt, 0, 0);
+    return pte ? *pte : 0;
 }
 
-void vmm_load_directory(uint32_t dir_phys) {
-    __asm__ volatile("mov %0, %%cr3" :: "r"(dir_phys));
+void vmm_set_pte(uint32_t dir_phys, uint32_t virt, uint32_t value) {
+    uint32_t *pte = vmm_walk(dir_phys, virt, 0, 0);
+    if (!pte) return;
+    
+    *pte = value;
+    vmm_invalidate(dir_phys, virt);
 }
 
-void vmm_init(void) {
-    vga_print("Initializing VMM...\n");
+// Helper: May this frame only become writable through COW? True while
+// it is shared after fork, and for a KSM page even with one mapper left
+// (it stays in the stable tree until a write fault makes it private).
+static int vmm_frame_shared(uint32_t phys) {
+    if (pmm_block_refcount(phys) > 1) return 1;
+    page_t *page = pmm_phys_to_page(phys);
+    return page && (page->flags & PG_KSM);
+}
+
+int vmm_protect_page_dir(uint32_t dir_phys, uint32_t virt, uint32_t flags) {
+    uint32_t *pte = vmm_walk(dir_phys, virt, 0, 0);
+    if (!pte || !(*pte & PTE_PRESENT)) return 0;
+    
+    uint32_t phys = *pte & 0xFFFFF000;
+    flags &= ~PTE_COW;
+    
+    // A shared frame only becomes writable through COW
+    if ((flags & PTE_RW) && vmm_frame_shared(phys)) {
+        flags = (flags & ~PTE_RW) | PTE_COW;
+    }
+    
+    *pte = phys | flags | (*pte & (PTE_ACCESSED | PTE_DIRTY));
+    vmm_invalidate(dir_phys, virt);
+    
+    return 1;
+}
+
+// ============================================================================
+// RANGE OPERATIONS
+// ============================================================================
+
+// Above this many pages one full flush is cheaper than single invlpgs
+#define TLB_FLUSH_CEILING 32
+
+// Pending TLB invalidations of one range operation
+typedef struct {
+    uint32_t addrs[TLB_FLUSH_CEILING];
+    uint32_t count;
+    int full;       // Too many pages: flush everything instead
+    int global;     // Kernel (global) pages involved
+} tlb_batch_t;
+
+// Helper: Record that the translation of virt in dir changed. Only
+// mappings that can be cached (active directory or kernel half) count.
+static void tlb_batch_add(tlb_batch_t *batch, uint32_t dir_phys, uint32_t virt) {
+    if (virt < KERNEL_VIRT_BASE && dir_phys != vmm_get_current_directory()) return;
     
-    // 1. Allocate Kernel Directory
-    uint32_t dir_phys = pmm_alloc_block();
-    if (!dir_phys) {
-        vga_print("VMM: Failed to alloc directory!\n");
+    if (virt >= KERNEL_VIRT_BASE) batch->global = 1;
+    if (batch->full) return;
+    
+    if (batch->count == TLB_FLUSH_CEILING) {
+        batch->full = 1;
+        return;
+    }
+    batch->addrs[batch->count++] = virt;
+}
+
+// Helper: Flush everything, including global entries (toggling CR4.PGE)
+static void vmm_flush_tlb_all(void) {
+    if (!pge_enabled) {
+        vmm_flush_tlb();
         return;
     }
     
-    kernel_directory = (uint32_t*)dir_phys;
-    memset((uint8_t*)kernel_directory, 0, 4096);
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    __asm__ volatile("mov %0, %%cr4" :: "r"(cr4 & ~CR4_PGE) : "memory");
+    __asm__ volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+}
+
+// Helper: Apply the collected invalidations
+static void tlb_batch_flush(tlb_batch_t *batch) {
+    if (batch->full) {
+        if (batch->global) vmm_flush_tlb_all();
+        else vmm_flush_tlb();
+        return;
+    }
+    
+    for (uint32_t i = 0; i < batch->count; i++) {
+        __asm__ volatile("invlpg (%0)" :: "r" (batch->addrs[i]) : "memory");
+    }
+}
+
+int vmm_map_range(uint32_t dir_phys, uint32_t phys, uint32_t virt, uint32_t size, uint32_t flags) {
+    if ((flags & PTE_USER) && (virt >= KERNEL_VIRT_BASE || virt + size > KERNEL_VIRT_BASE)) {
+        vga_print("VMM: User mapping in kernel space refused!\n");
+        return -1;
+    }
     
-    // 2. Identity Map Kernel (0 - 8MB for kernel + heap area)
-    // The heap in memory.c is at 2MB, so we need to map at least up to 3MB
-    for (uint32_t addr = 0; addr < 0x800000; addr += PAGE_SIZE) {
-        vmm_map_page(addr, addr, PTE_PRESENT | PTE_RW);
+    uint32_t global = (pge_enabled && virt >= KERNEL_VIRT_BASE) ? PTE_GLOBAL : 0;
+    uint32_t end = virt + (size & ~(PAGE_SIZE - 1));
+    tlb_batch_t batch = {0};
+    int ret = 0;
+    
+    // One table lookup per 4MB, then straight PTE stores
+    while (virt < end) {
+        uint32_t *table = vmm_get_table(dir_phys, virt >> 22, flags, 1);
+        if (!table) {
+            ret = -1;
+            break;
+        }
+        
+        uint32_t table_end = (virt & LARGE_PAGE_MASK) + LARGE_PAGE_SIZE;
+        if (table_end > end || table_end == 0) table_end = end;
+        
+        for (; virt < table_end; virt += PAGE_SIZE, phys += PAGE_SIZE) {
+            uint32_t *pte = &table[(virt >> 12) & 0x03FF];
+            if (*pte & PTE_PRESENT) tlb_batch_add(&batch, dir_phys, virt);
+            *pte = (phys & 0xFFFFF000) | flags | global;
+        }
     }
     
-    // 3. Load CR3
-    vmm_load_directory(dir_phys);
+    tlb_batch_flush(&batch);
+    return ret;
+}
+
+void vmm_unmap_range(uint32_t dir_phys, uint32_t virt, uint32_t size, int release) {
+    uint32_t end = virt + (size & ~(PAGE_SIZE - 1));
+    tlb_batch_t batch = {0};
     
-    // 4. Enable Paging
-    vmm_enable_paging();
+    while (virt < end) {
+        uint32_t table_end = (virt & LARGE_PAGE_MASK) + LARGE_PAGE_SIZE;
+        if (table_end > end || table_end == 0) table_end = end;
+        
+        // Nothing mapped in this 4MB: skip it whole
+        uint32_t *table = vmm_get_table(dir_phys, virt >> 22, 0, 0);
+        if (!table) {
+            virt = table_end;
+            continue;
+        }
+        
+        for (; virt < table_end; virt += PAGE_SIZE) {
+            uint32_t *pte = &table[(virt >> 12) & 0x03FF];
+            if (!(*pte & PTE_PRESENT)) {
+                // Swapped out: only the slot is left to release
+                if (pte_is_swap(*pte)) {
+                    if (release) swap_free(*pte);
+                    *pte = 0;
+                }
+                continue;
+            }
+            
+            if (release) pmm_unref_block(*pte & 0xFFFFF000);
+            *pte = 0;
+            tlb_batch_add(&batch, dir_phys, virt);
+        }
+    }
     
-    vga_print("Paging Enabled!\n");
+    tlb_batch_flush(&batch);
 }
 
-uint32_t vmm_clone_directory(void) {
+void vmm_protect_range(uint32_t dir_phys, uint32_t virt, uint32_t size, uint32_t flags) {
+    uint32_t end = virt + (size & ~(PAGE_SIZE - 1));
+    tlb_batch_t batch = {0};
+    
+    flags &= ~PTE_COW;
+    if (pge_enabled && virt >= KERNEL_VIRT_BASE) flags |= PTE_GLOBAL;
+    
+    while (virt < end) {
+        uint32_t table_end = (virt & LARGE_PAGE_MASK) + LARGE_PAGE_SIZE;
+        if (table_end > end || table_end == 0) table_end = end;
+        
+        uint32_t *table = vmm_get_table(dir_phys, virt >> 22, 0, 0);
+        if (!table) {
+            virt = table_end;
+            continue;
+        }
+        
+        for (; virt < table_end; virt += PAGE_SIZE) {
+            uint32_t *pte = &table[(virt >> 12) & 0x03FF];
+            if (!(*pte & PTE_PRESENT)) continue;
+            
+            // A shared frame only becomes writable through COW
+            uint32_t phys = *pte & 0xFFFFF000;
+            uint32_t new_flags = flags;
+            if ((flags & PTE_RW) && vmm_frame_shared(phys)) {
+                new_flags = (flags & ~PTE_RW) | PTE_COW;
+            }
+            
+            // Accessed/dirty are the CPU's: compare and keep them as they are
+            uint32_t cpu_bits = *pte & (PTE_ACCESSED | PTE_DIRTY);
+            if ((*pte & 0xFFF & ~(PTE_ACCESSED | PTE_DIRTY)) != new_flags) {
+                *pte = phys | new_flags | cpu_bits;
+                tlb_batch_add(&batch, dir_phys, virt);
+            }
+        }
+    }
+    
+    tlb_batch_flush(&batch);
+}
+
+uint32_t vmm_replace_frame_range(uint32_t dir_phys, uint32_t virt, uint32_t size,
+                                 uint32_t old_phys, uint32_t new_phys) {
+    uint32_t end = virt + (size & ~(PAGE_SIZE - 1));
+    tlb_batch_t batch = {0};
+    uint32_t count = 0;
+    
+    while (virt < end) {
+        uint32_t table_end = (virt & LARGE_PAGE_MASK) + LARGE_PAGE_SIZE;
+        if (table_end > end || table_end == 0) table_end = end;
+        
+        uint32_t *table = vmm_get_table(dir_phys, virt >> 22, 0, 0);
+        if (!table) {
+            virt = table_end;
+            continue;
+        }
+        
+        for (; virt < table_end; virt += PAGE_SIZE) {
+            uint32_t *pte = &table[(virt >> 12) & 0x03FF];
+            if (!(*pte & PTE_PRESENT) || (*pte & 0xFFFFF000) != old_phys) continue;
+            
+            *pte = new_phys | (*pte & 0xFFF);
+            tlb_batch_add(&batch, dir_phys, virt);
+            count++;
+        }
+    }
+    
+    tlb_batch_flush(&batch);
+    return count;
+}
+
+// Helper: Read CPUID leaf 1 feature flags (EDX)
+static uint32_t vmm_cpu_features(void) {
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return edx;
+}
+
+int vmm_pse_enabled(void) {
+    return pse_enabled;
+}
+
+// Helper: Install a 4MB page in a directory slot (no checks)
+static void vmm_set_large(uint32_t *dir, uint32_t pd_index, uint32_t phys, uint32_t flags) {
+    uint32_t user = (pd_index < KERNEL_PDE_START) ? (flags & PTE_USER) : 0;
+    uint32_t global = (pd_index >= KERNEL_PDE_START && pge_enabled) ? PTE_GLOBAL : 0;
+    dir[pd_index] = (phys & LARGE_PAGE_MASK) | PTE_PSE | (flags & (PTE_PRESENT | PTE_RW)) | user | global;
+}
+
+int vmm_map_large_dir(uint32_t dir_phys, uint32_t phys, uint32_t virt, uint32_t flags) {
+    if (!pse_enabled) return -1;
+    if ((phys | virt) & ~LARGE_PAGE_MASK) return -1;  // Must be 4MB aligned
+    
+    uint32_t pd_index = virt >> 22;
+    if (pd_index == RECURSIVE_PDE) return -1;
+    if ((flags & PTE_USER) && virt >= KERNEL_VIRT_BASE) return -1;
+    
+    if (pd_index >= KERNEL_PDE_START) dir_phys = kernel_directory_phys;
+    uint32_t *dir = (dir_phys == vmm_get_current_directory()) ?
+                    (uint32_t*)PAGE_DIR_VIRT : (uint32_t*)phys_to_virt(dir_phys);
+    
+    // Never replace a page table (its 4KB mappings would be lost)
+    uint32_t pde = dir[pd_index];
+    if ((pde & PTE_PRESENT) && !(pde & PTE_PSE)) return -1;
+    
+    vmm_set_large(dir, pd_index, phys, flags);
+    vmm_invalidate(dir_phys, virt);
+    return 0;
+}
+
+int vmm_map_large(uint32_t phys, uint32_t virt, uint32_t flags) {
+    return vmm_map_large_dir(kernel_directory_phys, phys, virt, flags);
+}
+
+uint32_t vmm_get_physical_address(uint32_t virt) {
+    // The active directory is always visible through the recursive slot
+    uint32_t pde = ((uint32_t*)PAGE_DIR_VIRT)[virt >> 22];
+    if ((pde & PTE_PRESENT) && (pde & PTE_PSE)) {
+        return (pde & LARGE_PAGE_MASK) | (virt & ~LARGE_PAGE_MASK);
+    }
+    
+    uint32_t *pte = vmm_walk(vmm_get_current_directory(), virt, 0, 0);
+    if (!pte || !(*pte & PTE_PRESENT)) return 0;
+    
+    return (*pte & 0xFFFFF000) | (virt & 0xFFF);
+}
+
+void vmm_flush_tlb(void) {
+    uint32_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
+}
+
+void vmm_init(void) {
+    vga_print("Initializing VMM...\n");
+    
+    // 1. Adopt the boot directory (paging is already on, see
+    // kernel_entry.asm); it maps the first 8MB at 3GB and at 0
+    kernel_directory = boot_page_directory;
+    kernel_directory_phys = virt_to_phys(boot_page_directory);
+    
+    // 2. Enable 4MB and global pages if the CPU has them
+    uint32_t features = vmm_cpu_features();
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (features & CPUID_FEAT_PSE) {
+        cr4 |= CR4_PSE;
+        pse_enabled = 1;
+    }
+    if (features & CPUID_FEAT_PGE) {
+        cr4 |= CR4_PGE;
+        pge_enabled = 1;
+    }
+    __asm__ volatile("mov %0, %%cr4" :: "r"(cr4));
+    
+    // 3. Linear map of all RAM managed by the PMM at 3GB, since frames
+    // (page tables, slabs, user pages) are accessed through it. Whole
+    // 4MB chunks take one directory entry each (this also replaces the
+    // boot page tables, which map the same addresses); the tail uses
+    // 4KB pages.
+    uint32_t map_end = pmm_get_total_memory();
+    if (map_end < BOOT_MAPPED_END) map_end = BOOT_MAPPED_END;
+    uint32_t addr = 0;
+    if (pse_enabled) {
+        for (; addr + LARGE_PAGE_SIZE <= map_end; addr += LARGE_PAGE_SIZE) {
+            vmm_set_large(kernel_directory, (uint32_t)phys_to_virt(addr) >> 22,
+                          addr, PTE_PRESENT | PTE_RW);
+        }
+        vmm_flush_tlb();
+    }
+    vmm_map_range(kernel_directory_phys, addr, (uint32_t)phys_to_virt(addr),
+                  map_end - addr, PTE_PRESENT | PTE_RW);
+    
+    // 4. Give the kernel mapping area its page tables up front so that
+    // directories created later share them
+    for (uint32_t pd = KERNEL_MAP_START >> 22; pd < RECURSIVE_PDE; pd++) {
+        vmm_walk(kernel_directory_phys, pd << 22, PTE_RW, 1);
+    }
+    
+    // 5. Drop the boot identity map: the low 3GB is user space
+    for (uint32_t pd = 0; pd < KERNEL_PDE_START; pd++) {
+        kernel_directory[pd] = 0;
+    }
+    vmm_flush_tlb();
+    
+    vga_print("Paging Enabled!");
+    if (pse_enabled) vga_print(" [4MB pages]");
+    if (pge_enabled) vga_print(" [global pages]");
+    vga_print("\n");
+}
+
+// Helper: Allocate a directory holding only the shared kernel half
+static uint32_t vmm_alloc_directory(void) {
+    uint32_t dir_phys = pmm_alloc_zeroed();  // User half starts empty
+    if (!dir_phys) return 0;
+    
+    uint32_t *dir = (uint32_t*)phys_to_virt(dir_phys);
+    for (uint32_t i = KERNEL_PDE_START; i < RECURSIVE_PDE; i++) {
+        dir[i] = kernel_directory[i];
+    }
+    dir[RECURSIVE_PDE] = dir_phys | PTE_PRESENT | PTE_RW;
+    
+    return dir_phys;
+}
+
+uint32_t vmm_create_directory(void) {
+    return vmm_alloc_directory();
+}
+
+uint32_t vmm_clone_directory(uint32_t src_phys) {
+    uint32_t *src = (uint32_t*)phys_to_virt(src_phys);
+    
     // Allocate new directory
-    uint32_t new_dir_phys = pmm_alloc_block();
+    uint32_t new_dir_phys = vmm_alloc_directory();
     if (!new_dir_phys) return 0;
     
-    uint32_t *new_dir = (uint32_t*)new_dir_phys;
-    memset((uint8_t*)new_dir, 0, 4096);
+    uint32_t *new_dir = (uint32_t*)phys_to_virt(new_dir_phys);
     
-    // Copy kernel mappings (first 768 entries for lower 3GB)
-    // User space would be entries 0-767, kernel is 768-1023
-    for (int i = 0; i < 768; i++) {
-        new_dir[i] = kernel_directory[i];
+    for (uint32_t i = 0; i < KERNEL_PDE_START; i++) {
+        uint32_t pde = src[i];
+        if (!(pde & PTE_PRESENT)) continue;
+        
+        // 4MB user pages map memory owned elsewhere (e.g. a
+        // framebuffer): both address spaces simply share them
+        if (pde & PTE_PSE) {
+            new_dir[i] = pde;
+            continue;
+        }
+        
+        // User tables get a private copy. Writable user pages become
+        // read-only + COW in both parent and child, and every user
+        // frame gains a reference instead of being copied.
+        uint32_t new_table_phys = pmm_alloc_block();
+        if (!new_table_phys) {
+            vmm_free_directory(new_dir_phys);
+            vmm_flush_tlb();
+            return 0;
+        }
+        
+        uint32_t *src_table = (uint32_t*)phys_to_virt(pde & 0xFFFFF000);
+        uint32_t *new_table = (uint32_t*)phys_to_virt(new_table_phys);
+        
+        for (int j = 0; j < PAGES_PER_TABLE; j++) {
+            uint32_t pte = src_table[j];
+            if (pte & PTE_PRESENT) {
+                if (pte & PTE_RW) {
+                    pte = (pte & ~PTE_RW) | PTE_COW;
+                    src_table[j] = pte;
+                }
+                pmm_ref_block(pte & 0xFFFFF000);
+            } else if (pte_is_swap(pte)) {
+                swap_dup(pte);
+            }
+            new_table[j] = pte;
+        }
+        
+        new_dir[i] = new_table_phys | (pde & 0xFFF);
     }
     
-    // Share kernel space (768-1023)
-    for (int i = 768; i < 1024; i++) {
-        new_dir[i] = kernel_directory[i];
-    }
+    // Parent lost write access to its user pages
+    vmm_flush_tlb();
     
     return new_dir_phys;
 }
 
+void vmm_free_directory(uint32_t dir_phys) {
+    if (!dir_phys || dir_phys == kernel_directory_phys) return;
+    
+    uint32_t *dir = (uint32_t*)phys_to_virt(dir_phys);
+    
+    // Only the user half is owned; kernel tables are shared
+    for (uint32_t i = 0; i < KERNEL_PDE_START; i++) {
+        uint32_t pde = dir[i];
+        if (!(pde & PTE_PRESENT) || (pde & PTE_PSE)) continue;
+        
+        uint32_t *table = (uint32_t*)phys_to_virt(pde & 0xFFFFF000);
+        for (int j = 0; j < PAGES_PER_TABLE; j++) {
+            uint32_t pte = table[j];
+            if (pte & PTE_PRESENT) {
+                pmm_unref_block(pte & 0xFFFFF000);
+            } else if (pte_is_swap(pte)) {
+                swap_free(pte);
+            }
+        }
+        pmm_free_block(pde & 0xFFFFF000);
+    }
+    
+    pmm_free_block(dir_phys);
+}
+
+// Helper: Resolve a write to a copy-on-write page in the active directory.
+// Returns 1 if the fault was handled.
+static int vmm_handle_cow(uint32_t fault_addr) {
+    uint32_t *pte = vmm_walk(vmm_get_current_directory(), fault_addr, 0, 0);
+    if (!pte || !(*pte & PTE_PRESENT) || !(*pte & PTE_COW)) return 0;
+    
+    uint32_t old_phys = *pte & 0xFFFFF000;
+    uint32_t flags = (*pte & 0xFFF & ~PTE_COW) | PTE_RW;
+    
+    if (pmm_block_refcount(old_phys) > 1) {
+        // Still shared: give this address space its own copy
+        uint32_t new_phys = pmm_alloc_block();
+        if (!new_phys) return 0;
+        
+        memcpy(phys_to_virt(new_phys), phys_to_virt(old_phys), PAGE_SIZE);
+        *pte = new_phys | flags;
+        lru_cache_add(new_phys, fault_addr);
+        pmm_unref_block(old_phys);
+    } else {
+        // Last user of the frame: just make it writable again. A
+        // merged page is private from now on and may change.
+        page_t *page = pmm_phys_to_page(old_phys);
+        if (page) page->flags &= ~PG_KSM;
+        *pte = old_phys | flags;
+    }
+    
+    __asm__ volatile("invlpg (%0)" :: "r" (fault_addr) : "memory");
+    return 1;
+}
+
 void page_fault_handler(uint32_t err_code) {
     uint32_t fault_addr;
     __asm__ volatile("mov %%cr2, %0" : "=r" (fault_addr));
     
+    // Write to a present page: copy-on-write after fork. With CR0.WP
+    // this includes the kernel writing to a user buffer (sys_read).
+    int user_addr = fault_addr < KERNEL_VIRT_BASE;
+    if ((err_code & 1) && (err_code & 2) && user_addr && vmm_handle_cow(fault_addr)) {
+        return;
+    }
+    
+    // Untouched page of a user region: populate it on demand
+    if (mm_handle_fault(fault_addr, err_code)) {
+        return;
+    }
+    
+    // Bad user access, by the process or by the kernel on its behalf:
+    // stop the process instead of the whole system
+    if (((err_code & 4) || (user_addr && current_process && current_process->mm)) &&
+        current_process && current_process->pid != 0) {
+        vga_print_color("Segmentation fault\n", 0x0C);
+        current_process->state = PROCESS_TERMINATED;
+        process_yield();
+        while(1) __asm__ volatile("hlt");
+    }
+    
     vga_print_color("\n========== PAGE FAULT ==========\n", 0x0C);
     
     const char *digits = "0123456789ABCDEF";